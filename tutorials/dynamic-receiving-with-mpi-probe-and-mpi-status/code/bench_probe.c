@@ -0,0 +1,146 @@
+// Author: Wes Kendall
+// Copyright 2011 www.mpitutorial.com
+// This code is provided freely with the tutorials on mpitutorial.com. Feel
+// free to modify it for your own use. Any distribution of the code must
+// either provide a link to www.mpitutorial.com or keep this header intact.
+//
+// Message rate benchmark of receiving messages of unknown size. Every process
+// except rank zero sends num_messages messages of 0 to max_count integers to
+// rank zero, which receives them from any source either with the pattern of
+// probe.c (MPI_Probe, malloc, MPI_Recv and free) or with TMPI_Receiver. The
+// results are printed as CSV.
+//
+#include <stdio.h>
+#include <stdlib.h>
+#include <mpi.h>
+#include "tmpi_receiver.h"
+
+#define BENCH_TAG 0
+
+// Returns the size of message i, so that the sizes vary without a random
+// number generator
+int get_message_count(int i, int max_count) {
+  return (int)(((long long)i * 7919) % (max_count + 1));
+}
+
+// What the receiver keeps track of to check that every message arrived
+typedef struct {
+  long long num_numbers;
+  long long sum;
+} ReceiveTotals;
+
+// Adds a message to the totals
+void add_message(const int *numbers, int count, ReceiveTotals *totals) {
+  totals->num_numbers += count;
+  if (count > 0) {
+    totals->sum += numbers[0];
+  }
+}
+
+// The callback of TMPI_Receiver_dispatch
+void add_message_callback(const TMPI_Message *message, void *user_data) {
+  add_message((const int *)message->data, message->count,
+              (ReceiveTotals *)user_data);
+}
+
+// Receives messages with MPI_Probe, malloc and MPI_Recv like probe.c
+void probe_receive(int num_messages, ReceiveTotals *totals) {
+  int i;
+  for (i = 0; i < num_messages; i++) {
+    MPI_Status status;
+    MPI_Probe(MPI_ANY_SOURCE, BENCH_TAG, MPI_COMM_WORLD, &status);
+    int count;
+    MPI_Get_count(&status, MPI_INT, &count);
+    int *numbers = (int *)malloc(sizeof(int) * count);
+    MPI_Recv(numbers, count, MPI_INT, status.MPI_SOURCE, BENCH_TAG,
+             MPI_COMM_WORLD, MPI_STATUS_IGNORE);
+    add_message(numbers, count, totals);
+    free(numbers);
+  }
+}
+
+// Sends the messages to rank zero. The first number of message i is i.
+void send_messages(int num_messages, int max_count, int *numbers) {
+  int i;
+  for (i = 0; i < num_messages; i++) {
+    numbers[0] = i;
+    MPI_Send(numbers, get_message_count(i, max_count), MPI_INT, 0, BENCH_TAG,
+             MPI_COMM_WORLD);
+  }
+}
+
+int main(int argc, char** argv) {
+  if (argc != 3) {
+    fprintf(stderr, "Usage: bench_probe num_messages max_count\n");
+    exit(1);
+  }
+  int num_messages = atoi(argv[1]);
+  int max_count = atoi(argv[2]);
+
+  MPI_Init(NULL, NULL);
+
+  int world_size;
+  MPI_Comm_size(MPI_COMM_WORLD, &world_size);
+  if (world_size < 2) {
+    fprintf(stderr, "Must use at least two processes for this example\n");
+    MPI_Abort(MPI_COMM_WORLD, 1);
+  }
+  int world_rank;
+  MPI_Comm_rank(MPI_COMM_WORLD, &world_rank);
+
+  // The totals every run should reach
+  ReceiveTotals expected = {0, 0};
+  int i;
+  for (i = 0; i < num_messages; i++) {
+    int count = get_message_count(i, max_count);
+    expected.num_numbers += count;
+    expected.sum += count > 0 ? i : 0;
+  }
+  expected.num_numbers *= world_size - 1;
+  expected.sum *= world_size - 1;
+  int total_messages = num_messages * (world_size - 1);
+
+  int *numbers = (int *)malloc(sizeof(int) * (max_count + 1));
+  TMPI_Receiver receiver;
+  TMPI_Receiver_create(MPI_COMM_WORLD, MPI_INT, &receiver);
+  if (world_rank == 0) {
+    printf("implementation,senders,messages,max_bytes,seconds,"
+           "messages_per_second,allocations\n");
+  }
+
+  int use_receiver;
+  for (use_receiver = 0; use_receiver < 2; use_receiver++) {
+    MPI_Barrier(MPI_COMM_WORLD);
+    double time = -MPI_Wtime();
+    if (world_rank == 0) {
+      ReceiveTotals totals = {0, 0};
+      long long allocations = receiver.pool.num_allocations;
+      if (use_receiver) {
+        TMPI_Receiver_dispatch(&receiver, MPI_ANY_SOURCE, BENCH_TAG,
+                               total_messages, &add_message_callback, &totals);
+        allocations = receiver.pool.num_allocations - allocations;
+      } else {
+        probe_receive(total_messages, &totals);
+        allocations = total_messages;
+      }
+      time += MPI_Wtime();
+      if (totals.num_numbers != expected.num_numbers ||
+          totals.sum != expected.sum) {
+        fprintf(stderr, "Received %lld numbers with sum %lld instead of %lld "
+                "with sum %lld\n", totals.num_numbers, totals.sum,
+                expected.num_numbers, expected.sum);
+        MPI_Abort(MPI_COMM_WORLD, 1);
+      }
+      printf("%s,%d,%d,%d,%f,%.0f,%lld\n",
+             use_receiver ? "TMPI_Receiver" : "MPI_Probe", world_size - 1,
+             total_messages, (int)sizeof(int) * max_count, time,
+             total_messages / time, allocations);
+    } else {
+      send_messages(num_messages, max_count, numbers);
+    }
+  }
+
+  TMPI_Receiver_free(&receiver);
+  free(numbers);
+  MPI_Finalize();
+}
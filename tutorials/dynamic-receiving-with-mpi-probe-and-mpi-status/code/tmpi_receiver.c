@@ -0,0 +1,245 @@
+// Author: Wes Kendall
+// Copyright 2011 www.mpitutorial.com
+// This code is provided freely with the tutorials on mpitutorial.com. Feel
+// free to modify it for your own use. Any distribution of the code must
+// either provide a link to www.mpitutorial.com or keep this header intact.
+//
+// Receiving messages of unknown size at high rates. The pattern of probe.c,
+// MPI_Probe followed by malloc and MPI_Recv, allocates and frees a buffer for
+// every message, and another thread can receive the probed message before
+// MPI_Recv does. TMPI_Receiver matches the message when it probes, so
+// MPI_Mrecv always receives the probed message, and takes the buffers from a
+// pool that stops allocating once it holds enough buffers of every size.
+//
+#include <stdlib.h>
+#include <mpi.h>
+#include "tmpi_receiver.h"
+
+// Every pooled buffer starts with a header. Free buffers are linked through
+// it, and it remembers the size class. It is 16 bytes so that the data stays
+// aligned for any type.
+typedef union {
+  struct {
+    void *next;
+    int size_class;
+  } info;
+  char padding[16];
+} BufferHeader;
+
+// Returns the smallest size class whose buffers hold size bytes, or
+// TMPI_POOL_NUM_CLASSES if the buffer is too large to pool
+static int get_size_class(size_t size) {
+  int size_class = 0;
+  while (size_class < TMPI_POOL_NUM_CLASSES &&
+         ((size_t)1 << size_class) < size) {
+    size_class++;
+  }
+  return size_class;
+}
+
+void TMPI_Buffer_pool_init(TMPI_Buffer_pool *pool) {
+  int i;
+  for (i = 0; i < TMPI_POOL_NUM_CLASSES; i++) {
+    pool->free_buffers[i] = NULL;
+  }
+  pool->num_allocations = 0;
+}
+
+void *TMPI_Buffer_pool_get(TMPI_Buffer_pool *pool, size_t size) {
+  int size_class = get_size_class(size);
+  BufferHeader *header;
+  if (size_class < TMPI_POOL_NUM_CLASSES &&
+      pool->free_buffers[size_class] != NULL) {
+    header = (BufferHeader *)pool->free_buffers[size_class];
+    pool->free_buffers[size_class] = header->info.next;
+  } else {
+    size_t buffer_size = size_class < TMPI_POOL_NUM_CLASSES ?
+      (size_t)1 << size_class : size;
+    header = (BufferHeader *)malloc(sizeof(BufferHeader) + buffer_size);
+    if (header == NULL) {
+      return NULL;
+    }
+    header->info.size_class = size_class;
+    pool->num_allocations++;
+  }
+  return header + 1;
+}
+
+void TMPI_Buffer_pool_put(TMPI_Buffer_pool *pool, void *buffer) {
+  BufferHeader *header = (BufferHeader *)buffer - 1;
+  int size_class = header->info.size_class;
+  if (size_class < TMPI_POOL_NUM_CLASSES) {
+    header->info.next = pool->free_buffers[size_class];
+    pool->free_buffers[size_class] = header;
+  } else {
+    free(header);
+  }
+}
+
+void TMPI_Buffer_pool_free(TMPI_Buffer_pool *pool) {
+  int i;
+  for (i = 0; i < TMPI_POOL_NUM_CLASSES; i++) {
+    while (pool->free_buffers[i] != NULL) {
+      BufferHeader *header = (BufferHeader *)pool->free_buffers[i];
+      pool->free_buffers[i] = header->info.next;
+      free(header);
+    }
+  }
+}
+
+int TMPI_Receiver_create(MPI_Comm comm, MPI_Datatype datatype,
+                         TMPI_Receiver *receiver) {
+  receiver->comm = comm;
+  receiver->datatype = datatype;
+  MPI_Type_size(datatype, &receiver->datatype_size);
+  TMPI_Buffer_pool_init(&receiver->pool);
+  receiver->queue_capacity = 16;
+  receiver->queue = (TMPI_Message *)malloc(sizeof(TMPI_Message) *
+                                           receiver->queue_capacity);
+  receiver->queue_start = 0;
+  receiver->queue_size = 0;
+  return receiver->queue == NULL ? MPI_ERR_NO_MEM : MPI_SUCCESS;
+}
+
+int TMPI_Receiver_free(TMPI_Receiver *receiver) {
+  TMPI_Message message;
+  while (TMPI_Receiver_next(receiver, &message)) {
+    TMPI_Receiver_release(receiver, &message);
+  }
+  TMPI_Buffer_pool_free(&receiver->pool);
+  free(receiver->queue);
+  return MPI_SUCCESS;
+}
+
+// Makes room for one more message in the queue. The queue doubles when it is
+// full.
+static int reserve_queue_slot(TMPI_Receiver *receiver) {
+  if (receiver->queue_size == receiver->queue_capacity) {
+    int capacity = 2 * receiver->queue_capacity;
+    TMPI_Message *queue = (TMPI_Message *)malloc(sizeof(TMPI_Message) *
+                                                 capacity);
+    if (queue == NULL) {
+      return MPI_ERR_NO_MEM;
+    }
+    int i;
+    for (i = 0; i < receiver->queue_size; i++) {
+      queue[i] = receiver->queue[(receiver->queue_start + i) %
+                                 receiver->queue_capacity];
+    }
+    free(receiver->queue);
+    receiver->queue = queue;
+    receiver->queue_capacity = capacity;
+    receiver->queue_start = 0;
+  }
+  return MPI_SUCCESS;
+}
+
+// Adds a message to the end of the queue, which must have room for it
+static void enqueue_message(TMPI_Receiver *receiver,
+                            const TMPI_Message *message) {
+  receiver->queue[(receiver->queue_start + receiver->queue_size) %
+                  receiver->queue_capacity] = *message;
+  receiver->queue_size++;
+}
+
+// Receives a matched message into a pooled buffer and queues it. The queue
+// grows before the message is received, so that a received message is never
+// dropped. A matched message that cannot be received because memory runs out
+// is lost, and the error is returned.
+static int receive_matched_message(TMPI_Receiver *receiver,
+                                   MPI_Message *matched, MPI_Status *status) {
+  int error = reserve_queue_slot(receiver);
+  if (error != MPI_SUCCESS) {
+    return error;
+  }
+  TMPI_Message message;
+  MPI_Get_count(status, receiver->datatype, &message.count);
+  message.source = status->MPI_SOURCE;
+  message.tag = status->MPI_TAG;
+  message.data = TMPI_Buffer_pool_get(
+    &receiver->pool, (size_t)message.count * receiver->datatype_size);
+  if (message.data == NULL) {
+    return MPI_ERR_NO_MEM;
+  }
+  error = MPI_Mrecv(message.data, message.count, receiver->datatype, matched,
+                    MPI_STATUS_IGNORE);
+  if (error != MPI_SUCCESS) {
+    TMPI_Buffer_pool_put(&receiver->pool, message.data);
+    return error;
+  }
+  enqueue_message(receiver, &message);
+  return MPI_SUCCESS;
+}
+
+int TMPI_Receiver_poll(TMPI_Receiver *receiver, int source, int tag,
+                       int *num_received) {
+  *num_received = 0;
+  while (1) {
+    int flag;
+    MPI_Message matched;
+    MPI_Status status;
+    int error = MPI_Improbe(source, tag, receiver->comm, &flag, &matched,
+                            &status);
+    if (error != MPI_SUCCESS || !flag) {
+      return error;
+    }
+    error = receive_matched_message(receiver, &matched, &status);
+    if (error != MPI_SUCCESS) {
+      return error;
+    }
+    (*num_received)++;
+  }
+}
+
+int TMPI_Receiver_wait(TMPI_Receiver *receiver, int source, int tag) {
+  MPI_Message matched;
+  MPI_Status status;
+  int error = MPI_Mprobe(source, tag, receiver->comm, &matched, &status);
+  if (error != MPI_SUCCESS) {
+    return error;
+  }
+  return receive_matched_message(receiver, &matched, &status);
+}
+
+int TMPI_Receiver_next(TMPI_Receiver *receiver, TMPI_Message *message) {
+  if (receiver->queue_size == 0) {
+    return 0;
+  }
+  *message = receiver->queue[receiver->queue_start];
+  receiver->queue_start = (receiver->queue_start + 1) %
+    receiver->queue_capacity;
+  receiver->queue_size--;
+  return 1;
+}
+
+void TMPI_Receiver_release(TMPI_Receiver *receiver, TMPI_Message *message) {
+  TMPI_Buffer_pool_put(&receiver->pool, message->data);
+  message->data = NULL;
+}
+
+int TMPI_Receiver_dispatch(TMPI_Receiver *receiver, int source, int tag,
+                           int num_messages, TMPI_Message_callback callback,
+                           void *user_data) {
+  int num_dispatched = 0;
+  while (num_dispatched < num_messages) {
+    // Take everything that has arrived, and only block when nothing has
+    if (receiver->queue_size == 0) {
+      int num_received;
+      int error = TMPI_Receiver_poll(receiver, source, tag, &num_received);
+      if (error == MPI_SUCCESS && num_received == 0) {
+        error = TMPI_Receiver_wait(receiver, source, tag);
+      }
+      if (error != MPI_SUCCESS) {
+        return error;
+      }
+    }
+    TMPI_Message message;
+    while (num_dispatched < num_messages &&
+           TMPI_Receiver_next(receiver, &message)) {
+      callback(&message, user_data);
+      TMPI_Receiver_release(receiver, &message);
+      num_dispatched++;
+    }
+  }
+  return MPI_SUCCESS;
+}
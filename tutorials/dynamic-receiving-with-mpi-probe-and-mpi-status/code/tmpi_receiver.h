@@ -0,0 +1,99 @@
+// Author: Wes Kendall
+// Copyright 2011 www.mpitutorial.com
+// This code is provided freely with the tutorials on mpitutorial.com. Feel
+// free to modify it for your own use. Any distribution of the code must
+// either provide a link to www.mpitutorial.com or keep this header intact.
+//
+// Header file for TMPI_Receiver, which receives messages of unknown size
+//
+#ifndef __TMPI_RECEIVER_H
+#define __TMPI_RECEIVER_H 1
+
+#include <stddef.h>
+
+// The amount of size classes of TMPI_Buffer_pool. Class c holds buffers of
+// 2^c bytes, and larger buffers are not pooled.
+#define TMPI_POOL_NUM_CLASSES 28
+
+// A pool of buffers that are reused instead of freed. Buffer sizes are
+// rounded up to a power of two so that a buffer can be reused for any size
+// of its class.
+typedef struct {
+  void *free_buffers[TMPI_POOL_NUM_CLASSES];
+  // The amount of buffers that were allocated and not reused
+  long long num_allocations;
+} TMPI_Buffer_pool;
+
+void TMPI_Buffer_pool_init(TMPI_Buffer_pool *pool);
+
+// Returns a buffer of at least size bytes
+void *TMPI_Buffer_pool_get(TMPI_Buffer_pool *pool, size_t size);
+
+// Returns a buffer from TMPI_Buffer_pool_get to the pool
+void TMPI_Buffer_pool_put(TMPI_Buffer_pool *pool, void *buffer);
+
+// Frees all buffers in the pool
+void TMPI_Buffer_pool_free(TMPI_Buffer_pool *pool);
+
+// A received message. The data belongs to the receiver until it is released.
+typedef struct {
+  void *data;
+  int count;
+  int source;
+  int tag;
+} TMPI_Message;
+
+// Called for every message received by TMPI_Receiver_dispatch. The message
+// is released after the call.
+typedef void (*TMPI_Message_callback)(const TMPI_Message *message,
+                                      void *user_data);
+
+// Receives messages of datatype elements without knowing their size. Messages
+// are matched with MPI_Improbe or MPI_Mprobe and received with MPI_Mrecv, so
+// another thread that probes the same communicator cannot receive a message
+// in between. The messages are put in a queue, and their buffers come from a
+// pool of the receiver. A receiver itself must only be used by one thread at
+// a time.
+typedef struct {
+  MPI_Comm comm;
+  MPI_Datatype datatype;
+  int datatype_size;
+  TMPI_Buffer_pool pool;
+  // The queue is a ring of queue_capacity messages, and the oldest message is
+  // at queue_start
+  TMPI_Message *queue;
+  int queue_capacity;
+  int queue_start;
+  int queue_size;
+} TMPI_Receiver;
+
+int TMPI_Receiver_create(MPI_Comm comm, MPI_Datatype datatype,
+                         TMPI_Receiver *receiver);
+
+// Frees the receiver and the buffers of all messages, including the ones
+// that are still queued
+int TMPI_Receiver_free(TMPI_Receiver *receiver);
+
+// Queues the messages from source with tag that have arrived without waiting
+// for more, and sets num_received to the amount of messages that were queued.
+// Stops at the first error and returns it.
+int TMPI_Receiver_poll(TMPI_Receiver *receiver, int source, int tag,
+                       int *num_received);
+
+// Waits for a message from source with tag and queues it. Returns the error
+// of the probe or of the receive if either fails.
+int TMPI_Receiver_wait(TMPI_Receiver *receiver, int source, int tag);
+
+// Takes the oldest message out of the queue. Returns 0 if the queue is empty.
+int TMPI_Receiver_next(TMPI_Receiver *receiver, TMPI_Message *message);
+
+// Returns the buffer of a message from TMPI_Receiver_next to the pool
+void TMPI_Receiver_release(TMPI_Receiver *receiver, TMPI_Message *message);
+
+// Receives num_messages messages from source with tag and calls callback for
+// each of them in the order they were received
+int TMPI_Receiver_dispatch(TMPI_Receiver *receiver, int source, int tag,
+                           int num_messages, TMPI_Message_callback callback,
+                           void *user_data);
+
+#endif
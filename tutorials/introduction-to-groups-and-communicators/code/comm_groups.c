@@ -22,12 +22,27 @@ int main(int argc, char **argv) {
   MPI_Group world_group;
   MPI_Comm_group(MPI_COMM_WORLD, &world_group);
 
-  int n = 7;
-  const int ranks[7] = {1, 2, 3, 5, 7, 11, 13};
+  // Find the prime ranks below world_size, so that the program works with
+  // any amount of processes. Like the list in the lesson, it starts at 1,
+  // which gives {1, 2, 3, 5, 7, 11, 13} with 16 processes.
+  int *ranks = (int *)malloc(sizeof(int) * world_size);
+  int n = 0;
+  int i, j;
+  for (i = 1; i < world_size; i++) {
+    int is_prime = 1;
+    for (j = 2; j * j <= i; j++) {
+      if (i % j == 0) {
+        is_prime = 0;
+      }
+    }
+    if (is_prime) {
+      ranks[n++] = i;
+    }
+  }
 
   // Construct a group containing all of the prime ranks in world_group
   MPI_Group prime_group;
-  MPI_Group_incl(world_group, 7, ranks, &prime_group);
+  MPI_Group_incl(world_group, n, ranks, &prime_group);
 
   // Create a new communicator based on the group
   MPI_Comm prime_comm;
@@ -46,6 +61,7 @@ int main(int argc, char **argv) {
 
   MPI_Group_free(&world_group);
   MPI_Group_free(&prime_group);
+  free(ranks);
 
   if (MPI_COMM_NULL != prime_comm) {
     MPI_Comm_free(&prime_comm);
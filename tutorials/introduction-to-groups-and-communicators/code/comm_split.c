@@ -4,12 +4,47 @@
 // free to modify it for your own use. Any distribution of the code must
 // either provide a link to www.mpitutorial.com or keep this header intact.
 //
-// Example using MPI_Comm_split to divide a communicator into subcommunicators
+// Example using MPI_Comm_split to divide a communicator into subcommunicators.
+// The rows of four processes are only an example. The program then gets the
+// communicators of the nodes and sockets that the processes actually run on
+// from TMPI_Topology, along with a 2D grid in which every node owns a block.
 //
 
 #include <stdlib.h>
 #include <stdio.h>
 #include <mpi.h>
+#include "tmpi_topology.h"
+
+// Prints the communicators of the topology and the place of this process in
+// a 2D grid, and checks the node-aware reduction against MPI_Allreduce
+void print_topology(int world_rank, int world_size) {
+  TMPI_Topology *topology;
+  TMPI_Topology_get(MPI_COMM_WORLD, &topology);
+  int node_rank, node_size, socket_rank, socket_size;
+  MPI_Comm_rank(topology->node_comm, &node_rank);
+  MPI_Comm_size(topology->node_comm, &node_size);
+  MPI_Comm_rank(topology->socket_comm, &socket_rank);
+  MPI_Comm_size(topology->socket_comm, &socket_size);
+
+  int periods[2] = {0, 0};
+  MPI_Comm grid_comm;
+  TMPI_Topology_get_grid(MPI_COMM_WORLD, 2, periods, &grid_comm);
+  int grid_rank, dims[2], grid_periods[2], coords[2];
+  MPI_Comm_rank(grid_comm, &grid_rank);
+  MPI_Cart_get(grid_comm, 2, dims, grid_periods, coords);
+
+  long long sum, node_sum;
+  long long rank = world_rank;
+  MPI_Allreduce(&rank, &sum, 1, MPI_LONG_LONG, MPI_SUM, MPI_COMM_WORLD);
+  TMPI_Node_allreduce(&rank, &node_sum, 1, MPI_LONG_LONG, MPI_SUM,
+                      MPI_COMM_WORLD);
+
+  printf("WORLD RANK/SIZE: %d/%d --- NODE %d/%d RANK/SIZE: %d/%d --- "
+         "SOCKET RANK/SIZE: %d/%d --- GRID %dx%d COORDS: (%d, %d)%s\n",
+         world_rank, world_size, topology->node, topology->num_nodes,
+         node_rank, node_size, socket_rank, socket_size, dims[0], dims[1],
+         coords[0], coords[1], sum == node_sum ? "" : " --- REDUCTION FAILED");
+}
 
 int main(int argc, char **argv) {
   MPI_Init(NULL, NULL);
@@ -34,5 +69,8 @@ int main(int argc, char **argv) {
 
   MPI_Comm_free(&row_comm);
 
+  print_topology(world_rank, world_size);
+  TMPI_Topology_free(MPI_COMM_WORLD);
+
   MPI_Finalize();
 }
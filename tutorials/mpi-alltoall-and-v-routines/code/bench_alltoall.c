@@ -0,0 +1,163 @@
+// Author: Wes Kendall
+// Copyright 2014 www.mpitutorial.com
+// This code is provided freely with the tutorials on mpitutorial.com. Feel
+// free to modify it for your own use. Any distribution of the code must
+// either provide a link to www.mpitutorial.com or keep this header intact.
+//
+// Benchmark of the flat MPI_Alltoallv against the two-level TMPI_Alltoallv.
+// Every process sends message_size bytes to every process, and the message
+// sizes are swept in powers of two. The results are printed as CSV. Every
+// result is checked, so the benchmark also tests TMPI_Alltoallv.
+//
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <mpi.h>
+#include "tmpi_alltoallv.h"
+#include "tmpi_bench.h"
+#include "tmpi_topology.h"
+
+// The buffers of one exchange of message_size bytes between every pair of
+// processes
+typedef struct {
+  char *send_data;
+  char *recv_data;
+  int *counts;
+  int *offsets;
+  int hierarchical;
+  TMPI_Hierarchy *hierarchy;
+} AlltoallTrial;
+
+// The byte at index i of the message from process source to process dest
+char get_message_byte(int source, int dest, int i) {
+  return (char)(source * 7 + dest * 3 + i);
+}
+
+// Returns the amount of bytes that process world_rank received wrong
+long long count_errors(const char *recv_data, int message_size, int world_rank,
+                       int world_size) {
+  long long errors = 0;
+  int source, i;
+  for (source = 0; source < world_size; source++) {
+    for (i = 0; i < message_size; i++) {
+      if (recv_data[(long long)message_size * source + i] !=
+          get_message_byte(source, world_rank, i)) {
+        errors++;
+      }
+    }
+  }
+  return errors;
+}
+
+void run_alltoallv(void *arg) {
+  AlltoallTrial *trial = (AlltoallTrial *)arg;
+  if (trial->hierarchical) {
+    TMPI_Alltoallv(trial->send_data, trial->counts, trial->offsets,
+                   trial->recv_data, trial->counts, trial->offsets, MPI_BYTE,
+                   trial->hierarchy);
+  } else {
+    MPI_Alltoallv(trial->send_data, trial->counts, trial->offsets, MPI_BYTE,
+                  trial->recv_data, trial->counts, trial->offsets, MPI_BYTE,
+                  MPI_COMM_WORLD);
+  }
+}
+
+// Times num_trials exchanges of message_size bytes between every pair of
+// processes. The time of a trial is the time of the slowest process. The
+// sorted trial times are returned on rank zero.
+double *time_alltoallv(int message_size, int num_trials, int hierarchical,
+                       TMPI_Hierarchy *hierarchy) {
+  int world_rank, world_size;
+  MPI_Comm_rank(MPI_COMM_WORLD, &world_rank);
+  MPI_Comm_size(MPI_COMM_WORLD, &world_size);
+  long long buffer_size = (long long)message_size * world_size;
+  AlltoallTrial trial;
+  trial.send_data = (char *)malloc(buffer_size);
+  trial.recv_data = (char *)malloc(buffer_size);
+  trial.counts = (int *)malloc(sizeof(int) * world_size);
+  trial.offsets = (int *)malloc(sizeof(int) * world_size);
+  trial.hierarchical = hierarchical;
+  trial.hierarchy = hierarchy;
+  memset(trial.recv_data, 0, buffer_size);
+  int dest, i;
+  for (dest = 0; dest < world_size; dest++) {
+    trial.counts[dest] = message_size;
+    trial.offsets[dest] = message_size * dest;
+    for (i = 0; i < message_size; i++) {
+      trial.send_data[(long long)message_size * dest + i] =
+        get_message_byte(world_rank, dest, i);
+    }
+  }
+
+  // The first trial is not timed so that the connections are set up, and its
+  // result is checked
+  run_alltoallv(&trial);
+  long long errors = count_errors(trial.recv_data, message_size, world_rank,
+                                  world_size);
+  if (errors > 0) {
+    fprintf(stderr, "%s on process %d has %lld wrong bytes out of %lld\n",
+            hierarchical ? "TMPI_Alltoallv" : "MPI_Alltoallv", world_rank,
+            errors, buffer_size);
+    MPI_Abort(MPI_COMM_WORLD, 1);
+  }
+  double *sorted_times = TMPI_Bench_time(&run_alltoallv, &trial, 0, num_trials,
+                                         MPI_COMM_WORLD);
+
+  free(trial.send_data);
+  free(trial.recv_data);
+  free(trial.counts);
+  free(trial.offsets);
+  return sorted_times;
+}
+
+int main(int argc, char** argv) {
+  if (argc != 3) {
+    fprintf(stderr, "Usage: bench_alltoall max_message_size num_trials\n");
+    exit(1);
+  }
+
+  int max_message_size = atoi(argv[1]);
+  int num_trials = atoi(argv[2]);
+  if (num_trials < 1) {
+    num_trials = 1;
+  }
+
+  MPI_Init(NULL, NULL);
+
+  int world_rank;
+  MPI_Comm_rank(MPI_COMM_WORLD, &world_rank);
+  int world_size;
+  MPI_Comm_size(MPI_COMM_WORLD, &world_size);
+
+  TMPI_Hierarchy hierarchy;
+  TMPI_Hierarchy_create(MPI_COMM_WORLD, &hierarchy);
+
+  // The flat exchange sends world_size^2 messages and the two-level exchange
+  // sends num_nodes^2 messages between the nodes
+  if (world_rank == 0) {
+    printf("implementation,procs,nodes,messages,bytes,min_us,median_us,max_us\n");
+  }
+  int message_size;
+  for (message_size = 1; message_size <= max_message_size; message_size *= 2) {
+    int hierarchical;
+    for (hierarchical = 0; hierarchical < 2; hierarchical++) {
+      double *sorted_times = time_alltoallv(message_size, num_trials,
+                                            hierarchical, &hierarchy);
+      if (world_rank == 0) {
+        int messages = hierarchical ? hierarchy.num_nodes * hierarchy.num_nodes :
+          world_size * world_size;
+        printf("%s,%d,%d,%d,%d,%.3f,%.3f,%.3f\n",
+               hierarchical ? "TMPI_Alltoallv" : "MPI_Alltoallv", world_size,
+               hierarchy.num_nodes, messages, message_size,
+               sorted_times[0] * 1e6, sorted_times[num_trials / 2] * 1e6,
+               sorted_times[num_trials - 1] * 1e6);
+        fflush(stdout);
+        free(sorted_times);
+      }
+    }
+  }
+
+  TMPI_Hierarchy_free(&hierarchy);
+  TMPI_Topology_free(MPI_COMM_WORLD);
+  MPI_Finalize();
+}
@@ -4,78 +4,430 @@
 // free to modify it for your own use. Any distribution of the code must
 // either provide a link to www.mpitutorial.com or keep this header intact.
 //
-// A program that bins random numbers using MPI_Alltoallv.
+// A program that bins random numbers using MPI_Alltoallv. The bin boundaries
+// are chosen from a sample of the numbers so that every process receives
+// about the same amount of numbers, even if the numbers are skewed. Passing
+// --chunk-size, --input or --output bins the numbers in chunks with
+// MPI_Ialltoallv instead, so that the numbers never have to fit in memory.
+// Passing --hierarchical exchanges the counts, and the numbers when they are
+// not binned in chunks, with the two-level TMPI_Alltoallv.
 //
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <stdint.h>
+#include <limits.h>
+#include <math.h>
 #include <mpi.h>
+#include "tmpi_memory.h"
+#include "tmpi_random.h"
+#include "tmpi_alltoallv.h"
+#include "tmpi_topology.h"
+#ifdef _OPENMP
+#include <omp.h>
+#endif
 
-// Creates an array of random numbers for binning. Note that the numbers are
-// between [0, 1)
-float *create_random_numbers(int numbers_per_proc) {
-  float *random_numbers = (float *)malloc(sizeof(float) * numbers_per_proc);
-  int i;
-  for (i = 0; i < numbers_per_proc; i++) {
-    int r = rand();
-    // Make sure that the random number is never exactly one.
-    if (r == RAND_MAX) {
-      r--;
+// The amount of numbers gathered for a process before they are copied to the
+// send buffer. 16 floats fill a 64 byte cache line.
+#define PARTITION_BUFFER_SIZE 16
+
+// The default amount of numbers per chunk when binning in chunks
+#define STREAM_CHUNK_SIZE (1024 * 1024)
+
+// A process receives at most this many chunks of numbers (and one number per
+// process) at a time when binning in chunks. Chunks that would bin more
+// numbers to a process are binned in several rounds.
+#define STREAM_RECV_CHUNKS 2
+
+// The amount of random numbers a thread creates at a time
+#define FILL_CHUNK_SIZE (1 << 16)
+
+// The amount of samples each process contributes when choosing the bin
+// boundaries is BIN_OVERSAMPLING times the amount of processes, within the
+// limits below. With regular samples of the sorted numbers, no bin would get
+// more than about 1 + 1 / BIN_OVERSAMPLING times its share of the numbers. The
+// samples are taken from candidates instead (see SAMPLE_CANDIDATES), which
+// adds a small random error to that bound. More samples give better balanced
+// bins at the cost of a larger MPI_Allgatherv.
+#define BIN_OVERSAMPLING 16
+#define BIN_MIN_SAMPLES_PER_PROC 512
+#define BIN_MAX_SAMPLES_PER_PROC 8192
+
+// The amount of evenly spaced numbers of a process (candidates) that are read
+// for every sample. Only the candidates are sorted, not all numbers of the
+// process, and the samples are regular samples of the sorted candidates.
+#define SAMPLE_CANDIDATES 16
+
+// The bits of a digit of the radix sort that sorts the candidates
+#define SORT_RADIX_BITS 8
+
+// Fills an array with random numbers for binning. Note that the numbers are
+// between [0, 1). The numbers are elements first to first + count - 1 of a
+// random stream, so the numbers of all processes together only depend on the
+// seed. If skew is larger than one, every number is raised to the power of
+// skew, which piles the numbers up close to zero like a Zipf distribution.
+// Every thread fills one contiguous range of chunks of FILL_CHUNK_SIZE numbers,
+// which is about the range of numbers that it partitions later. Memory from
+// TMPI_Alloc is placed on the NUMA node of the thread that fills it, so the
+// threads mostly partition numbers from their own node.
+void fill_random_numbers(unsigned long long seed, float skew, long long first,
+                         float *random_numbers, int count) {
+  int num_chunks = (count + FILL_CHUNK_SIZE - 1) / FILL_CHUNK_SIZE;
+  int chunk;
+#pragma omp parallel for schedule(static)
+  for (chunk = 0; chunk < num_chunks; chunk++) {
+    int start = chunk * FILL_CHUNK_SIZE;
+    int end = count - start < FILL_CHUNK_SIZE ? count : start + FILL_CHUNK_SIZE;
+    TMPI_Random_fill_float(seed, 0, first + start, random_numbers + start,
+                           end - start);
+    if (skew > 1) {
+      int i;
+      for (i = start; i < end; i++) {
+        random_numbers[i] = powf(random_numbers[i], skew);
+      }
     }
-    random_numbers[i] = rand() / (float)(RAND_MAX);
   }
+}
+
+// Creates an array of random numbers for binning
+float *create_random_numbers(unsigned long long seed, float skew, long long first,
+                             int numbers_per_proc) {
+  float *random_numbers = (float *)TMPI_Alloc(sizeof(float) * numbers_per_proc);
+  fill_random_numbers(seed, skew, first, random_numbers, numbers_per_proc);
   return random_numbers;
 }
 
-// Given a number, determine which process owns it. Since numbers are from [0, 1),
-// simply multiple the number by the size of the MPI world to figure out which
-// process owns it
-int which_process_owns_this_number(float rand_num, int world_size) {
-  return (int)(rand_num * world_size);
+// Used for sorting floating point numbers
+int compare_float(const void *a, const void *b) {
+  if (*(float *)a < *(float *)b) {
+    return -1;
+  } else if (*(float *)a > *(float *)b) {
+    return 1;
+  } else {
+    return 0;
+  }
+}
+
+// Returns the amount of samples that every process contributes when choosing
+// the bin boundaries
+int get_num_samples(int world_size) {
+  int num_samples = BIN_OVERSAMPLING * world_size;
+  if (num_samples < BIN_MIN_SAMPLES_PER_PROC) {
+    return BIN_MIN_SAMPLES_PER_PROC;
+  }
+  if (num_samples > BIN_MAX_SAMPLES_PER_PROC) {
+    return BIN_MAX_SAMPLES_PER_PROC;
+  }
+  return num_samples;
+}
+
+// Gets the index of sample i of num_samples out of count numbers. The samples
+// are evenly spaced.
+long long get_sample_index(int i, int num_samples, long long count) {
+  return ((2 * i + 1) * count) / (2 * num_samples);
+}
+
+// Sorts count numbers into sorted with an LSD radix sort, using buffer as
+// scratch space. The numbers are in [0, 1), so the bits of the numbers are in
+// the same order as the numbers. There is an even amount of passes, so the
+// last pass writes to sorted.
+void sort_numbers(const float *nums, int count, float *sorted, float *buffer) {
+  const float *src = nums;
+  float *dst = buffer;
+  int shift;
+  for (shift = 0; shift < 32; shift += SORT_RADIX_BITS) {
+    int offsets[1 << SORT_RADIX_BITS];
+    memset(offsets, 0, sizeof(offsets));
+    int i, digit;
+    for (i = 0; i < count; i++) {
+      uint32_t bits;
+      memcpy(&bits, &src[i], sizeof(bits));
+      offsets[(bits >> shift) & ((1 << SORT_RADIX_BITS) - 1)]++;
+    }
+    int offset = 0;
+    for (digit = 0; digit < (1 << SORT_RADIX_BITS); digit++) {
+      int digit_count = offsets[digit];
+      offsets[digit] = offset;
+      offset += digit_count;
+    }
+    for (i = 0; i < count; i++) {
+      uint32_t bits;
+      memcpy(&bits, &src[i], sizeof(bits));
+      dst[offsets[(bits >> shift) & ((1 << SORT_RADIX_BITS) - 1)]++] = src[i];
+    }
+    src = dst;
+    dst = dst == buffer ? sorted : buffer;
+  }
+}
+
+// Returns the amount of candidates that are read from count numbers to take
+// num_samples samples
+int get_num_candidates(int num_samples, long long count) {
+  long long num_candidates = (long long)num_samples * SAMPLE_CANDIDATES;
+  return count < num_candidates ? count : num_candidates;
+}
+
+// Takes regular samples of the candidates (parallel sorting by regular
+// sampling). The candidates are sorted, and num_samples evenly spaced
+// candidates of the sorted candidates are the samples. Every sample then
+// stands for about the same amount of numbers of the process. Returns the
+// amount of samples, which is smaller than num_samples if there are fewer
+// candidates.
+int sample_candidates(const float *candidates, int num_candidates,
+                      int num_samples, float *samples) {
+  if (num_candidates < num_samples) {
+    num_samples = num_candidates;
+  }
+  if (num_samples == 0) {
+    return 0;
+  }
+  float *sorted = (float *)malloc(sizeof(float) * num_candidates);
+  float *buffer = (float *)malloc(sizeof(float) * num_candidates);
+  sort_numbers(candidates, num_candidates, sorted, buffer);
+  int i;
+  for (i = 0; i < num_samples; i++) {
+    samples[i] = sorted[get_sample_index(i, num_samples, num_candidates)];
+  }
+  free(sorted);
+  free(buffer);
+  return num_samples;
+}
+
+// Takes num_samples samples of the count numbers of a process. Only the
+// candidates are copied and sorted, so the numbers themselves are left alone
+// until they are partitioned. Returns the amount of samples.
+int sample_numbers(const float *nums, int count, int num_samples,
+                   float *samples) {
+  int num_candidates = get_num_candidates(num_samples, count);
+  float *candidates = (float *)malloc(sizeof(float) * num_candidates);
+  int i;
+  for (i = 0; i < num_candidates; i++) {
+    candidates[i] = nums[get_sample_index(i, num_candidates, count)];
+  }
+  num_samples = sample_candidates(candidates, num_candidates, num_samples,
+                                  samples);
+  free(candidates);
+  return num_samples;
+}
+
+// Chooses the bin boundaries so that every process receives about the same
+// amount of numbers. Every process contributes num_samples samples of its
+// numbers, and the boundaries are the quantiles of the samples of all
+// processes. Processes without numbers contribute no samples, so they do not
+// pull the boundaries. Returns world_size + 1 splitters, where process i owns
+// the numbers in [splitters[i], splitters[i + 1]). Numbers that are equal
+// always go to the same process, so a single number that makes up more than a
+// bin can not be balanced.
+float *choose_splitters(const float *samples, int num_samples, int world_size) {
+  int *sample_counts = (int *)malloc(sizeof(int) * world_size);
+  int *sample_offsets = (int *)malloc(sizeof(int) * world_size);
+  MPI_Allgather(&num_samples, 1, MPI_INT, sample_counts, 1, MPI_INT,
+                MPI_COMM_WORLD);
+  int total_samples = 0;
+  int i;
+  for (i = 0; i < world_size; i++) {
+    sample_offsets[i] = total_samples;
+    total_samples += sample_counts[i];
+  }
+  float *all_samples = (float *)malloc(sizeof(float) * (total_samples + 1));
+  MPI_Allgatherv(samples, num_samples, MPI_FLOAT, all_samples, sample_counts,
+                 sample_offsets, MPI_FLOAT, MPI_COMM_WORLD);
+  qsort(all_samples, total_samples, sizeof(float), &compare_float);
+
+  float *splitters = (float *)malloc(sizeof(float) * (world_size + 1));
+  splitters[0] = 0;
+  for (i = 1; i < world_size; i++) {
+    // Without any numbers, the bins are simply evenly spaced
+    splitters[i] = total_samples == 0 ? (float)i / world_size :
+      all_samples[(long long)i * total_samples / world_size];
+  }
+  splitters[world_size] = 1;
+  free(sample_counts);
+  free(sample_offsets);
+  free(all_samples);
+  return splitters;
+}
+
+// Given a number, determine which process owns it. This is the last process
+// whose bin starts at or before the number, which is found with a binary
+// search of the splitters.
+int which_process_owns_this_number(float rand_num, const float *splitters,
+                                   int world_size) {
+  int low = 0, high = world_size - 1;
+  while (low < high) {
+    int middle = (low + high + 1) / 2;
+    if (splitters[middle] <= rand_num) {
+      low = middle;
+    } else {
+      high = middle - 1;
+    }
+  }
+  return low;
 }
 
 // Gets the starting value for a process's bin
-float get_bin_start(int world_rank, int world_size) {
-  return (float)world_rank / world_size;
+float get_bin_start(int world_rank, const float *splitters) {
+  return splitters[world_rank];
 }
 
 // Gets the ending value for a process's bin
-float get_bin_end(int world_rank, int world_size) {
-  return get_bin_start(world_rank + 1, world_size);
+float get_bin_end(int world_rank, const float *splitters) {
+  return splitters[world_rank + 1];
 }
 
-// This function returns the amount of numbers that will be sent to each
-// process given the array of random numbers.
-int *get_send_amounts_per_proc(float *rand_nums, int numbers_per_proc,
-                               int world_size) {
-  int *send_amounts_per_proc = (int *)malloc(sizeof(int) * world_size);
+// Returns the number of threads used to partition the numbers
+int get_num_threads() {
+#ifdef _OPENMP
+  return omp_get_max_threads();
+#else
+  return 1;
+#endif
+}
+
+// Returns the number of the calling thread and the amount of threads in the
+// parallel region. The system may start fewer threads than were asked for (for
+// example with OMP_THREAD_LIMIT), so the threads loop over the ranges of
+// numbers and a thread takes over the ranges of the threads that are missing.
+void get_thread_team(int *thread, int *team_size) {
+#ifdef _OPENMP
+  *thread = omp_get_thread_num();
+  *team_size = omp_get_num_threads();
+#else
+  *thread = 0;
+  *team_size = 1;
+#endif
+}
+
+// Gets the range of numbers that a thread partitions. Every thread gets a
+// contiguous part of the numbers.
+void get_thread_range(int thread, int num_threads, int numbers_per_proc,
+                      int *start, int *end) {
+  *start = (long long)numbers_per_proc * thread / num_threads;
+  *end = (long long)numbers_per_proc * (thread + 1) / num_threads;
+}
+
+// This function returns the amount of numbers that every thread will send to
+// each process given the array of random numbers. The count of thread t for
+// process p is at index t * world_size + p.
+int *get_send_amounts_per_thread(float *rand_nums, int numbers_per_proc,
+                                 const float *splitters, int world_size,
+                                 int num_threads) {
+  int *send_amounts_per_thread =
+    (int *)malloc(sizeof(int) * world_size * num_threads);
   // Initialize the amount of numbers per process to zero
-  memset(send_amounts_per_proc, 0, sizeof(int) * world_size);
+  memset(send_amounts_per_thread, 0, sizeof(int) * world_size * num_threads);
 
   // For each random number, determine which process owns it and increment
   // the amount of numbers for that process.
-  int i;
-  for (i = 0; i < numbers_per_proc; i++) {
-    int owning_rank = which_process_owns_this_number(rand_nums[i], world_size);
-    send_amounts_per_proc[owning_rank]++;
+#pragma omp parallel num_threads(num_threads)
+  {
+    int thread, team_size;
+    get_thread_team(&thread, &team_size);
+    for (; thread < num_threads; thread += team_size) {
+      int *send_amounts = send_amounts_per_thread + thread * world_size;
+      int start, end, i;
+      get_thread_range(thread, num_threads, numbers_per_proc, &start, &end);
+      for (i = start; i < end; i++) {
+        int owning_rank = which_process_owns_this_number(rand_nums[i],
+                                                         splitters, world_size);
+        send_amounts[owning_rank]++;
+      }
+    }
   }
 
+  return send_amounts_per_thread;
+}
+
+// This function returns the amount of numbers that will be sent to each
+// process by adding up the amounts of all threads.
+int *get_send_amounts_per_proc(int *send_amounts_per_thread, int world_size,
+                               int num_threads) {
+  int *send_amounts_per_proc = (int *)malloc(sizeof(int) * world_size);
+  memset(send_amounts_per_proc, 0, sizeof(int) * world_size);
+  int t, i;
+  for (t = 0; t < num_threads; t++) {
+    for (i = 0; i < world_size; i++) {
+      send_amounts_per_proc[i] += send_amounts_per_thread[t * world_size + i];
+    }
+  }
   return send_amounts_per_proc;
 }
 
+// Arranges the random numbers by the process that owns them. Since the counts
+// are known, every number can be written straight to its place in send_nums
+// in a single pass. Thread t writes its numbers for process p after the numbers
+// of the threads before it. Writing every number to a different place in
+// memory is slow when there are many processes, so numbers are first gathered
+// in a small buffer per process that is copied out once it is full.
+void partition_numbers(float *rand_nums, int numbers_per_proc,
+                       const float *splitters, int world_size, int num_threads,
+                       int *send_amounts_per_thread, int *send_offsets_per_proc,
+                       float *send_nums) {
+#pragma omp parallel num_threads(num_threads)
+  {
+    int thread, team_size;
+    get_thread_team(&thread, &team_size);
+    int *positions = (int *)malloc(sizeof(int) * world_size);
+    int *buffer_counts = (int *)malloc(sizeof(int) * world_size);
+    float *buffers =
+      (float *)malloc(sizeof(float) * world_size * PARTITION_BUFFER_SIZE);
+    for (; thread < num_threads; thread += team_size) {
+      int t, p, i;
+      for (p = 0; p < world_size; p++) {
+        positions[p] = send_offsets_per_proc[p];
+        for (t = 0; t < thread; t++) {
+          positions[p] += send_amounts_per_thread[t * world_size + p];
+        }
+        buffer_counts[p] = 0;
+      }
+
+      int start, end;
+      get_thread_range(thread, num_threads, numbers_per_proc, &start, &end);
+      for (i = start; i < end; i++) {
+        int owning_rank = which_process_owns_this_number(rand_nums[i],
+                                                         splitters, world_size);
+        float *buffer = buffers + owning_rank * PARTITION_BUFFER_SIZE;
+        buffer[buffer_counts[owning_rank]++] = rand_nums[i];
+        if (buffer_counts[owning_rank] == PARTITION_BUFFER_SIZE) {
+          memcpy(send_nums + positions[owning_rank], buffer,
+                 sizeof(float) * PARTITION_BUFFER_SIZE);
+          positions[owning_rank] += PARTITION_BUFFER_SIZE;
+          buffer_counts[owning_rank] = 0;
+        }
+      }
+      // Copy out the numbers left in the buffers
+      for (p = 0; p < world_size; p++) {
+        memcpy(send_nums + positions[p], buffers + p * PARTITION_BUFFER_SIZE,
+               sizeof(float) * buffer_counts[p]);
+      }
+    }
+
+    free(positions);
+    free(buffer_counts);
+    free(buffers);
+  }
+}
+
 // Given how many numbers each process is sending to the other processes, find
 // out how many numbers you are receiving from each process. This function
 // returns an array of counts indexed on the rank of the process from which it
-// will receive the numbers.
-int *get_recv_amounts_per_proc(int *send_amounts_per_proc, int world_size) {
+// will receive the numbers. The counts are exchanged with TMPI_Alltoall if
+// hierarchy is not NULL.
+int *get_recv_amounts_per_proc(int *send_amounts_per_proc, int world_size,
+                               TMPI_Hierarchy *hierarchy) {
   int *recv_amounts_per_proc = (int *)malloc(sizeof(int) * world_size);
 
   // Perform an Alltoall for the send counts. This will send the send counts
   // from each process and place them in the recv_amounts_per_proc array of
   // the receiving processes to let them know how many numbers they will
   // receive when binning occurs.
-  MPI_Alltoall(send_amounts_per_proc, 1, MPI_INT, recv_amounts_per_proc, 1,
-               MPI_INT, MPI_COMM_WORLD);
+  if (hierarchy != NULL) {
+    TMPI_Alltoall(send_amounts_per_proc, 1, recv_amounts_per_proc, MPI_INT,
+                  hierarchy);
+  } else {
+    MPI_Alltoall(send_amounts_per_proc, 1, MPI_INT, recv_amounts_per_proc, 1,
+                 MPI_INT, MPI_COMM_WORLD);
+  }
   return recv_amounts_per_proc;
 }
 
@@ -101,23 +453,12 @@ int sum(int *arr, int size) {
   return sum_result;
 }
 
-// Used for sorting floating point numbers
-int compare_float(const void *a, const void *b) {
-  if (*(float *)a < *(float *)b) {
-    return -1;
-  } else if (*(float *)a > *(float *)b) {
-    return 1;
-  } else {
-    return 0;
-  }
-}
-
 // Verifies that the binned numbers belong to the process.
 void verify_bin_nums(float *binned_nums, int num_count, int world_rank,
-                     int world_size) {
+                     const float *splitters) {
   int i;
-  float bin_start = get_bin_start(world_rank, world_size);
-  float bin_end = get_bin_end(world_rank, world_size);
+  float bin_start = get_bin_start(world_rank, splitters);
+  float bin_end = get_bin_end(world_rank, splitters);
   for (i = 0; i < num_count; i++) {
     if (binned_nums[i] >= bin_end || binned_nums[i] < bin_start) {
       fprintf(stderr, "Error: Binned number %f exceeds bin range [%f - %f) for process %d\n",
@@ -126,43 +467,45 @@ void verify_bin_nums(float *binned_nums, int num_count, int world_rank,
   }
 }
 
-int main(int argc, char** argv) {
-  if (argc != 2) {
-    fprintf(stderr, "Usage: bin numbers_per_proc\n");
-    exit(1);
-  }
-
-  // Get the amount of random numbers to create per process
-  int numbers_per_proc = atoi(argv[1]);
-
-  MPI_Init(NULL, NULL);
-
-  int world_rank;
-  MPI_Comm_rank(MPI_COMM_WORLD, &world_rank);
-  int world_size;
-  MPI_Comm_size(MPI_COMM_WORLD, &world_size);
-
-  // Seed the random number generator to get different results each time
-  srand(time(NULL) * world_rank);
-
+// Bins numbers_per_proc random numbers of this process with one MPI_Alltoallv.
+// All numbers and all binned numbers are held in memory. Returns the amount of
+// numbers this process received.
+int bin_numbers(int numbers_per_proc, unsigned long long seed, float skew,
+                TMPI_Hierarchy *hierarchy, int world_rank, int world_size) {
   // Create the random numbers on this process. Note that all numbers
   // will be between 0 and 1
-  float *rand_nums = create_random_numbers(numbers_per_proc);
+  float *rand_nums = create_random_numbers(seed, skew,
+                                           (long long)world_rank * numbers_per_proc,
+                                           numbers_per_proc);
+
+  // Choose the bin boundaries from a sample of the numbers of all processes
+  float *samples = (float *)malloc(sizeof(float) * get_num_samples(world_size));
+  int num_samples = sample_numbers(rand_nums, numbers_per_proc,
+                                   get_num_samples(world_size), samples);
+  float *splitters = choose_splitters(samples, num_samples, world_size);
+  free(samples);
 
   // Given the array of random numbers, determine how many will be sent
   // to each process (based on the which process owns the number).
   // The return value from this function is an array of counts
   // for each rank in the communicator.
   // The count represents how many numbers each process will receive
-  // when they are binned from this process.
-  int *send_amounts_per_proc = get_send_amounts_per_proc(rand_nums,
-                                                         numbers_per_proc,
-                                                         world_size);
+  // when they are binned from this process. The counts are first made
+  // for each thread so that the threads can partition the numbers on their
+  // own later.
+  int num_threads = get_num_threads();
+  int *send_amounts_per_thread = get_send_amounts_per_thread(rand_nums,
+                                                             numbers_per_proc,
+                                                             splitters,
+                                                             world_size,
+                                                             num_threads);
+  int *send_amounts_per_proc = get_send_amounts_per_proc(send_amounts_per_thread,
+                                                         world_size, num_threads);
 
   // Determine how many numbers you will receive from each process. This
   // information is needed to set up the binning call.
   int *recv_amounts_per_proc = get_recv_amounts_per_proc(send_amounts_per_proc,
-                                                         world_size);
+                                                         world_size, hierarchy);
 
   // Do a prefix sum for the send/recv amounts to get the send/recv offsets for
   // the MPI_Alltoallv call (the binning call).
@@ -172,37 +515,429 @@ int main(int argc, char** argv) {
   // Allocate an array to hold the binned numbers for this process based on the total
   // amount of numbers this process will receive from others.
   int total_recv_amount = sum(recv_amounts_per_proc, world_size);
-  float *binned_nums = (float *)malloc(sizeof(float) * total_recv_amount);
+  float *binned_nums = (float *)TMPI_Alloc(sizeof(float) * total_recv_amount);
 
   // The final step before binning - arrange all of the random numbers so that they
-  // are ordered by bin. For simplicity, we are simply going to sort the random
-  // numbers, however, this could be optimized since the numbers don't need to be
-  // fully sorted.
-  qsort(rand_nums, numbers_per_proc, sizeof(float), &compare_float);
+  // are ordered by bin. The numbers don't need to be fully sorted, so they are
+  // simply written to the place of their bin in a send buffer.
+  float *send_nums = (float *)TMPI_Alloc(sizeof(float) * numbers_per_proc);
+  partition_numbers(rand_nums, numbers_per_proc, splitters, world_size,
+                    num_threads, send_amounts_per_thread, send_offsets_per_proc,
+                    send_nums);
 
   // Perform the binning step with MPI_Alltoallv. This will send all of the numbers in
-  // the rand_nums array to their proper bin. Each process will only contain numbers
-  // belonging to its bin after this step. For example, if there are 4 processes, process
-  // 0 will contain numbers in the [0, .25) range.
-  MPI_Alltoallv(rand_nums, send_amounts_per_proc, send_offsets_per_proc, MPI_FLOAT,
-                binned_nums, recv_amounts_per_proc, recv_offsets_per_proc, MPI_FLOAT,
-                MPI_COMM_WORLD);
+  // the send_nums array to their proper bin. Each process will only contain numbers
+  // belonging to its bin after this step. For example, if there are 4 processes and the
+  // numbers are uniform, process 0 will contain numbers in about the [0, .25) range.
+  if (hierarchy != NULL) {
+    TMPI_Alltoallv(send_nums, send_amounts_per_proc, send_offsets_per_proc,
+                   binned_nums, recv_amounts_per_proc, recv_offsets_per_proc,
+                   MPI_FLOAT, hierarchy);
+  } else {
+    MPI_Alltoallv(send_nums, send_amounts_per_proc, send_offsets_per_proc, MPI_FLOAT,
+                  binned_nums, recv_amounts_per_proc, recv_offsets_per_proc, MPI_FLOAT,
+                  MPI_COMM_WORLD);
+  }
 
   // Print results
   printf("Process %d received %d numbers in bin [%f - %f)\n", world_rank, total_recv_amount,
-         get_bin_start(world_rank, world_size), get_bin_end(world_rank, world_size));
+         get_bin_start(world_rank, splitters), get_bin_end(world_rank, splitters));
 
   // Check that the bin numbers are correct
-  verify_bin_nums(binned_nums, total_recv_amount, world_rank, world_size);
-
-  MPI_Barrier(MPI_COMM_WORLD);
-  MPI_Finalize();
+  verify_bin_nums(binned_nums, total_recv_amount, world_rank, splitters);
 
   // Clean up
-  free(rand_nums);
+  TMPI_Free(rand_nums);
+  TMPI_Free(send_nums);
+  free(send_amounts_per_thread);
   free(send_amounts_per_proc);
   free(recv_amounts_per_proc);
   free(send_offsets_per_proc);
   free(recv_offsets_per_proc);
-  free(binned_nums);
+  TMPI_Free(binned_nums);
+  free(splitters);
+  return total_recv_amount;
+}
+
+// The buffers and counts of one exchange of the streaming mode. A chunk is
+// exchanged in num_rounds rounds, and every round sends the next part of the
+// numbers for every process.
+typedef struct {
+  float *send_nums;
+  float *recv_nums;
+  int *send_amounts_per_proc;
+  int *recv_amounts_per_proc;
+  int *send_offsets_per_proc;
+  int num_rounds;
+  int round;
+  int *send_round_amounts;
+  int *recv_round_amounts;
+  int *send_round_offsets;
+  int *recv_round_offsets;
+  MPI_Request request;
+} Exchange;
+
+// Reads the next count numbers of this process into chunk. Numbers come from
+// the input file if there is one and are generated otherwise.
+void read_chunk(FILE *input, unsigned long long seed, float skew,
+                long long first, float *chunk, int count) {
+  if (input == NULL) {
+    fill_random_numbers(seed, skew, first, chunk, count);
+    return;
+  }
+  if (fread(chunk, sizeof(float), count, input) != (size_t)count) {
+    fprintf(stderr, "Error: Could not read numbers %lld - %lld of the input\n",
+            first, first + count - 1);
+    MPI_Abort(MPI_COMM_WORLD, 1);
+  }
+  int i;
+  for (i = 0; i < count; i++) {
+    // Numbers outside of [0, 1) have no owner
+    if (!(chunk[i] >= 0 && chunk[i] < 1)) {
+      fprintf(stderr, "Error: Input number %f is not in [0, 1)\n", chunk[i]);
+      MPI_Abort(MPI_COMM_WORLD, 1);
+    }
+  }
+}
+
+// Takes num_samples samples of the count numbers of this process starting at
+// first without reading all of them. Only the candidates are read, and each
+// of them is read or generated on its own. Returns the amount of samples.
+int read_samples(FILE *input, unsigned long long seed, float skew,
+                 long long first, long long count, int num_samples,
+                 float *samples) {
+  int num_candidates = get_num_candidates(num_samples, count);
+  float *candidates = (float *)malloc(sizeof(float) * num_candidates);
+  int i;
+  for (i = 0; i < num_candidates; i++) {
+    long long index = first + get_sample_index(i, num_candidates, count);
+    if (input != NULL && fseek(input, index * sizeof(float), SEEK_SET) != 0) {
+      fprintf(stderr, "Error: Could not read number %lld of the input\n", index);
+      MPI_Abort(MPI_COMM_WORLD, 1);
+    }
+    read_chunk(input, seed, skew, index, &candidates[i], 1);
+  }
+  if (input != NULL) {
+    fseek(input, first * sizeof(float), SEEK_SET);
+  }
+  num_samples = sample_candidates(candidates, num_candidates, num_samples,
+                                  samples);
+  free(candidates);
+  return num_samples;
+}
+
+// Gets the part of amount numbers that is sent in a round out of num_rounds
+void get_round_part(int amount, int round, int num_rounds, int *start,
+                    int *count) {
+  *start = (long long)amount * round / num_rounds;
+  *count = (long long)amount * (round + 1) / num_rounds - *start;
+}
+
+// Starts the next round of an exchange with MPI_Ialltoallv. Every process
+// sends the same part of its numbers for every process in a round, so the
+// receivers can compute how much they receive in the round on their own.
+void start_round(Exchange *exchange, int world_size) {
+  int p, start;
+  int recv_offset = 0;
+  for (p = 0; p < world_size; p++) {
+    get_round_part(exchange->send_amounts_per_proc[p], exchange->round,
+                   exchange->num_rounds, &start,
+                   &exchange->send_round_amounts[p]);
+    exchange->send_round_offsets[p] = exchange->send_offsets_per_proc[p] + start;
+    get_round_part(exchange->recv_amounts_per_proc[p], exchange->round,
+                   exchange->num_rounds, &start,
+                   &exchange->recv_round_amounts[p]);
+    exchange->recv_round_offsets[p] = recv_offset;
+    recv_offset += exchange->recv_round_amounts[p];
+  }
+  MPI_Ialltoallv(exchange->send_nums, exchange->send_round_amounts,
+                 exchange->send_round_offsets, MPI_FLOAT, exchange->recv_nums,
+                 exchange->recv_round_amounts, exchange->recv_round_offsets,
+                 MPI_FLOAT, MPI_COMM_WORLD, &exchange->request);
+}
+
+// Partitions a chunk of numbers into the send buffer of an exchange and starts
+// binning it with MPI_Ialltoallv. The counts are exchanged first with
+// MPI_Ialltoall while the chunk is partitioned, which can run while the
+// previous exchange is still in flight. A process that would receive more
+// than recv_capacity - world_size numbers makes all processes exchange the
+// chunk in as many rounds as it needs. A round sends at most one more number
+// per process than its share, so no round overflows the receive buffers.
+void start_exchange(float *chunk, int count, const float *splitters,
+                    TMPI_Hierarchy *hierarchy, int world_size, int num_threads,
+                    int recv_capacity, Exchange *exchange) {
+  int *send_amounts_per_thread = get_send_amounts_per_thread(chunk, count,
+                                                             splitters,
+                                                             world_size,
+                                                             num_threads);
+  exchange->send_amounts_per_proc =
+    get_send_amounts_per_proc(send_amounts_per_thread, world_size, num_threads);
+  exchange->send_offsets_per_proc =
+    prefix_sum(exchange->send_amounts_per_proc, world_size);
+  MPI_Request counts_request = MPI_REQUEST_NULL;
+  if (hierarchy != NULL) {
+    exchange->recv_amounts_per_proc =
+      get_recv_amounts_per_proc(exchange->send_amounts_per_proc, world_size,
+                                hierarchy);
+  } else {
+    exchange->recv_amounts_per_proc = (int *)malloc(sizeof(int) * world_size);
+    MPI_Ialltoall(exchange->send_amounts_per_proc, 1, MPI_INT,
+                  exchange->recv_amounts_per_proc, 1, MPI_INT, MPI_COMM_WORLD,
+                  &counts_request);
+  }
+  partition_numbers(chunk, count, splitters, world_size, num_threads,
+                    send_amounts_per_thread, exchange->send_offsets_per_proc,
+                    exchange->send_nums);
+  free(send_amounts_per_thread);
+  MPI_Wait(&counts_request, MPI_STATUS_IGNORE);
+
+  long long recv_amount = 0;
+  int p;
+  for (p = 0; p < world_size; p++) {
+    recv_amount += exchange->recv_amounts_per_proc[p];
+  }
+  long long round_capacity = recv_capacity - world_size;
+  int num_rounds = (recv_amount + round_capacity - 1) / round_capacity;
+  if (num_rounds < 1) {
+    num_rounds = 1;
+  }
+  MPI_Allreduce(&num_rounds, &exchange->num_rounds, 1, MPI_INT, MPI_MAX,
+                MPI_COMM_WORLD);
+  exchange->round = 0;
+  start_round(exchange, world_size);
+}
+
+// Waits for every round of an exchange to finish, checks the binned numbers,
+// and appends them to the output file if there is one. Returns the amount of
+// binned numbers.
+long long finish_exchange(Exchange *exchange, FILE *output,
+                          const float *splitters, int world_rank,
+                          int world_size) {
+  long long total_recv_amount = 0;
+  while (1) {
+    MPI_Wait(&exchange->request, MPI_STATUS_IGNORE);
+    int recv_amount = sum(exchange->recv_round_amounts, world_size);
+    verify_bin_nums(exchange->recv_nums, recv_amount, world_rank, splitters);
+    if (output != NULL &&
+        fwrite(exchange->recv_nums, sizeof(float), recv_amount, output) !=
+        (size_t)recv_amount) {
+      fprintf(stderr, "Error: Could not write binned numbers on process %d\n",
+              world_rank);
+      MPI_Abort(MPI_COMM_WORLD, 1);
+    }
+    total_recv_amount += recv_amount;
+    if (++exchange->round == exchange->num_rounds) {
+      break;
+    }
+    start_round(exchange, world_size);
+  }
+  free(exchange->send_amounts_per_proc);
+  free(exchange->recv_amounts_per_proc);
+  free(exchange->send_offsets_per_proc);
+  return total_recv_amount;
+}
+
+// Bins numbers_per_proc numbers of this process in chunks of chunk_size
+// numbers. Every chunk is binned with its own MPI_Ialltoallv. There are two
+// exchanges, so the next chunk is read and partitioned while the previous one
+// is in flight, and the previous one is written while the next one is in
+// flight. A process receives at most STREAM_RECV_CHUNKS * chunk_size +
+// world_size numbers at a time, and chunks that bin more to a process are
+// exchanged in several rounds, so the memory needed does not depend on
+// numbers_per_proc, on the amount of processes or on how the numbers are
+// distributed. Numbers are read from input_filename if it is
+// not NULL, where process i reads the numbers_per_proc floats after the first
+// i * numbers_per_proc. Each process writes its bin to
+// output_prefix.<rank> if output_prefix is not NULL. The bin boundaries are
+// chosen from samples of all numbers before the first chunk is read. Returns
+// the amount of numbers this process received.
+long long stream_bin_numbers(long long numbers_per_proc, int chunk_size,
+                             unsigned long long seed, float skew,
+                             const char *input_filename,
+                             const char *output_prefix,
+                             TMPI_Hierarchy *hierarchy, int world_rank,
+                             int world_size) {
+  long long first = world_rank * numbers_per_proc;
+  FILE *input = NULL;
+  if (input_filename != NULL) {
+    input = fopen(input_filename, "rb");
+    if (input == NULL || fseek(input, first * sizeof(float), SEEK_SET) != 0) {
+      fprintf(stderr, "Error: Could not read %s\n", input_filename);
+      MPI_Abort(MPI_COMM_WORLD, 1);
+    }
+  }
+  FILE *output = NULL;
+  if (output_prefix != NULL) {
+    char output_filename[1024];
+    snprintf(output_filename, sizeof(output_filename), "%s.%d", output_prefix,
+             world_rank);
+    output = fopen(output_filename, "wb");
+    if (output == NULL) {
+      fprintf(stderr, "Error: Could not write %s\n", output_filename);
+      MPI_Abort(MPI_COMM_WORLD, 1);
+    }
+  }
+
+  int num_threads = get_num_threads();
+  int recv_capacity = STREAM_RECV_CHUNKS * chunk_size + world_size;
+  float *chunk = (float *)TMPI_Alloc(sizeof(float) * chunk_size);
+  Exchange exchanges[2];
+  int e;
+  for (e = 0; e < 2; e++) {
+    exchanges[e].send_nums = (float *)TMPI_Alloc(sizeof(float) * chunk_size);
+    exchanges[e].recv_nums = (float *)TMPI_Alloc(sizeof(float) * recv_capacity);
+    exchanges[e].send_round_amounts = (int *)malloc(sizeof(int) * world_size);
+    exchanges[e].recv_round_amounts = (int *)malloc(sizeof(int) * world_size);
+    exchanges[e].send_round_offsets = (int *)malloc(sizeof(int) * world_size);
+    exchanges[e].recv_round_offsets = (int *)malloc(sizeof(int) * world_size);
+  }
+
+  // Choose the bin boundaries from a sample of the numbers of all processes
+  float *samples = (float *)malloc(sizeof(float) * get_num_samples(world_size));
+  int num_samples = read_samples(input, seed, skew, first, numbers_per_proc,
+                                 get_num_samples(world_size), samples);
+  float *splitters = choose_splitters(samples, num_samples, world_size);
+  free(samples);
+
+  long long num_chunks = (numbers_per_proc + chunk_size - 1) / chunk_size;
+  long long total_recv_amount = 0;
+  long long c;
+  for (c = 0; c < num_chunks; c++) {
+    long long count = numbers_per_proc - c * chunk_size;
+    if (count > chunk_size) {
+      count = chunk_size;
+    }
+    read_chunk(input, seed, skew, first + c * chunk_size, chunk, count);
+    start_exchange(chunk, count, splitters, hierarchy, world_size, num_threads,
+                   recv_capacity, &exchanges[c % 2]);
+    if (c > 0) {
+      total_recv_amount += finish_exchange(&exchanges[(c - 1) % 2], output,
+                                           splitters, world_rank, world_size);
+    }
+  }
+  if (num_chunks > 0) {
+    total_recv_amount += finish_exchange(&exchanges[(num_chunks - 1) % 2],
+                                         output, splitters, world_rank,
+                                         world_size);
+  }
+
+  printf("Process %d received %lld numbers in bin [%f - %f) in %lld chunks\n",
+         world_rank, total_recv_amount, get_bin_start(world_rank, splitters),
+         get_bin_end(world_rank, splitters), num_chunks);
+
+  // Clean up
+  if (input != NULL) {
+    fclose(input);
+  }
+  if (output != NULL) {
+    fclose(output);
+  }
+  TMPI_Free(chunk);
+  for (e = 0; e < 2; e++) {
+    TMPI_Free(exchanges[e].send_nums);
+    TMPI_Free(exchanges[e].recv_nums);
+    free(exchanges[e].send_round_amounts);
+    free(exchanges[e].recv_round_amounts);
+    free(exchanges[e].send_round_offsets);
+    free(exchanges[e].recv_round_offsets);
+  }
+  free(splitters);
+  return total_recv_amount;
+}
+
+int main(int argc, char** argv) {
+  if (argc < 2) {
+    fprintf(stderr, "Usage: bin numbers_per_proc [seed] [--skew=exponent] "
+            "[--chunk-size=N] [--input=file] [--output=prefix] [--hierarchical]\n");
+    exit(1);
+  }
+
+  // Get the amount of random numbers to create per process
+  long long numbers_per_proc = atoll(argv[1]);
+  unsigned long long seed = TMPI_RANDOM_DEFAULT_SEED;
+  float skew = 1;
+  // Giving any of the options bins the numbers in chunks
+  int stream = 0;
+  int chunk_size = STREAM_CHUNK_SIZE;
+  const char *input_filename = NULL;
+  const char *output_prefix = NULL;
+  int hierarchical = 0;
+  int a;
+  for (a = 2; a < argc; a++) {
+    if (strncmp(argv[a], "--skew=", 7) == 0) {
+      skew = atof(argv[a] + 7);
+    } else if (strncmp(argv[a], "--chunk-size=", 13) == 0) {
+      chunk_size = atoi(argv[a] + 13);
+      stream = 1;
+    } else if (strncmp(argv[a], "--input=", 8) == 0) {
+      input_filename = argv[a] + 8;
+      stream = 1;
+    } else if (strncmp(argv[a], "--output=", 9) == 0) {
+      output_prefix = argv[a] + 9;
+      stream = 1;
+    } else if (strcmp(argv[a], "--hierarchical") == 0) {
+      hierarchical = 1;
+    } else if (strncmp(argv[a], "--", 2) != 0) {
+      seed = strtoull(argv[a], NULL, 10);
+    } else {
+      fprintf(stderr, "Unknown option %s\n", argv[a]);
+      exit(1);
+    }
+  }
+  if (chunk_size < 1) {
+    fprintf(stderr, "The chunk size must be positive\n");
+    exit(1);
+  }
+  if (!stream && numbers_per_proc > INT_MAX) {
+    fprintf(stderr, "Binning more than %d numbers per process needs "
+            "--chunk-size\n", INT_MAX);
+    exit(1);
+  }
+
+  // Only the main thread calls MPI
+  int provided;
+  MPI_Init_thread(NULL, NULL, MPI_THREAD_FUNNELED, &provided);
+#ifdef _OPENMP
+  if (provided < MPI_THREAD_FUNNELED) {
+    omp_set_num_threads(1);
+  }
+#endif
+
+  int world_rank;
+  MPI_Comm_rank(MPI_COMM_WORLD, &world_rank);
+  int world_size;
+  MPI_Comm_size(MPI_COMM_WORLD, &world_size);
+
+  TMPI_Hierarchy hierarchy;
+  if (hierarchical) {
+    TMPI_Hierarchy_create(MPI_COMM_WORLD, &hierarchy);
+  }
+
+  long long recv_amount;
+  if (stream) {
+    recv_amount = stream_bin_numbers(numbers_per_proc, chunk_size, seed, skew,
+                                     input_filename, output_prefix,
+                                     hierarchical ? &hierarchy : NULL,
+                                     world_rank, world_size);
+  } else {
+    recv_amount = bin_numbers(numbers_per_proc, seed, skew,
+                              hierarchical ? &hierarchy : NULL, world_rank,
+                              world_size);
+  }
+  if (hierarchical) {
+    TMPI_Hierarchy_free(&hierarchy);
+    TMPI_Topology_free(MPI_COMM_WORLD);
+  }
+
+  // Compare the largest bin with a perfectly balanced bin
+  long long max_recv_amount;
+  MPI_Reduce(&recv_amount, &max_recv_amount, 1, MPI_LONG_LONG, MPI_MAX, 0,
+             MPI_COMM_WORLD);
+  if (world_rank == 0 && numbers_per_proc > 0) {
+    printf("Largest bin / mean bin = %f\n",
+           (double)max_recv_amount / numbers_per_proc);
+  }
+
+  MPI_Barrier(MPI_COMM_WORLD);
+  MPI_Finalize();
 }
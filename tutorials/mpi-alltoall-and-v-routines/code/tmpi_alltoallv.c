@@ -0,0 +1,317 @@
+// Author: Wes Kendall
+// Copyright 2014 www.mpitutorial.com
+// This code is provided freely with the tutorials on mpitutorial.com. Feel
+// free to modify it for your own use. Any distribution of the code must
+// either provide a link to www.mpitutorial.com or keep this header intact.
+//
+// A two-level all-to-all exchange. With MPI_Alltoallv, every process sends a
+// message to every other process, which is comm_size^2 messages that are
+// often tiny. TMPI_Alltoallv gathers the data of every node on the first
+// process of the node (the leader), exchanges it between the leaders, and
+// scatters it on the nodes again. Only num_nodes^2 messages cross the network.
+//
+// The nodes come from the topology that TMPI_Topology caches on the
+// communicator. To try the exchange on a single machine, set the environment
+// variable TMPI_TOPOLOGY_NODE_SIZE to group that many consecutive ranks into a
+// node instead.
+//
+#include <stdlib.h>
+#include <string.h>
+#include <mpi.h>
+#include "tmpi_alltoallv.h"
+#include "tmpi_topology.h"
+
+int TMPI_Hierarchy_create(MPI_Comm comm, TMPI_Hierarchy *hierarchy) {
+  int comm_size;
+  MPI_Comm_size(comm, &comm_size);
+  hierarchy->comm = comm;
+
+  TMPI_Topology *topology;
+  TMPI_Topology_get(comm, &topology);
+  hierarchy->node_comm = topology->node_comm;
+  hierarchy->leader_comm = topology->leader_comm;
+  hierarchy->node = topology->node;
+  hierarchy->num_nodes = topology->num_nodes;
+  int local_rank;
+  MPI_Comm_rank(hierarchy->node_comm, &local_rank);
+
+  // Find the node and local rank of every process
+  int my_location[2] = {hierarchy->node, local_rank};
+  int *locations = (int *)malloc(sizeof(int) * 2 * comm_size);
+  MPI_Allgather(my_location, 2, MPI_INT, locations, 2, MPI_INT, comm);
+  hierarchy->node_of_rank = (int *)malloc(sizeof(int) * comm_size);
+  hierarchy->local_rank_of_rank = (int *)malloc(sizeof(int) * comm_size);
+  hierarchy->node_offsets =
+    (int *)calloc(hierarchy->num_nodes + 1, sizeof(int));
+  hierarchy->node_ranks = (int *)malloc(sizeof(int) * comm_size);
+  int i;
+  for (i = 0; i < comm_size; i++) {
+    hierarchy->node_of_rank[i] = locations[2 * i];
+    hierarchy->local_rank_of_rank[i] = locations[2 * i + 1];
+    hierarchy->node_offsets[locations[2 * i] + 1]++;
+  }
+  for (i = 0; i < hierarchy->num_nodes; i++) {
+    hierarchy->node_offsets[i + 1] += hierarchy->node_offsets[i];
+  }
+  for (i = 0; i < comm_size; i++) {
+    hierarchy->node_ranks[hierarchy->node_offsets[locations[2 * i]] +
+                          locations[2 * i + 1]] = i;
+  }
+  free(locations);
+  return MPI_SUCCESS;
+}
+
+int TMPI_Hierarchy_free(TMPI_Hierarchy *hierarchy) {
+  free(hierarchy->node_of_rank);
+  free(hierarchy->local_rank_of_rank);
+  free(hierarchy->node_ranks);
+  free(hierarchy->node_offsets);
+  return MPI_SUCCESS;
+}
+
+// Returns the amount of processes on a node
+static int get_node_size(TMPI_Hierarchy *hierarchy, int node) {
+  return hierarchy->node_offsets[node + 1] - hierarchy->node_offsets[node];
+}
+
+// Returns the prefix sum of counts in a newly allocated array
+static int *get_offsets(const int *counts, int size) {
+  int *offsets = (int *)malloc(sizeof(int) * size);
+  int i;
+  offsets[0] = 0;
+  for (i = 1; i < size; i++) {
+    offsets[i] = offsets[i - 1] + counts[i - 1];
+  }
+  return offsets;
+}
+
+// Exchanges the data between the leaders. The leader of this node has the
+// counts of its processes, which it got with MPI_Gather, in local_counts and
+// their data, ordered by sending process and then by receiving process, in
+// local_data. The receiving processes are ordered by node. Returns the data
+// for the processes of this node, ordered by receiving process and then by
+// sending rank, and sets member_sizes to the amount of bytes for each process
+// of this node.
+static char *exchange_between_leaders(const int *local_counts,
+                                      const char *local_data, int type_size,
+                                      TMPI_Hierarchy *hierarchy,
+                                      int *member_sizes) {
+  int comm_size;
+  MPI_Comm_size(hierarchy->comm, &comm_size);
+  int num_nodes = hierarchy->num_nodes;
+  int my_node_size = get_node_size(hierarchy, hierarchy->node);
+  int n, s, d;
+
+  // Every leader sends the counts from its processes to the processes of a
+  // node as a my_node_size x node_size matrix
+  int *count_send_counts = (int *)malloc(sizeof(int) * num_nodes);
+  int *data_send_counts = (int *)calloc(num_nodes, sizeof(int));
+  int *count_recv_counts = (int *)malloc(sizeof(int) * num_nodes);
+  for (n = 0; n < num_nodes; n++) {
+    count_send_counts[n] = my_node_size * get_node_size(hierarchy, n);
+    count_recv_counts[n] = get_node_size(hierarchy, n) * my_node_size;
+  }
+  int *count_send_offsets = get_offsets(count_send_counts, num_nodes);
+  int *count_recv_offsets = get_offsets(count_recv_counts, num_nodes);
+  int *send_matrices = (int *)malloc(sizeof(int) * my_node_size * comm_size);
+  for (n = 0; n < num_nodes; n++) {
+    int node_size = get_node_size(hierarchy, n);
+    for (s = 0; s < my_node_size; s++) {
+      for (d = 0; d < node_size; d++) {
+        int count = local_counts[s * comm_size +
+                                 hierarchy->node_ranks[hierarchy->node_offsets[n] + d]];
+        send_matrices[count_send_offsets[n] + s * node_size + d] = count;
+        data_send_counts[n] += count * type_size;
+      }
+    }
+  }
+  int *recv_matrices = (int *)malloc(sizeof(int) * comm_size * my_node_size);
+  MPI_Alltoallv(send_matrices, count_send_counts, count_send_offsets, MPI_INT,
+                recv_matrices, count_recv_counts, count_recv_offsets, MPI_INT,
+                hierarchy->leader_comm);
+
+  // Reorder the data by receiving node. The data from a process to a node is
+  // contiguous, since the data of every process is ordered by node.
+  int *data_send_offsets = get_offsets(data_send_counts, num_nodes);
+  int local_size = data_send_offsets[num_nodes - 1] + data_send_counts[num_nodes - 1];
+  char *send_data = (char *)malloc(local_size);
+  int *positions = (int *)malloc(sizeof(int) * num_nodes);
+  memcpy(positions, data_send_offsets, sizeof(int) * num_nodes);
+  const char *segment = local_data;
+  for (s = 0; s < my_node_size; s++) {
+    for (n = 0; n < num_nodes; n++) {
+      int node_size = get_node_size(hierarchy, n);
+      int size = 0;
+      for (d = 0; d < node_size; d++) {
+        size += send_matrices[count_send_offsets[n] + s * node_size + d] * type_size;
+      }
+      memcpy(send_data + positions[n], segment, size);
+      positions[n] += size;
+      segment += size;
+    }
+  }
+
+  // The data from node n is a block per sending process of node n, which
+  // holds a block per receiving process of this node
+  int *data_recv_counts = (int *)calloc(num_nodes, sizeof(int));
+  for (n = 0; n < num_nodes; n++) {
+    for (s = 0; s < count_recv_counts[n]; s++) {
+      data_recv_counts[n] += recv_matrices[count_recv_offsets[n] + s] * type_size;
+    }
+  }
+  int *data_recv_offsets = get_offsets(data_recv_counts, num_nodes);
+  char *recv_data = (char *)malloc(data_recv_offsets[num_nodes - 1] +
+                                   data_recv_counts[num_nodes - 1]);
+  MPI_Alltoallv(send_data, data_send_counts, data_send_offsets, MPI_BYTE,
+                recv_data, data_recv_counts, data_recv_offsets, MPI_BYTE,
+                hierarchy->leader_comm);
+
+  // Find where the block from every sending rank to every receiving process
+  // of this node is in the received data
+  int *block_offsets = (int *)malloc(sizeof(int) * comm_size * my_node_size);
+  int total_size = 0;
+  for (n = 0; n < num_nodes; n++) {
+    int offset = data_recv_offsets[n];
+    for (s = hierarchy->node_offsets[n]; s < hierarchy->node_offsets[n + 1]; s++) {
+      int sender = hierarchy->node_ranks[s];
+      int local_sender = s - hierarchy->node_offsets[n];
+      for (d = 0; d < my_node_size; d++) {
+        block_offsets[sender * my_node_size + d] = offset;
+        offset += recv_matrices[count_recv_offsets[n] + local_sender * my_node_size + d] *
+          type_size;
+      }
+    }
+    total_size += data_recv_counts[n];
+  }
+
+  // Reorder the data by receiving process and then by sending rank
+  char *member_data = (char *)malloc(total_size);
+  char *position = member_data;
+  for (d = 0; d < my_node_size; d++) {
+    member_sizes[d] = 0;
+    for (s = 0; s < comm_size; s++) {
+      int n = hierarchy->node_of_rank[s];
+      int size = recv_matrices[count_recv_offsets[n] +
+                               hierarchy->local_rank_of_rank[s] * my_node_size + d] *
+        type_size;
+      memcpy(position, recv_data + block_offsets[s * my_node_size + d], size);
+      position += size;
+      member_sizes[d] += size;
+    }
+  }
+
+  free(count_send_counts);
+  free(data_send_counts);
+  free(count_recv_counts);
+  free(count_send_offsets);
+  free(count_recv_offsets);
+  free(send_matrices);
+  free(recv_matrices);
+  free(data_recv_counts);
+  free(data_send_offsets);
+  free(data_recv_offsets);
+  free(send_data);
+  free(positions);
+  free(recv_data);
+  free(block_offsets);
+  return member_data;
+}
+
+int TMPI_Alltoallv(const void *send_data, const int *send_counts,
+                   const int *send_offsets, void *recv_data,
+                   const int *recv_counts, const int *recv_offsets,
+                   MPI_Datatype datatype, TMPI_Hierarchy *hierarchy) {
+  int comm_size;
+  MPI_Comm_size(hierarchy->comm, &comm_size);
+  int local_rank, node_size;
+  MPI_Comm_rank(hierarchy->node_comm, &local_rank);
+  MPI_Comm_size(hierarchy->node_comm, &node_size);
+  int type_size;
+  MPI_Type_size(datatype, &type_size);
+  int i;
+
+  // Pack the data ordered by the node of the receiving process, and by the
+  // order of the processes on the node, so that the data for a node is
+  // contiguous
+  int send_size = 0;
+  for (i = 0; i < comm_size; i++) {
+    send_size += send_counts[i] * type_size;
+  }
+  char *packed_data = (char *)malloc(send_size);
+  char *position = packed_data;
+  for (i = 0; i < comm_size; i++) {
+    int receiver = hierarchy->node_ranks[i];
+    memcpy(position, (char *)send_data + send_offsets[receiver] * type_size,
+           send_counts[receiver] * type_size);
+    position += send_counts[receiver] * type_size;
+  }
+
+  // Gather the counts and the data of the node on the leader
+  int *local_counts = NULL, *local_sizes = NULL, *local_offsets = NULL;
+  char *local_data = NULL;
+  if (local_rank == 0) {
+    local_counts = (int *)malloc(sizeof(int) * comm_size * node_size);
+    local_sizes = (int *)malloc(sizeof(int) * node_size);
+  }
+  MPI_Gather(send_counts, comm_size, MPI_INT, local_counts, comm_size, MPI_INT,
+             0, hierarchy->node_comm);
+  MPI_Gather(&send_size, 1, MPI_INT, local_sizes, 1, MPI_INT, 0,
+             hierarchy->node_comm);
+  if (local_rank == 0) {
+    local_offsets = get_offsets(local_sizes, node_size);
+    local_data = (char *)malloc(local_offsets[node_size - 1] +
+                                local_sizes[node_size - 1]);
+  }
+  MPI_Gatherv(packed_data, send_size, MPI_BYTE, local_data, local_sizes,
+              local_offsets, MPI_BYTE, 0, hierarchy->node_comm);
+  free(packed_data);
+
+  // Exchange between the leaders and scatter the data on the node. Every
+  // process gets its data ordered by sending rank.
+  char *member_data = NULL;
+  if (local_rank == 0) {
+    member_data = exchange_between_leaders(local_counts, local_data, type_size,
+                                           hierarchy, local_sizes);
+    free(local_offsets);
+    local_offsets = get_offsets(local_sizes, node_size);
+  }
+  int recv_size = 0;
+  for (i = 0; i < comm_size; i++) {
+    recv_size += recv_counts[i] * type_size;
+  }
+  char *unpacked_data = (char *)malloc(recv_size);
+  MPI_Scatterv(member_data, local_sizes, local_offsets, MPI_BYTE,
+               unpacked_data, recv_size, MPI_BYTE, 0, hierarchy->node_comm);
+  position = unpacked_data;
+  for (i = 0; i < comm_size; i++) {
+    memcpy((char *)recv_data + recv_offsets[i] * type_size, position,
+           recv_counts[i] * type_size);
+    position += recv_counts[i] * type_size;
+  }
+
+  free(unpacked_data);
+  free(local_counts);
+  free(local_sizes);
+  free(local_offsets);
+  free(local_data);
+  free(member_data);
+  return MPI_SUCCESS;
+}
+
+int TMPI_Alltoall(const void *send_data, int count, void *recv_data,
+                  MPI_Datatype datatype, TMPI_Hierarchy *hierarchy) {
+  int comm_size;
+  MPI_Comm_size(hierarchy->comm, &comm_size);
+  int *counts = (int *)malloc(sizeof(int) * comm_size);
+  int *offsets = (int *)malloc(sizeof(int) * comm_size);
+  int i;
+  for (i = 0; i < comm_size; i++) {
+    counts[i] = count;
+    offsets[i] = count * i;
+  }
+  int result = TMPI_Alltoallv(send_data, counts, offsets, recv_data, counts,
+                              offsets, datatype, hierarchy);
+  free(counts);
+  free(offsets);
+  return result;
+}
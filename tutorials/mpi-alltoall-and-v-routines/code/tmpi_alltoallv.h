@@ -0,0 +1,47 @@
+// Author: Wes Kendall
+// Copyright 2014 www.mpitutorial.com
+// This code is provided freely with the tutorials on mpitutorial.com. Feel
+// free to modify it for your own use. Any distribution of the code must
+// either provide a link to www.mpitutorial.com or keep this header intact.
+//
+// Header file for TMPI_Alltoallv, a two-level all-to-all exchange
+//
+#ifndef __TMPI_ALLTOALLV_H
+#define __TMPI_ALLTOALLV_H 1
+
+// How the processes of a communicator are spread over nodes. Creating it
+// needs communication, so it is created once and used for many exchanges.
+typedef struct {
+  MPI_Comm comm;
+  // The processes on the same node as this process, and the first process of
+  // every node or MPI_COMM_NULL on other processes. They belong to the
+  // topology that TMPI_Topology caches on comm and must not be freed.
+  MPI_Comm node_comm;
+  MPI_Comm leader_comm;
+  int node;
+  int num_nodes;
+  // The node and the rank in node_comm of every rank of comm
+  int *node_of_rank;
+  int *local_rank_of_rank;
+  // The ranks of comm on node n are node_ranks[node_offsets[n]] to
+  // node_ranks[node_offsets[n + 1] - 1] in the order of node_comm
+  int *node_ranks;
+  int *node_offsets;
+} TMPI_Hierarchy;
+
+int TMPI_Hierarchy_create(MPI_Comm comm, TMPI_Hierarchy *hierarchy);
+
+int TMPI_Hierarchy_free(TMPI_Hierarchy *hierarchy);
+
+// Works like MPI_Alltoallv on the communicator of the hierarchy, with the same
+// datatype for sending and receiving. The datatype must be contiguous.
+int TMPI_Alltoallv(const void *send_data, const int *send_counts,
+                   const int *send_offsets, void *recv_data,
+                   const int *recv_counts, const int *recv_offsets,
+                   MPI_Datatype datatype, TMPI_Hierarchy *hierarchy);
+
+// Works like MPI_Alltoall on the communicator of the hierarchy
+int TMPI_Alltoall(const void *send_data, int count, void *recv_data,
+                  MPI_Datatype datatype, TMPI_Hierarchy *hierarchy);
+
+#endif
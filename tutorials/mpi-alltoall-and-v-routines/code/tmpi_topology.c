@@ -0,0 +1,238 @@
+// Author: Wesley Bland
+// Copyright 2015 www.mpitutorial.com
+// This code is provided freely with the tutorials on mpitutorial.com. Feel
+// free to modify it for your own use. Any distribution of the code must
+// either provide a link to www.mpitutorial.com or keep this header intact.
+//
+// Communicators that follow the placement of processes. Splitting by
+// rank / 4 only matches the machine by chance. TMPI_Topology finds the nodes
+// with MPI_Comm_split_type and the sockets with the socket split type of the
+// MPI library, and builds Cartesian grids in which every node owns a block.
+// The topology is cached on the communicator as an attribute, so collective
+// routines can get it cheaply every time they are called.
+//
+// To try it on a single machine, set the environment variables
+// TMPI_TOPOLOGY_NODE_SIZE and TMPI_TOPOLOGY_SOCKET_SIZE to group that many
+// consecutive ranks into a node, or processes of a node into a socket, instead.
+//
+#include <stdlib.h>
+#include <mpi.h>
+#include "tmpi_topology.h"
+
+// The attribute that holds the topology of a communicator
+static int topology_keyval = MPI_KEYVAL_INVALID;
+
+// Frees a topology when its communicator is freed or its attribute deleted
+static int delete_topology(MPI_Comm comm, int keyval, void *attribute,
+                           void *extra_state) {
+  TMPI_Topology *topology = (TMPI_Topology *)attribute;
+  int d, p;
+  for (d = 0; d <= TMPI_TOPOLOGY_MAX_DIMS; d++) {
+    for (p = 0; p < (1 << TMPI_TOPOLOGY_MAX_DIMS); p++) {
+      if (topology->grids[d][p] != MPI_COMM_NULL) {
+        MPI_Comm_free(&topology->grids[d][p]);
+      }
+    }
+  }
+  if (topology->leader_comm != MPI_COMM_NULL) {
+    MPI_Comm_free(&topology->leader_comm);
+  }
+  MPI_Comm_free(&topology->socket_comm);
+  MPI_Comm_free(&topology->node_comm);
+  free(topology);
+  return MPI_SUCCESS;
+}
+
+// Splits comm into groups of group_size consecutive ranks if the environment
+// variable env_name is set. Returns false if it is not set.
+static int split_by_env(MPI_Comm comm, const char *env_name,
+                        MPI_Comm *group_comm) {
+  const char *group_size = getenv(env_name);
+  if (group_size == NULL || atoi(group_size) <= 0) {
+    return 0;
+  }
+  int comm_rank;
+  MPI_Comm_rank(comm, &comm_rank);
+  MPI_Comm_split(comm, comm_rank / atoi(group_size), comm_rank, group_comm);
+  return 1;
+}
+
+// Splits the processes of a node by socket. Sockets are not part of the MPI 3
+// standard, so this uses the split type of Open MPI, and of MPI 4 libraries,
+// where it is available.
+static void split_by_socket(MPI_Comm node_comm, MPI_Comm *socket_comm) {
+  if (split_by_env(node_comm, "TMPI_TOPOLOGY_SOCKET_SIZE", socket_comm)) {
+    return;
+  }
+  int node_rank;
+  MPI_Comm_rank(node_comm, &node_rank);
+#if defined(OPEN_MPI)
+  MPI_Comm_split_type(node_comm, OMPI_COMM_TYPE_SOCKET, node_rank,
+                      MPI_INFO_NULL, socket_comm);
+#elif MPI_VERSION >= 4
+  MPI_Info info;
+  MPI_Info_create(&info);
+  MPI_Info_set(info, "mpi_hw_resource_type", "Package");
+  MPI_Comm_split_type(node_comm, MPI_COMM_TYPE_HW_GUIDED, node_rank, info,
+                      socket_comm);
+  MPI_Info_free(&info);
+#else
+  *socket_comm = MPI_COMM_NULL;
+#endif
+  // Some libraries give processes that are not bound to a socket no
+  // communicator, and others give them one of their own
+  if (*socket_comm == MPI_COMM_NULL) {
+    MPI_Comm_dup(node_comm, socket_comm);
+  }
+}
+
+// Creates the topology of comm
+static void create_topology(MPI_Comm comm, TMPI_Topology *topology) {
+  int comm_rank;
+  MPI_Comm_rank(comm, &comm_rank);
+  if (!split_by_env(comm, "TMPI_TOPOLOGY_NODE_SIZE", &topology->node_comm)) {
+    MPI_Comm_split_type(comm, MPI_COMM_TYPE_SHARED, comm_rank, MPI_INFO_NULL,
+                        &topology->node_comm);
+  }
+  split_by_socket(topology->node_comm, &topology->socket_comm);
+  int node_rank, node_size;
+  MPI_Comm_rank(topology->node_comm, &node_rank);
+  MPI_Comm_size(topology->node_comm, &node_size);
+  MPI_Comm_split(comm, node_rank == 0 ? 0 : MPI_UNDEFINED, comm_rank,
+                 &topology->leader_comm);
+
+  // Nodes are numbered by the rank of their leader in the leader communicator
+  int node_info[2];
+  if (node_rank == 0) {
+    MPI_Comm_rank(topology->leader_comm, &node_info[0]);
+    MPI_Comm_size(topology->leader_comm, &node_info[1]);
+  }
+  MPI_Bcast(node_info, 2, MPI_INT, 0, topology->node_comm);
+  topology->node = node_info[0];
+  topology->num_nodes = node_info[1];
+
+  int node_sizes[2] = {node_size, -node_size};
+  MPI_Allreduce(MPI_IN_PLACE, node_sizes, 2, MPI_INT, MPI_MAX, comm);
+  topology->uniform_nodes = node_sizes[0] == -node_sizes[1];
+
+  int d, p;
+  for (d = 0; d <= TMPI_TOPOLOGY_MAX_DIMS; d++) {
+    for (p = 0; p < (1 << TMPI_TOPOLOGY_MAX_DIMS); p++) {
+      topology->grids[d][p] = MPI_COMM_NULL;
+    }
+  }
+}
+
+int TMPI_Topology_get(MPI_Comm comm, TMPI_Topology **topology) {
+  if (topology_keyval == MPI_KEYVAL_INVALID) {
+    MPI_Comm_create_keyval(MPI_COMM_NULL_COPY_FN, delete_topology,
+                           &topology_keyval, NULL);
+  }
+  int found;
+  MPI_Comm_get_attr(comm, topology_keyval, topology, &found);
+  if (!found) {
+    *topology = (TMPI_Topology *)malloc(sizeof(TMPI_Topology));
+    create_topology(comm, *topology);
+    MPI_Comm_set_attr(comm, topology_keyval, *topology);
+  }
+  return MPI_SUCCESS;
+}
+
+int TMPI_Topology_free(MPI_Comm comm) {
+  if (topology_keyval == MPI_KEYVAL_INVALID) {
+    return MPI_SUCCESS;
+  }
+  return MPI_Comm_delete_attr(comm, topology_keyval);
+}
+
+// Computes the coordinates of an index in a grid in row major order, which is
+// the order of the ranks of a Cartesian communicator
+static void get_coords(int index, int ndims, const int *dims, int *coords) {
+  int d;
+  for (d = ndims - 1; d >= 0; d--) {
+    coords[d] = index % dims[d];
+    index /= dims[d];
+  }
+}
+
+// Creates a grid in which every node owns a block. The nodes form a grid of
+// their own, and so do the processes of a node. Dimensions in which there are
+// many nodes get few processes per node, so that the blocks stay close to
+// cubes. The processes are ordered by their place in the grid before the
+// grid is created, so it needs no reordering.
+static void create_node_grid(MPI_Comm comm, TMPI_Topology *topology,
+                             int ndims, const int *periods,
+                             MPI_Comm *grid_comm) {
+  int node_rank, node_size;
+  MPI_Comm_rank(topology->node_comm, &node_rank);
+  MPI_Comm_size(topology->node_comm, &node_size);
+  int node_dims[TMPI_TOPOLOGY_MAX_DIMS] = {0};
+  int sorted_block_dims[TMPI_TOPOLOGY_MAX_DIMS] = {0};
+  MPI_Dims_create(topology->num_nodes, ndims, node_dims);
+  MPI_Dims_create(node_size, ndims, sorted_block_dims);
+
+  int block_dims[TMPI_TOPOLOGY_MAX_DIMS], dims[TMPI_TOPOLOGY_MAX_DIMS];
+  int node_coords[TMPI_TOPOLOGY_MAX_DIMS], block_coords[TMPI_TOPOLOGY_MAX_DIMS];
+  int coords[TMPI_TOPOLOGY_MAX_DIMS];
+  int d;
+  for (d = 0; d < ndims; d++) {
+    block_dims[d] = sorted_block_dims[ndims - 1 - d];
+    dims[d] = node_dims[d] * block_dims[d];
+  }
+  get_coords(topology->node, ndims, node_dims, node_coords);
+  get_coords(node_rank, ndims, block_dims, block_coords);
+  int grid_rank = 0;
+  for (d = 0; d < ndims; d++) {
+    coords[d] = node_coords[d] * block_dims[d] + block_coords[d];
+    grid_rank = grid_rank * dims[d] + coords[d];
+  }
+
+  MPI_Comm ordered_comm;
+  MPI_Comm_split(comm, 0, grid_rank, &ordered_comm);
+  MPI_Cart_create(ordered_comm, ndims, dims, periods, 0, grid_comm);
+  MPI_Comm_free(&ordered_comm);
+}
+
+int TMPI_Topology_get_grid(MPI_Comm comm, int ndims, const int *periods,
+                           MPI_Comm *grid_comm) {
+  if (ndims < 1 || ndims > TMPI_TOPOLOGY_MAX_DIMS) {
+    return MPI_ERR_DIMS;
+  }
+  TMPI_Topology *topology;
+  TMPI_Topology_get(comm, &topology);
+  int period_bits = 0;
+  int d;
+  for (d = 0; d < ndims; d++) {
+    period_bits |= (periods[d] ? 1 : 0) << d;
+  }
+  MPI_Comm *cached_grid = &topology->grids[ndims][period_bits];
+  if (*cached_grid == MPI_COMM_NULL) {
+    if (topology->uniform_nodes && topology->num_nodes > 1) {
+      create_node_grid(comm, topology, ndims, periods, cached_grid);
+    } else {
+      // One node, or nodes of different sizes. Let MPI place the processes.
+      int comm_size;
+      MPI_Comm_size(comm, &comm_size);
+      int dims[TMPI_TOPOLOGY_MAX_DIMS] = {0};
+      MPI_Dims_create(comm_size, ndims, dims);
+      MPI_Cart_create(comm, ndims, dims, periods, 1, cached_grid);
+    }
+  }
+  *grid_comm = *cached_grid;
+  return MPI_SUCCESS;
+}
+
+int TMPI_Node_allreduce(const void *send_data, void *recv_data, int count,
+                        MPI_Datatype datatype, MPI_Op op, MPI_Comm comm) {
+  TMPI_Topology *topology;
+  TMPI_Topology_get(comm, &topology);
+  // Reduce on the leader of the node, combine the results of the nodes on
+  // the leaders, and send the result back on every node
+  MPI_Reduce(send_data, recv_data, count, datatype, op, 0,
+             topology->node_comm);
+  if (topology->leader_comm != MPI_COMM_NULL) {
+    MPI_Allreduce(MPI_IN_PLACE, recv_data, count, datatype, op,
+                  topology->leader_comm);
+  }
+  return MPI_Bcast(recv_data, count, datatype, 0, topology->node_comm);
+}
@@ -0,0 +1,277 @@
+// Author: Wes Kendall
+// Copyright 2011 www.mpitutorial.com
+// This code is provided freely with the tutorials on mpitutorial.com. Feel
+// free to modify it for your own use. Any distribution of the code must
+// either provide a link to www.mpitutorial.com or keep this header intact.
+//
+// Benchmark of collective operations that sweeps message sizes and process
+// counts. Grown from compare_bcast, it compares the hand-written broadcasts
+// of this lesson with the collectives of the MPI library and reports the
+// latency distribution and bandwidth of each as CSV or JSON.
+//
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <mpi.h>
+#include <assert.h>
+#include "tmpi_bcast.h"
+#include "tmpi_bench.h"
+
+// The smallest and largest message sizes of the sweep in bytes
+#define MIN_MESSAGE_SIZE 1
+#define MAX_MESSAGE_SIZE (256 * 1024 * 1024)
+
+// Benchmarks that would need larger buffers than this are skipped
+#define MAX_BUFFER_SIZE (1024LL * 1024 * 1024)
+
+// The buffers a benchmark runs on. Collectives that send or receive a block per
+// process (like MPI_Gather) use comm_size blocks of message_size bytes.
+typedef struct {
+  char *send_buffer;
+  char *recv_buffer;
+  int *counts;
+  int *offsets;
+} BenchBuffers;
+
+// A collective operation to benchmark. If per_process_buffers is set, the buffers
+// hold comm_size blocks of message_size bytes. Otherwise they hold one block.
+// Message sizes below min_message_size are skipped.
+typedef struct {
+  const char *collective;
+  const char *implementation;
+  void (*run)(BenchBuffers *buffers, int message_size, MPI_Comm comm);
+  int per_process_buffers;
+  int min_message_size;
+} Benchmark;
+
+// The linear broadcast from my_bcast.c
+void my_bcast(void* data, int count, MPI_Datatype datatype, int root,
+              MPI_Comm communicator) {
+  int world_rank;
+  MPI_Comm_rank(communicator, &world_rank);
+  int world_size;
+  MPI_Comm_size(communicator, &world_size);
+
+  if (world_rank == root) {
+    // If we are the root process, send our data to everyone
+    int i;
+    for (i = 0; i < world_size; i++) {
+      if (i != world_rank) {
+        MPI_Send(data, count, datatype, i, 0, communicator);
+      }
+    }
+  } else {
+    // If we are a receiver process, receive the data from the root
+    MPI_Recv(data, count, datatype, root, 0, communicator, MPI_STATUS_IGNORE);
+  }
+}
+
+void run_my_bcast(BenchBuffers *buffers, int message_size, MPI_Comm comm) {
+  my_bcast(buffers->send_buffer, message_size, MPI_BYTE, 0, comm);
+}
+
+void run_tmpi_bcast(BenchBuffers *buffers, int message_size, MPI_Comm comm) {
+  TMPI_Bcast(buffers->send_buffer, message_size, MPI_BYTE, 0, comm);
+}
+
+void run_mpi_bcast(BenchBuffers *buffers, int message_size, MPI_Comm comm) {
+  MPI_Bcast(buffers->send_buffer, message_size, MPI_BYTE, 0, comm);
+}
+
+// Reductions sum floats, so message sizes below the size of a float are skipped
+void run_mpi_reduce(BenchBuffers *buffers, int message_size, MPI_Comm comm) {
+  MPI_Reduce(buffers->send_buffer, buffers->recv_buffer, message_size / sizeof(float),
+             MPI_FLOAT, MPI_SUM, 0, comm);
+}
+
+void run_mpi_allreduce(BenchBuffers *buffers, int message_size, MPI_Comm comm) {
+  MPI_Allreduce(buffers->send_buffer, buffers->recv_buffer, message_size / sizeof(float),
+                MPI_FLOAT, MPI_SUM, comm);
+}
+
+void run_mpi_scatter(BenchBuffers *buffers, int message_size, MPI_Comm comm) {
+  MPI_Scatter(buffers->send_buffer, message_size, MPI_BYTE, buffers->recv_buffer,
+              message_size, MPI_BYTE, 0, comm);
+}
+
+void run_mpi_gather(BenchBuffers *buffers, int message_size, MPI_Comm comm) {
+  MPI_Gather(buffers->send_buffer, message_size, MPI_BYTE, buffers->recv_buffer,
+             message_size, MPI_BYTE, 0, comm);
+}
+
+void run_mpi_allgather(BenchBuffers *buffers, int message_size, MPI_Comm comm) {
+  MPI_Allgather(buffers->send_buffer, message_size, MPI_BYTE, buffers->recv_buffer,
+                message_size, MPI_BYTE, comm);
+}
+
+void run_mpi_alltoallv(BenchBuffers *buffers, int message_size, MPI_Comm comm) {
+  // The counts hold the message size of every process
+  (void)message_size;
+  MPI_Alltoallv(buffers->send_buffer, buffers->counts, buffers->offsets, MPI_BYTE,
+                buffers->recv_buffer, buffers->counts, buffers->offsets, MPI_BYTE, comm);
+}
+
+Benchmark benchmarks[] = {
+  {"bcast", "my_bcast", &run_my_bcast, 0, 1},
+  {"bcast", "TMPI_Bcast", &run_tmpi_bcast, 0, 1},
+  {"bcast", "MPI_Bcast", &run_mpi_bcast, 0, 1},
+  {"reduce", "MPI_Reduce", &run_mpi_reduce, 0, sizeof(float)},
+  {"allreduce", "MPI_Allreduce", &run_mpi_allreduce, 0, sizeof(float)},
+  {"scatter", "MPI_Scatter", &run_mpi_scatter, 1, 1},
+  {"gather", "MPI_Gather", &run_mpi_gather, 1, 1},
+  {"allgather", "MPI_Allgather", &run_mpi_allgather, 1, 1},
+  {"alltoallv", "MPI_Alltoallv", &run_mpi_alltoallv, 1, 1},
+};
+
+// One trial of a benchmark for TMPI_Bench_time
+typedef struct {
+  Benchmark *benchmark;
+  BenchBuffers *buffers;
+  int message_size;
+  MPI_Comm comm;
+} BenchTrial;
+
+void run_trial(void *arg) {
+  BenchTrial *trial = (BenchTrial *)arg;
+  trial->benchmark->run(trial->buffers, trial->message_size, trial->comm);
+}
+
+// Runs a benchmark for one message size on comm. The time of a trial is the time
+// of the slowest process. The sorted trial times are returned on rank zero of
+// comm.
+double *time_benchmark(Benchmark *benchmark, int message_size, int num_trials,
+                       int num_warmup_trials, MPI_Comm comm) {
+  int comm_size;
+  MPI_Comm_size(comm, &comm_size);
+
+  // Allocate and initialize the buffers
+  long long buffer_size = benchmark->per_process_buffers ?
+    (long long)message_size * comm_size : message_size;
+  BenchBuffers buffers;
+  buffers.send_buffer = malloc(buffer_size);
+  buffers.recv_buffer = malloc(buffer_size);
+  buffers.counts = malloc(sizeof(int) * comm_size);
+  buffers.offsets = malloc(sizeof(int) * comm_size);
+  assert(buffers.send_buffer != NULL && buffers.recv_buffer != NULL);
+  memset(buffers.send_buffer, 0, buffer_size);
+  memset(buffers.recv_buffer, 0, buffer_size);
+  int i;
+  for (i = 0; i < comm_size; i++) {
+    buffers.counts[i] = message_size;
+    buffers.offsets[i] = message_size * i;
+  }
+
+  BenchTrial trial = {benchmark, &buffers, message_size, comm};
+  double *sorted_times = TMPI_Bench_time(&run_trial, &trial, num_warmup_trials,
+                                         num_trials, comm);
+
+  free(buffers.send_buffer);
+  free(buffers.recv_buffer);
+  free(buffers.counts);
+  free(buffers.offsets);
+  return sorted_times;
+}
+
+// Prints the results of one benchmark run. Times are in microseconds and the
+// bandwidth is the message size divided by the median time in MB/s.
+void print_result(Benchmark *benchmark, int comm_size, int message_size,
+                  double *sorted_times, int num_trials, int json, int first_result) {
+  double min = sorted_times[0] * 1e6;
+  double median = sorted_times[num_trials / 2] * 1e6;
+  double p99 = sorted_times[(99 * num_trials + 99) / 100 - 1] * 1e6;
+  double max = sorted_times[num_trials - 1] * 1e6;
+  double bandwidth = median > 0 ? message_size / median : 0;
+  if (json) {
+    printf("%s  {\"collective\": \"%s\", \"implementation\": \"%s\", \"procs\": %d, "
+           "\"bytes\": %d, \"min_us\": %.3f, \"median_us\": %.3f, \"p99_us\": %.3f, "
+           "\"max_us\": %.3f, \"bandwidth_MBps\": %.3f}",
+           first_result ? "" : ",\n", benchmark->collective, benchmark->implementation,
+           comm_size, message_size, min, median, p99, max, bandwidth);
+  } else {
+    printf("%s,%s,%d,%d,%.3f,%.3f,%.3f,%.3f,%.3f\n", benchmark->collective,
+           benchmark->implementation, comm_size, message_size, min, median, p99, max,
+           bandwidth);
+  }
+  fflush(stdout);
+}
+
+int main(int argc, char** argv) {
+  if (argc != 5 || (strcmp(argv[4], "csv") != 0 && strcmp(argv[4], "json") != 0)) {
+    fprintf(stderr, "Usage: bench_collectives max_message_size num_trials "
+            "num_warmup_trials csv|json\n");
+    exit(1);
+  }
+
+  int max_message_size = atoi(argv[1]);
+  int num_trials = atoi(argv[2]);
+  int num_warmup_trials = atoi(argv[3]);
+  int json = strcmp(argv[4], "json") == 0;
+  if (max_message_size > MAX_MESSAGE_SIZE || max_message_size < MIN_MESSAGE_SIZE) {
+    max_message_size = MAX_MESSAGE_SIZE;
+  }
+  if (num_trials < 1) {
+    num_trials = 1;
+  }
+
+  MPI_Init(NULL, NULL);
+
+  int world_rank;
+  MPI_Comm_rank(MPI_COMM_WORLD, &world_rank);
+  int world_size;
+  MPI_Comm_size(MPI_COMM_WORLD, &world_size);
+
+  if (world_rank == 0) {
+    if (json) {
+      printf("[\n");
+    } else {
+      printf("collective,implementation,procs,bytes,min_us,median_us,p99_us,max_us,"
+             "bandwidth_MBps\n");
+    }
+  }
+
+  // Sweep the process counts in powers of two, ending with the whole world. The
+  // first comm_size processes of the world run the benchmarks while the others wait.
+  int first_result = 1;
+  int comm_size = world_size > 1 ? 2 : 1;
+  while (1) {
+    MPI_Comm comm;
+    MPI_Comm_split(MPI_COMM_WORLD, world_rank < comm_size ? 0 : MPI_UNDEFINED,
+                   world_rank, &comm);
+    if (comm != MPI_COMM_NULL) {
+      int b;
+      for (b = 0; b < (int)(sizeof(benchmarks) / sizeof(Benchmark)); b++) {
+        int message_size;
+        for (message_size = MIN_MESSAGE_SIZE; message_size <= max_message_size;
+             message_size *= 2) {
+          long long buffer_size = benchmarks[b].per_process_buffers ?
+            (long long)message_size * comm_size : message_size;
+          if (buffer_size > MAX_BUFFER_SIZE ||
+              message_size < benchmarks[b].min_message_size) {
+            continue;
+          }
+          double *sorted_times = time_benchmark(&benchmarks[b], message_size, num_trials,
+                                                num_warmup_trials, comm);
+          if (world_rank == 0) {
+            print_result(&benchmarks[b], comm_size, message_size, sorted_times,
+                         num_trials, json, first_result);
+            first_result = 0;
+            free(sorted_times);
+          }
+        }
+      }
+      MPI_Comm_free(&comm);
+    }
+    MPI_Barrier(MPI_COMM_WORLD);
+
+    if (comm_size == world_size) {
+      break;
+    }
+    comm_size = comm_size * 2 < world_size ? comm_size * 2 : world_size;
+  }
+
+  if (world_rank == 0 && json) {
+    printf("\n]\n");
+  }
+
+  MPI_Finalize();
+}
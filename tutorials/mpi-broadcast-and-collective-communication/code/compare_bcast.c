@@ -4,12 +4,16 @@
 // free to modify it for your own use. Any distribution of the code must
 // either provide a link to www.mpitutorial.com or keep this header intact.
 //
-// Comparison of MPI_Bcast with the my_bcast function
+// Comparison of MPI_Bcast with the my_bcast and TMPI_Bcast functions, and with
+// a broadcast to memory that is shared by the processes of every node
 //
 #include <stdio.h>
 #include <stdlib.h>
 #include <mpi.h>
 #include <assert.h>
+#include "tmpi_bcast.h"
+#include "tmpi_memory.h"
+#include "tmpi_topology.h"
 
 void my_bcast(void* data, int count, MPI_Datatype datatype, int root,
               MPI_Comm communicator) {
@@ -32,6 +36,17 @@ void my_bcast(void* data, int count, MPI_Datatype datatype, int root,
   }
 }
 
+// Broadcasts count ints from the first process of comm to the shared memory
+// of every node. Only the first processes of the nodes take part in the
+// broadcast. The other processes read the data from the memory of their node
+// instead of receiving a copy of their own.
+void shared_bcast(TMPI_Shared* shared, int count, MPI_Comm leader_comm) {
+  if (leader_comm != MPI_COMM_NULL) {
+    MPI_Bcast(shared->data, count, MPI_INT, 0, leader_comm);
+  }
+  TMPI_Shared_sync(shared);
+}
+
 int main(int argc, char** argv) {
   if (argc != 3) {
     fprintf(stderr, "Usage: compare_bcast num_elements num_trials\n");
@@ -47,11 +62,21 @@ int main(int argc, char** argv) {
   MPI_Comm_rank(MPI_COMM_WORLD, &world_rank);
 
   double total_my_bcast_time = 0.0;
+  double total_tmpi_bcast_time = 0.0;
   double total_mpi_bcast_time = 0.0;
+  double total_shared_bcast_time = 0.0;
   int i;
   int* data = (int*)malloc(sizeof(int) * num_elements);
   assert(data != NULL);
 
+  // The processes of every node share one copy of the data. The first process
+  // of every node receives it.
+  TMPI_Topology *topology;
+  TMPI_Topology_get(MPI_COMM_WORLD, &topology);
+  TMPI_Shared shared;
+  TMPI_Shared_create(sizeof(int) * (MPI_Aint)num_elements, topology->node_comm,
+                     &shared);
+
   for (i = 0; i < num_trials; i++) {
     // Time my_bcast
     // Synchronize before starting timing
@@ -62,12 +87,26 @@ int main(int argc, char** argv) {
     MPI_Barrier(MPI_COMM_WORLD);
     total_my_bcast_time += MPI_Wtime();
 
+    // Time TMPI_Bcast
+    MPI_Barrier(MPI_COMM_WORLD);
+    total_tmpi_bcast_time -= MPI_Wtime();
+    TMPI_Bcast(data, num_elements, MPI_INT, 0, MPI_COMM_WORLD);
+    MPI_Barrier(MPI_COMM_WORLD);
+    total_tmpi_bcast_time += MPI_Wtime();
+
     // Time MPI_Bcast
     MPI_Barrier(MPI_COMM_WORLD);
     total_mpi_bcast_time -= MPI_Wtime();
     MPI_Bcast(data, num_elements, MPI_INT, 0, MPI_COMM_WORLD);
     MPI_Barrier(MPI_COMM_WORLD);
     total_mpi_bcast_time += MPI_Wtime();
+
+    // Time the broadcast to shared memory
+    MPI_Barrier(MPI_COMM_WORLD);
+    total_shared_bcast_time -= MPI_Wtime();
+    shared_bcast(&shared, num_elements, topology->leader_comm);
+    MPI_Barrier(MPI_COMM_WORLD);
+    total_shared_bcast_time += MPI_Wtime();
   }
 
   // Print off timing information
@@ -75,9 +114,14 @@ int main(int argc, char** argv) {
     printf("Data size = %d, Trials = %d\n", num_elements * (int)sizeof(int),
            num_trials);
     printf("Avg my_bcast time = %lf\n", total_my_bcast_time / num_trials);
+    printf("Avg TMPI_Bcast time = %lf\n", total_tmpi_bcast_time / num_trials);
     printf("Avg MPI_Bcast time = %lf\n", total_mpi_bcast_time / num_trials);
+    printf("Avg shared memory bcast time = %lf\n",
+           total_shared_bcast_time / num_trials);
   }
 
+  TMPI_Shared_free(&shared);
+  TMPI_Topology_free(MPI_COMM_WORLD);
   free(data);
   MPI_Finalize();
 }
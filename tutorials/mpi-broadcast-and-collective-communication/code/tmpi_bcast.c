@@ -0,0 +1,244 @@
+// Author: Wes Kendall
+// Copyright 2011 www.mpitutorial.com
+// This code is provided freely with the tutorials on mpitutorial.com. Feel
+// free to modify it for your own use. Any distribution of the code must
+// either provide a link to www.mpitutorial.com or keep this header intact.
+//
+// Broadcast algorithms built on point-to-point communication. Unlike my_bcast,
+// where the root sends the whole message to every process, these algorithms
+// spread the work of sending over all processes.
+//
+// The thresholds used to choose an algorithm can be tuned with environment
+// variables:
+//   TMPI_BCAST_SHORT_MSG - Messages smaller than this many bytes use the
+//                          binomial tree (default 12288)
+//   TMPI_BCAST_LONG_MSG - Messages of at least this many bytes use the
+//                         pipeline on small communicators (default 524288)
+//   TMPI_BCAST_PIPELINE_MAX_PROCS - The largest communicator that uses the
+//                                   pipeline (default 8)
+//   TMPI_BCAST_SEGMENT_SIZE - The segment size of the pipeline in bytes
+//                             (default 65536)
+//
+#include <stdlib.h>
+#include <mpi.h>
+#include "tmpi_bcast.h"
+
+#define TMPI_BCAST_TAG 0
+
+// Reads a positive integer from an environment variable, or returns the default
+// value if it is not set
+int get_tunable(const char *name, int default_value) {
+  const char *value = getenv(name);
+  if (value != NULL && atoi(value) > 0) {
+    return atoi(value);
+  }
+  return default_value;
+}
+
+// Returns the address of element "index" of a buffer of datatype elements
+char *element_address(void *data, MPI_Datatype datatype, long long index) {
+  MPI_Aint lower_bound, extent;
+  MPI_Type_get_extent(datatype, &lower_bound, &extent);
+  return (char *)data + index * extent;
+}
+
+// Broadcasts along a binomial tree. In every stage, each process that has the data
+// sends it to one process that does not, so all processes have the data after
+// log(comm_size) stages. Ranks are shifted so that the root is rank zero of the tree.
+void binomial_bcast(void *data, int count, MPI_Datatype datatype, int root,
+                    MPI_Comm comm) {
+  int comm_rank, comm_size;
+  MPI_Comm_rank(comm, &comm_rank);
+  MPI_Comm_size(comm, &comm_size);
+  int relative_rank = (comm_rank - root + comm_size) % comm_size;
+
+  // Receive the data from the parent. The parent is found by clearing the lowest
+  // set bit of the relative rank.
+  int mask = 1;
+  while (mask < comm_size) {
+    if (relative_rank & mask) {
+      int parent = (relative_rank - mask + root) % comm_size;
+      MPI_Recv(data, count, datatype, parent, TMPI_BCAST_TAG, comm, MPI_STATUS_IGNORE);
+      break;
+    }
+    mask <<= 1;
+  }
+
+  // Send the data to the children, the farthest one first
+  mask >>= 1;
+  while (mask > 0) {
+    if (relative_rank + mask < comm_size) {
+      int child = (relative_rank + mask + root) % comm_size;
+      MPI_Send(data, count, datatype, child, TMPI_BCAST_TAG, comm);
+    }
+    mask >>= 1;
+  }
+}
+
+// Returns the amount of elements in block "block" when count elements are split
+// into blocks of block_size elements. The last blocks may be partial or empty.
+int get_block_count(int count, int block_size, int block) {
+  long long block_start = (long long)block * block_size;
+  if (block_start >= count) {
+    return 0;
+  }
+  return count - block_start < block_size ? count - block_start : block_size;
+}
+
+// Broadcasts by scattering the message in comm_size blocks along a binomial tree
+// and then allgathering the blocks around a ring (van de Geijn). Every process sends
+// and receives about twice the message size no matter how many processes there are,
+// which makes this the best choice for long messages on large communicators.
+void scatter_allgather_bcast(void *data, int count, MPI_Datatype datatype, int root,
+                             MPI_Comm comm) {
+  int comm_rank, comm_size;
+  MPI_Comm_rank(comm, &comm_rank);
+  MPI_Comm_size(comm, &comm_size);
+  int relative_rank = (comm_rank - root + comm_size) % comm_size;
+  int block_size = (count + comm_size - 1) / comm_size;
+
+  // Scatter the blocks. A process receives the blocks of its whole subtree from its
+  // parent, starting with its own block. The root starts with every block.
+  int current_count = relative_rank == 0 ? count : 0;
+  int mask = 1;
+  while (mask < comm_size) {
+    if (relative_rank & mask) {
+      int parent = (relative_rank - mask + root) % comm_size;
+      long long first_element = (long long)relative_rank * block_size;
+      if (first_element < count) {
+        MPI_Status status;
+        MPI_Recv(element_address(data, datatype, first_element), count - first_element,
+                 datatype, parent, TMPI_BCAST_TAG, comm, &status);
+        MPI_Get_count(&status, datatype, &current_count);
+      }
+      break;
+    }
+    mask <<= 1;
+  }
+  mask >>= 1;
+  while (mask > 0) {
+    if (relative_rank + mask < comm_size) {
+      // Send the blocks of the child's subtree, which are all the blocks this
+      // process holds after the first mask blocks
+      int send_count = current_count - block_size * mask;
+      if (send_count > 0) {
+        int child = (relative_rank + mask + root) % comm_size;
+        MPI_Send(element_address(data, datatype, (long long)(relative_rank + mask) * block_size),
+                 send_count, datatype, child, TMPI_BCAST_TAG, comm);
+        current_count -= send_count;
+      }
+    }
+    mask >>= 1;
+  }
+
+  // Allgather the blocks around a ring. In every step a process passes the block it
+  // received in the previous step to its right neighbor.
+  int left = (comm_rank - 1 + comm_size) % comm_size;
+  int right = (comm_rank + 1) % comm_size;
+  int step;
+  for (step = 0; step < comm_size - 1; step++) {
+    int send_block = (relative_rank - step + comm_size) % comm_size;
+    int recv_block = (relative_rank - step - 1 + comm_size) % comm_size;
+    MPI_Sendrecv(element_address(data, datatype, (long long)send_block * block_size),
+                 get_block_count(count, block_size, send_block), datatype, right,
+                 TMPI_BCAST_TAG,
+                 element_address(data, datatype, (long long)recv_block * block_size),
+                 get_block_count(count, block_size, recv_block), datatype, left,
+                 TMPI_BCAST_TAG, comm, MPI_STATUS_IGNORE);
+  }
+}
+
+// Broadcasts along a chain from the root to the last process. The message is cut
+// into segments, and a process forwards each segment as soon as it arrives while
+// the next segment is still on the way. For long messages every link of the chain
+// is busy at the same time.
+void pipeline_bcast(void *data, int count, MPI_Datatype datatype, int root,
+                    MPI_Comm comm) {
+  int comm_rank, comm_size;
+  MPI_Comm_rank(comm, &comm_rank);
+  MPI_Comm_size(comm, &comm_size);
+  int relative_rank = (comm_rank - root + comm_size) % comm_size;
+  int previous = (comm_rank - 1 + comm_size) % comm_size;
+  int next = (comm_rank + 1) % comm_size;
+
+  int datatype_size;
+  MPI_Type_size(datatype, &datatype_size);
+  int segment_size = datatype_size > 0 ?
+    get_tunable("TMPI_BCAST_SEGMENT_SIZE", 65536) / datatype_size : count;
+  if (segment_size < 1) {
+    segment_size = 1;
+  }
+  int segment_count = (count + segment_size - 1) / segment_size;
+
+  MPI_Request *requests = malloc(sizeof(MPI_Request) * (segment_count + 1));
+  int segment;
+  for (segment = 0; segment < segment_count; segment++) {
+    char *segment_data = element_address(data, datatype, (long long)segment * segment_size);
+    int segment_elements = get_block_count(count, segment_size, segment);
+    if (relative_rank > 0) {
+      MPI_Recv(segment_data, segment_elements, datatype, previous, TMPI_BCAST_TAG, comm,
+               MPI_STATUS_IGNORE);
+    }
+    if (relative_rank < comm_size - 1) {
+      MPI_Isend(segment_data, segment_elements, datatype, next, TMPI_BCAST_TAG, comm,
+                &requests[segment]);
+    } else {
+      requests[segment] = MPI_REQUEST_NULL;
+    }
+  }
+  MPI_Waitall(segment_count, requests, MPI_STATUSES_IGNORE);
+  free(requests);
+}
+
+// Returns the algorithm TMPI_Bcast uses for the message and communicator size.
+// Short messages are bound by latency, so they use the binomial tree with its
+// log(comm_size) stages. Long messages are bound by bandwidth. They use the pipeline
+// on small communicators, where the chain is short, and scatter-allgather otherwise.
+TMPI_Bcast_algorithm TMPI_Bcast_choose_algorithm(int message_size, int comm_size) {
+  if (comm_size <= 2 || message_size < get_tunable("TMPI_BCAST_SHORT_MSG", 12288)) {
+    return TMPI_BCAST_BINOMIAL;
+  } else if (message_size >= get_tunable("TMPI_BCAST_LONG_MSG", 524288) &&
+             comm_size <= get_tunable("TMPI_BCAST_PIPELINE_MAX_PROCS", 8)) {
+    return TMPI_BCAST_PIPELINE;
+  } else {
+    return TMPI_BCAST_SCATTER_ALLGATHER;
+  }
+}
+
+int TMPI_Bcast_with_algorithm(void *data, int count, MPI_Datatype datatype, int root,
+                              MPI_Comm comm, TMPI_Bcast_algorithm algorithm) {
+  int comm_size;
+  MPI_Comm_size(comm, &comm_size);
+  if (count < 0) {
+    return MPI_ERR_COUNT;
+  }
+  if (root < 0 || root >= comm_size) {
+    return MPI_ERR_ROOT;
+  }
+  if (comm_size == 1 || count == 0) {
+    return MPI_SUCCESS;
+  }
+
+  if (algorithm == TMPI_BCAST_AUTO) {
+    int datatype_size;
+    MPI_Type_size(datatype, &datatype_size);
+    long long message_size = (long long)count * datatype_size;
+    algorithm = TMPI_Bcast_choose_algorithm(
+      message_size > 0x7FFFFFFF ? 0x7FFFFFFF : (int)message_size, comm_size);
+  }
+
+  if (algorithm == TMPI_BCAST_BINOMIAL) {
+    binomial_bcast(data, count, datatype, root, comm);
+  } else if (algorithm == TMPI_BCAST_SCATTER_ALLGATHER) {
+    scatter_allgather_bcast(data, count, datatype, root, comm);
+  } else if (algorithm == TMPI_BCAST_PIPELINE) {
+    pipeline_bcast(data, count, datatype, root, comm);
+  } else {
+    return MPI_ERR_ARG;
+  }
+  return MPI_SUCCESS;
+}
+
+int TMPI_Bcast(void *data, int count, MPI_Datatype datatype, int root, MPI_Comm comm) {
+  return TMPI_Bcast_with_algorithm(data, count, datatype, root, comm, TMPI_BCAST_AUTO);
+}
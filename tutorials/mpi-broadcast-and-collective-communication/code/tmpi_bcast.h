@@ -0,0 +1,30 @@
+// Author: Wes Kendall
+// Copyright 2011 www.mpitutorial.com
+// This code is provided freely with the tutorials on mpitutorial.com. Feel
+// free to modify it for your own use. Any distribution of the code must
+// either provide a link to www.mpitutorial.com or keep this header intact.
+//
+// Header file for TMPI_Bcast
+//
+#ifndef __TMPI_BCAST_H
+#define __TMPI_BCAST_H 1
+
+// The broadcast algorithms that TMPI_Bcast can choose from
+typedef enum {
+  TMPI_BCAST_AUTO,
+  TMPI_BCAST_BINOMIAL,
+  TMPI_BCAST_SCATTER_ALLGATHER,
+  TMPI_BCAST_PIPELINE
+} TMPI_Bcast_algorithm;
+
+// Broadcasts with the algorithm that suits the message and communicator size
+int TMPI_Bcast(void *data, int count, MPI_Datatype datatype, int root, MPI_Comm comm);
+
+// Broadcasts with the given algorithm
+int TMPI_Bcast_with_algorithm(void *data, int count, MPI_Datatype datatype, int root,
+                              MPI_Comm comm, TMPI_Bcast_algorithm algorithm);
+
+// Returns the algorithm TMPI_Bcast uses for the message and communicator size
+TMPI_Bcast_algorithm TMPI_Bcast_choose_algorithm(int message_size, int comm_size);
+
+#endif
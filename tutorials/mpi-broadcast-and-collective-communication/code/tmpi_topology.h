@@ -0,0 +1,61 @@
+// Author: Wesley Bland
+// Copyright 2015 www.mpitutorial.com
+// This code is provided freely with the tutorials on mpitutorial.com. Feel
+// free to modify it for your own use. Any distribution of the code must
+// either provide a link to www.mpitutorial.com or keep this header intact.
+//
+// Header file for TMPI_Topology, the communicators that follow how the
+// processes of a communicator are placed on nodes and sockets
+//
+#ifndef __TMPI_TOPOLOGY_H
+#define __TMPI_TOPOLOGY_H 1
+
+#include <mpi.h>
+
+// The largest amount of dimensions of a grid from TMPI_Topology_get_grid
+#define TMPI_TOPOLOGY_MAX_DIMS 3
+
+// How the processes of a communicator are placed on the machine. Creating it
+// needs communication, so it is created once per communicator and cached on
+// the communicator.
+typedef struct {
+  // The processes on the same node as this process
+  MPI_Comm node_comm;
+  // The processes on the same socket as this process. It contains the whole
+  // node where the MPI library cannot tell sockets apart, and only this
+  // process where the processes are not bound to sockets.
+  MPI_Comm socket_comm;
+  // The first process of every node, or MPI_COMM_NULL on other processes
+  MPI_Comm leader_comm;
+  int node;
+  int num_nodes;
+  // True if all nodes have the same amount of processes
+  int uniform_nodes;
+  // The grids made by TMPI_Topology_get_grid, by amount of dimensions and by
+  // periods, where bit i of the index is set if dimension i is periodic
+  MPI_Comm grids[TMPI_TOPOLOGY_MAX_DIMS + 1][1 << TMPI_TOPOLOGY_MAX_DIMS];
+} TMPI_Topology;
+
+// Gets the topology of comm. It is created on the first call, which is
+// collective over comm, and later calls return the cached topology.
+int TMPI_Topology_get(MPI_Comm comm, TMPI_Topology **topology);
+
+// Frees the cached topology of comm and its communicators. Freeing comm
+// frees its topology as well.
+int TMPI_Topology_free(MPI_Comm comm);
+
+// Gets a Cartesian grid of all processes of comm with ndims dimensions, where
+// periods[i] is true if dimension i wraps around. When all nodes have the same
+// amount of processes, every node gets a block of the grid, so that most
+// neighbors are on the same node. The grid is cached with the topology and
+// must not be freed. The first call for a grid is collective over comm.
+int TMPI_Topology_get_grid(MPI_Comm comm, int ndims, const int *periods,
+                           MPI_Comm *grid_comm);
+
+// Works like MPI_Allreduce, but reduces on every node first, so that only one
+// process per node communicates across nodes. The operation must be
+// commutative, and send_data cannot be MPI_IN_PLACE.
+int TMPI_Node_allreduce(const void *send_data, void *recv_data, int count,
+                        MPI_Datatype datatype, MPI_Op op, MPI_Comm comm);
+
+#endif
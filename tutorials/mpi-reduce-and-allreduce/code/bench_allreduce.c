@@ -0,0 +1,157 @@
+// Author: Wes Kendall
+// Copyright 2013 www.mpitutorial.com
+// This code is provided freely with the tutorials on mpitutorial.com. Feel
+// free to modify it for your own use. Any distribution of the code must
+// either provide a link to www.mpitutorial.com or keep this header intact.
+//
+// Benchmark of MPI_Allreduce against the algorithms of TMPI_Allreduce on
+// vectors of floats. The vector sizes are swept in powers of two from 1 KB
+// up to max_message_size bytes, and the results are printed as CSV. Every
+// result is checked, so the benchmark also tests the algorithms.
+//
+#include <stdio.h>
+#include <stdlib.h>
+#include <mpi.h>
+#include "tmpi_allreduce.h"
+#include "tmpi_bench.h"
+
+// An allreduce implementation to benchmark. MPI_Allreduce is marked by
+// use_mpi.
+typedef struct {
+  const char *name;
+  int use_mpi;
+  TMPI_Allreduce_algorithm algorithm;
+} Implementation;
+
+Implementation implementations[] = {
+  {"MPI_Allreduce", 1, TMPI_ALLREDUCE_AUTO},
+  {"TMPI_Allreduce", 0, TMPI_ALLREDUCE_AUTO},
+  {"recursive_doubling", 0, TMPI_ALLREDUCE_RECURSIVE_DOUBLING},
+  {"halving_doubling", 0, TMPI_ALLREDUCE_HALVING_DOUBLING},
+  {"ring", 0, TMPI_ALLREDUCE_RING}
+};
+#define NUM_IMPLEMENTATIONS (sizeof(implementations) / sizeof(Implementation))
+
+// Fills the vector with small whole numbers, so the sums are exact in any
+// order
+void fill_vector(float *data, int count, int rank) {
+  int i;
+  for (i = 0; i < count; i++) {
+    data[i] = (rank + i) % 16;
+  }
+}
+
+// Returns the amount of elements of an allreduced vector that are wrong
+int count_errors(float *data, int count, int world_size) {
+  int errors = 0;
+  int i;
+  for (i = 0; i < count; i++) {
+    float expected = 0;
+    int rank;
+    for (rank = 0; rank < world_size && rank < 16; rank++) {
+      expected += (world_size - rank + 15) / 16 * (float)((rank + i) % 16);
+    }
+    if (data[i] != expected) {
+      errors++;
+    }
+  }
+  return errors;
+}
+
+// One allreduce of count floats for TMPI_Bench_time
+typedef struct {
+  Implementation *implementation;
+  float *send_data;
+  float *recv_data;
+  int count;
+} AllreduceTrial;
+
+void run_allreduce(void *arg) {
+  AllreduceTrial *trial = (AllreduceTrial *)arg;
+  if (trial->implementation->use_mpi) {
+    MPI_Allreduce(trial->send_data, trial->recv_data, trial->count, MPI_FLOAT,
+                  MPI_SUM, MPI_COMM_WORLD);
+  } else {
+    TMPI_Allreduce_with_algorithm(trial->send_data, trial->recv_data,
+                                  trial->count, MPI_FLOAT, MPI_SUM,
+                                  MPI_COMM_WORLD,
+                                  trial->implementation->algorithm);
+  }
+}
+
+// Times num_trials allreduces of count floats. The time of a trial is the
+// time of the slowest process. The sorted trial times are returned on rank
+// zero.
+double *time_allreduce(Implementation *implementation, float *send_data,
+                       float *recv_data, int count, int num_trials) {
+  int world_rank, world_size;
+  MPI_Comm_rank(MPI_COMM_WORLD, &world_rank);
+  MPI_Comm_size(MPI_COMM_WORLD, &world_size);
+
+  // The first trial is not timed, and its result is checked
+  AllreduceTrial trial = {implementation, send_data, recv_data, count};
+  run_allreduce(&trial);
+  int errors = count_errors(recv_data, count, world_size);
+  if (errors > 0) {
+    fprintf(stderr, "%s on process %d has %d wrong elements out of %d\n",
+            implementation->name, world_rank, errors, count);
+    MPI_Abort(MPI_COMM_WORLD, 1);
+  }
+  return TMPI_Bench_time(&run_allreduce, &trial, 0, num_trials,
+                         MPI_COMM_WORLD);
+}
+
+int main(int argc, char** argv) {
+  if (argc != 3) {
+    fprintf(stderr, "Usage: bench_allreduce max_message_size num_trials\n");
+    exit(1);
+  }
+
+  long long max_message_size = atoll(argv[1]);
+  int num_trials = atoi(argv[2]);
+  if (num_trials < 1) {
+    num_trials = 1;
+  }
+
+  MPI_Init(NULL, NULL);
+
+  int world_rank;
+  MPI_Comm_rank(MPI_COMM_WORLD, &world_rank);
+  int world_size;
+  MPI_Comm_size(MPI_COMM_WORLD, &world_size);
+
+  int max_count = max_message_size / sizeof(float);
+  float *send_data = (float *)malloc(sizeof(float) * max_count);
+  float *recv_data = (float *)malloc(sizeof(float) * max_count);
+  if (send_data == NULL || recv_data == NULL) {
+    fprintf(stderr, "Could not allocate %lld bytes\n", 2 * max_message_size);
+    MPI_Abort(MPI_COMM_WORLD, 1);
+  }
+  fill_vector(send_data, max_count, world_rank);
+
+  if (world_rank == 0) {
+    printf("implementation,procs,bytes,min_us,median_us,max_us\n");
+  }
+  long long message_size;
+  for (message_size = 1024; message_size <= max_message_size;
+       message_size *= 2) {
+    int count = message_size / sizeof(float);
+    int i;
+    for (i = 0; i < NUM_IMPLEMENTATIONS; i++) {
+      double *sorted_times = time_allreduce(&implementations[i], send_data,
+                                            recv_data, count, num_trials);
+      if (world_rank == 0) {
+        printf("%s,%d,%lld,%.3f,%.3f,%.3f\n", implementations[i].name,
+               world_size, message_size, sorted_times[0] * 1e6,
+               sorted_times[num_trials / 2] * 1e6,
+               sorted_times[num_trials - 1] * 1e6);
+        fflush(stdout);
+        free(sorted_times);
+      }
+    }
+  }
+
+  free(send_data);
+  free(recv_data);
+  MPI_Finalize();
+}
@@ -5,34 +5,92 @@
 // either provide a link to www.mpitutorial.com or keep this header intact.
 //
 // Program that computes the average of an array of elements in parallel using
-// MPI_Reduce.
+// MPI_Reduce. The numbers of a process are created and summed by all of its
+// threads, so a process can use a whole node or socket.
 //
 #include <stdio.h>
 #include <stdlib.h>
 #include <mpi.h>
 #include <assert.h>
-#include <time.h>
+#include "tmpi_memory.h"
+#include "tmpi_random.h"
+#include "tmpi_sum.h"
+#ifdef _OPENMP
+#include <omp.h>
+#endif
 
-// Creates an array of random numbers. Each number has a value from 0 - 1
-float *create_rand_nums(int num_elements) {
-  float *rand_nums = (float *)malloc(sizeof(float) * num_elements);
+// The amount of numbers that a thread creates or sums at a time. The chunk
+// sums are added in order, so the result does not depend on the amount of
+// threads. Both loops over the chunks use a static schedule, so every thread
+// sums the chunks that it created. The numbers come from TMPI_Alloc, whose
+// pages are placed on the NUMA node of the thread that writes them first, so
+// every thread sums numbers from its own node.
+#define THREAD_CHUNK_SIZE (1 << 16)
+
+// Returns the amount of numbers in chunk "chunk" of num_elements numbers
+int get_chunk_count(int num_elements, int chunk) {
+  long long chunk_start = (long long)chunk * THREAD_CHUNK_SIZE;
+  return num_elements - chunk_start < THREAD_CHUNK_SIZE ?
+    num_elements - chunk_start : THREAD_CHUNK_SIZE;
+}
+
+// Creates an array of random numbers. Each number has a value from 0 - 1. The
+// numbers are elements first to first + num_elements - 1 of a random stream,
+// so the numbers of all processes together only depend on the seed and not on
+// the amount of processes.
+float *create_rand_nums(unsigned long long seed, long long first,
+                        int num_elements) {
+  float *rand_nums = (float *)TMPI_Alloc(sizeof(float) * num_elements);
   assert(rand_nums != NULL);
-  int i;
-  for (i = 0; i < num_elements; i++) {
-    rand_nums[i] = (rand() / (float)RAND_MAX);
+  int num_chunks = (num_elements + THREAD_CHUNK_SIZE - 1) / THREAD_CHUNK_SIZE;
+  int chunk;
+#pragma omp parallel for schedule(static)
+  for (chunk = 0; chunk < num_chunks; chunk++) {
+    long long chunk_start = (long long)chunk * THREAD_CHUNK_SIZE;
+    TMPI_Random_fill_float(seed, 0, first + chunk_start, rand_nums + chunk_start,
+                           get_chunk_count(num_elements, chunk));
   }
   return rand_nums;
 }
 
+// Sums the numbers with all threads
+double sum_rand_nums(const float *rand_nums, int num_elements) {
+  int num_chunks = (num_elements + THREAD_CHUNK_SIZE - 1) / THREAD_CHUNK_SIZE;
+  double *chunk_sums = (double *)malloc(sizeof(double) * num_chunks);
+  assert(num_chunks == 0 || chunk_sums != NULL);
+  int chunk;
+#pragma omp parallel for schedule(static)
+  for (chunk = 0; chunk < num_chunks; chunk++) {
+    chunk_sums[chunk] = TMPI_Sum_float(
+      rand_nums + (long long)chunk * THREAD_CHUNK_SIZE,
+      get_chunk_count(num_elements, chunk));
+  }
+  double sum = 0;
+  for (chunk = 0; chunk < num_chunks; chunk++) {
+    sum += chunk_sums[chunk];
+  }
+  free(chunk_sums);
+  return sum;
+}
+
 int main(int argc, char** argv) {
-  if (argc != 2) {
-    fprintf(stderr, "Usage: avg num_elements_per_proc\n");
+  if (argc != 2 && argc != 3) {
+    fprintf(stderr, "Usage: avg num_elements_per_proc [seed]\n");
     exit(1);
   }
 
   int num_elements_per_proc = atoi(argv[1]);
+  unsigned long long seed = argc == 3 ? strtoull(argv[2], NULL, 10) :
+    TMPI_RANDOM_DEFAULT_SEED;
 
-  MPI_Init(NULL, NULL);
+  // Only the main thread calls MPI
+  int provided;
+  MPI_Init_thread(NULL, NULL, MPI_THREAD_FUNNELED, &provided);
+#ifdef _OPENMP
+  if (provided < MPI_THREAD_FUNNELED) {
+    omp_set_num_threads(1);
+  }
+#endif
 
   int world_rank;
   MPI_Comm_rank(MPI_COMM_WORLD, &world_rank);
@@ -40,34 +98,30 @@ int main(int argc, char** argv) {
   MPI_Comm_size(MPI_COMM_WORLD, &world_size);
 
   // Create a random array of elements on all processes.
-  srand(time(NULL)*world_rank);   // Seed the random number generator to get different results each time for each processor
   float *rand_nums = NULL;
-  rand_nums = create_rand_nums(num_elements_per_proc);
+  rand_nums = create_rand_nums(seed, (long long)world_rank * num_elements_per_proc,
+                               num_elements_per_proc);
 
   // Sum the numbers locally
-  float local_sum = 0;
-  int i;
-  for (i = 0; i < num_elements_per_proc; i++) {
-    local_sum += rand_nums[i];
-  }
+  double local_sum = sum_rand_nums(rand_nums, num_elements_per_proc);
 
   // Print the random numbers on each process
   printf("Local sum for process %d - %f, avg = %f\n",
          world_rank, local_sum, local_sum / num_elements_per_proc);
 
   // Reduce all of the local sums into the global sum
-  float global_sum;
-  MPI_Reduce(&local_sum, &global_sum, 1, MPI_FLOAT, MPI_SUM, 0,
+  double global_sum;
+  MPI_Reduce(&local_sum, &global_sum, 1, MPI_DOUBLE, MPI_SUM, 0,
              MPI_COMM_WORLD);
 
   // Print the result
   if (world_rank == 0) {
     printf("Total sum = %f, avg = %f\n", global_sum,
-           global_sum / (world_size * num_elements_per_proc));
+           global_sum / ((double)world_size * num_elements_per_proc));
   }
 
   // Clean up
-  free(rand_nums);
+  TMPI_Free(rand_nums);
 
   MPI_Barrier(MPI_COMM_WORLD);
   MPI_Finalize();
@@ -5,81 +5,119 @@
 // either provide a link to www.mpitutorial.com or keep this header intact.
 //
 // Program that computes the standard deviation of an array of elements in parallel using
-// MPI_Reduce.
+// MPI_Reduce. The numbers of a process are created and added to the
+// statistics by all of its threads, so a process can use a whole node or
+// socket.
 //
 #include <stdio.h>
 #include <stdlib.h>
 #include <mpi.h>
-#include <math.h>
 #include <assert.h>
+#include "tmpi_random.h"
+#include "tmpi_stats.h"
+#ifdef _OPENMP
+#include <omp.h>
+#endif
 
-// Creates an array of random numbers. Each number has a value from 0 - 1
-float *create_rand_nums(int num_elements) {
-  float *rand_nums = (float *)malloc(sizeof(float) * num_elements);
-  assert(rand_nums != NULL);
-  int i;
-  for (i = 0; i < num_elements; i++) {
-    rand_nums[i] = (rand() / (float)RAND_MAX);
+// The amount of random numbers that are created at a time. The statistics
+// are computed in one pass, so the numbers never have to be in memory at once.
+#define CHUNK_SIZE (1 << 16)
+
+// The amount of chunks that the threads share in a round. Threads take the
+// chunks of a round as they become free, and the statistics of the chunks are
+// merged in order, so the result does not depend on the amount of threads.
+#define CHUNKS_PER_ROUND 256
+
+// Computes the statistics of random numbers that have a value from 0 - 1. The
+// numbers are elements first to first + num_elements - 1 of a random stream,
+// so the numbers of all processes together only depend on the seed and not on
+// the amount of processes.
+void compute_rand_nums_stats(unsigned long long seed, long long first,
+                             long long num_elements, TMPI_Stats *stats) {
+  TMPI_Stats chunk_stats[CHUNKS_PER_ROUND];
+  TMPI_Stats_init(stats);
+  long long num_chunks = (num_elements + CHUNK_SIZE - 1) / CHUNK_SIZE;
+  long long round_start;
+  for (round_start = 0; round_start < num_chunks;
+       round_start += CHUNKS_PER_ROUND) {
+    int round_chunks = num_chunks - round_start < CHUNKS_PER_ROUND ?
+      num_chunks - round_start : CHUNKS_PER_ROUND;
+#pragma omp parallel
+    {
+      // Every thread creates its chunks in its own buffer
+      float *rand_nums = (float *)malloc(sizeof(float) * CHUNK_SIZE);
+      assert(rand_nums != NULL);
+      int i;
+#pragma omp for schedule(dynamic)
+      for (i = 0; i < round_chunks; i++) {
+        long long start = (round_start + i) * CHUNK_SIZE;
+        long long count = num_elements - start < CHUNK_SIZE ?
+          num_elements - start : CHUNK_SIZE;
+        TMPI_Random_fill_float(seed, 0, first + start, rand_nums, count);
+        TMPI_Stats_init(&chunk_stats[i]);
+        TMPI_Stats_add_floats(&chunk_stats[i], rand_nums, count);
+      }
+      free(rand_nums);
+    }
+    int i;
+    for (i = 0; i < round_chunks; i++) {
+      TMPI_Stats_merge(stats, &chunk_stats[i]);
+    }
   }
-  return rand_nums;
 }
 
 int main(int argc, char** argv) {
-  if (argc != 2) {
-    fprintf(stderr, "Usage: avg num_elements_per_proc\n");
+  if (argc != 2 && argc != 3) {
+    fprintf(stderr, "Usage: reduce_stddev num_elements_per_proc [seed]\n");
     exit(1);
   }
 
-  int num_elements_per_proc = atoi(argv[1]);
+  long long num_elements_per_proc = atoll(argv[1]);
+  unsigned long long seed = argc == 3 ? strtoull(argv[2], NULL, 10) :
+    TMPI_RANDOM_DEFAULT_SEED;
 
-  MPI_Init(NULL, NULL);
+  // Only the main thread calls MPI
+  int provided;
+  MPI_Init_thread(NULL, NULL, MPI_THREAD_FUNNELED, &provided);
+#ifdef _OPENMP
+  if (provided < MPI_THREAD_FUNNELED) {
+    omp_set_num_threads(1);
+  }
+#endif
 
   int world_rank;
   MPI_Comm_rank(MPI_COMM_WORLD, &world_rank);
   int world_size;
   MPI_Comm_size(MPI_COMM_WORLD, &world_size);
 
-  // Create a random array of elements on all processes.
-  srand(time(NULL)*world_rank); // Seed the random number generator of processes uniquely
-  float *rand_nums = NULL;
-  rand_nums = create_rand_nums(num_elements_per_proc);
-
-  // Sum the numbers locally
-  float local_sum = 0;
-  int i;
-  for (i = 0; i < num_elements_per_proc; i++) {
-    local_sum += rand_nums[i];
-  }
-
-  // Reduce all of the local sums into the global sum in order to
-  // calculate the mean
-  float global_sum;
-  MPI_Allreduce(&local_sum, &global_sum, 1, MPI_FLOAT, MPI_SUM,
-                MPI_COMM_WORLD);
-  float mean = global_sum / (num_elements_per_proc * world_size);
-
-  // Compute the local sum of the squared differences from the mean
-  float local_sq_diff = 0;
-  for (i = 0; i < num_elements_per_proc; i++) {
-    local_sq_diff += (rand_nums[i] - mean) * (rand_nums[i] - mean);
-  }
+  // Compute the count, mean and sums of powers of the differences from the
+  // mean of the local numbers in a single pass
+  TMPI_Stats local_stats;
+  compute_rand_nums_stats(seed, (long long)world_rank * num_elements_per_proc,
+                          num_elements_per_proc, &local_stats);
 
-  // Reduce the global sum of the squared differences to the root process
-  // and print off the answer
-  float global_sq_diff;
-  MPI_Reduce(&local_sq_diff, &global_sq_diff, 1, MPI_FLOAT, MPI_SUM, 0,
+  // Merge the statistics of all processes on the root process with a single
+  // reduction. The mean does not have to be known before the reduction like it
+  // does when summing the squared differences.
+  MPI_Datatype stats_type;
+  MPI_Op stats_op;
+  TMPI_Stats_create_op(&stats_type, &stats_op);
+  TMPI_Stats global_stats;
+  MPI_Reduce(&local_stats, &global_stats, 1, stats_type, stats_op, 0,
              MPI_COMM_WORLD);
 
   // The standard deviation is the square root of the mean of the squared
   // differences.
   if (world_rank == 0) {
-    float stddev = sqrt(global_sq_diff /
-                        (num_elements_per_proc * world_size));
-    printf("Mean - %f, Standard deviation = %f\n", mean, stddev);
+    printf("Mean - %f, Standard deviation = %f\n", global_stats.mean,
+           TMPI_Stats_stddev(&global_stats));
+    printf("Min - %f, Max - %f, Skewness - %f, Kurtosis - %f\n",
+           global_stats.min, global_stats.max,
+           TMPI_Stats_skewness(&global_stats), TMPI_Stats_kurtosis(&global_stats));
   }
 
   // Clean up
-  free(rand_nums);
+  TMPI_Stats_free_op(&stats_type, &stats_op);
 
   MPI_Barrier(MPI_COMM_WORLD);
   MPI_Finalize();
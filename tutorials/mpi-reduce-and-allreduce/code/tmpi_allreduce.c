@@ -0,0 +1,430 @@
+// Author: Wes Kendall
+// Copyright 2013 www.mpitutorial.com
+// This code is provided freely with the tutorials on mpitutorial.com. Feel
+// free to modify it for your own use. Any distribution of the code must
+// either provide a link to www.mpitutorial.com or keep this header intact.
+//
+// Allreduce algorithms for vectors built on point-to-point communication.
+// Short vectors are bound by latency and use recursive doubling, where every
+// process exchanges the whole vector in log(comm_size) steps. Long vectors are
+// bound by bandwidth. Recursive halving and doubling (Rabenseifner) and the
+// ring both reduce-scatter the vector, so every process combines only its own
+// part, and then allgather the parts. Every process sends and receives about
+// twice the vector size no matter how many processes there are. The ring
+// cuts its blocks into segments, and a segment is combined and forwarded as
+// soon as it arrives while the next segments are still on the way.
+//
+// The thresholds used to choose an algorithm can be tuned with environment
+// variables:
+//   TMPI_ALLREDUCE_SHORT_MSG - Messages smaller than this many bytes use
+//                              recursive doubling (default 8192)
+//   TMPI_ALLREDUCE_LONG_MSG - Messages of at least this many bytes use the
+//                             ring (default 1048576)
+//   TMPI_ALLREDUCE_SEGMENT_SIZE - The segment size of the ring in bytes
+//                                 (default 65536)
+//
+#include <stdlib.h>
+#include <string.h>
+#include <mpi.h>
+#include "tmpi_allreduce.h"
+
+#define TMPI_ALLREDUCE_TAG 0
+
+// Reads a positive integer from an environment variable, or returns the
+// default value if it is not set
+static int get_tunable(const char *name, int default_value) {
+  const char *value = getenv(name);
+  if (value != NULL && atoi(value) > 0) {
+    return atoi(value);
+  }
+  return default_value;
+}
+
+// Returns the address of element "index" of a buffer of datatype elements
+static char *element_address(void *data, MPI_Datatype datatype,
+                             long long index) {
+  MPI_Aint lower_bound, extent;
+  MPI_Type_get_extent(datatype, &lower_bound, &extent);
+  return (char *)data + index * extent;
+}
+
+// Returns the size in bytes of a buffer of count datatype elements
+static size_t get_buffer_size(MPI_Datatype datatype, long long count) {
+  MPI_Aint lower_bound, extent;
+  MPI_Type_get_extent(datatype, &lower_bound, &extent);
+  return count * extent;
+}
+
+// Combines count elements of in into inout. Sums of floats, doubles and ints
+// are loops over independent elements that the compiler can vectorize. Other
+// operations and datatypes use MPI_Reduce_local.
+static void combine(const void *in, void *inout, int count,
+                    MPI_Datatype datatype, MPI_Op op) {
+  int i;
+  if (op == MPI_SUM && datatype == MPI_FLOAT) {
+    const float *restrict a = (const float *)in;
+    float *restrict b = (float *)inout;
+    for (i = 0; i < count; i++) {
+      b[i] += a[i];
+    }
+  } else if (op == MPI_SUM && datatype == MPI_DOUBLE) {
+    const double *restrict a = (const double *)in;
+    double *restrict b = (double *)inout;
+    for (i = 0; i < count; i++) {
+      b[i] += a[i];
+    }
+  } else if (op == MPI_SUM && datatype == MPI_INT) {
+    const int *restrict a = (const int *)in;
+    int *restrict b = (int *)inout;
+    for (i = 0; i < count; i++) {
+      b[i] += a[i];
+    }
+  } else {
+    MPI_Reduce_local(in, inout, count, datatype, op);
+  }
+}
+
+// Returns the largest power of two that is not larger than comm_size
+static int get_power_of_two(int comm_size) {
+  int power_of_two = 1;
+  while (power_of_two * 2 <= comm_size) {
+    power_of_two *= 2;
+  }
+  return power_of_two;
+}
+
+// Recursive doubling and halving pair processes by flipping bits of their
+// ranks, which needs a power of two processes. The first 2 * extra processes,
+// where extra is the amount of processes beyond the power of two, are paired
+// up, and the even process of each pair sends its vector to the odd one and
+// sits out. Returns the rank among the remaining processes, or -1 for a
+// process that sits out.
+static int fold_extra_processes(char *data, char *temp, int count,
+                                MPI_Datatype datatype, MPI_Op op,
+                                MPI_Comm comm, int power_of_two) {
+  int comm_rank, comm_size;
+  MPI_Comm_rank(comm, &comm_rank);
+  MPI_Comm_size(comm, &comm_size);
+  int extra = comm_size - power_of_two;
+  if (comm_rank >= 2 * extra) {
+    return comm_rank - extra;
+  }
+  if (comm_rank % 2 == 0) {
+    MPI_Send(data, count, datatype, comm_rank + 1, TMPI_ALLREDUCE_TAG, comm);
+    return -1;
+  }
+  MPI_Recv(temp, count, datatype, comm_rank - 1, TMPI_ALLREDUCE_TAG, comm,
+           MPI_STATUS_IGNORE);
+  combine(temp, data, count, datatype, op);
+  return comm_rank / 2;
+}
+
+// Sends the result to the processes that sat out
+static void unfold_extra_processes(char *data, int count, MPI_Datatype datatype,
+                                   MPI_Comm comm, int power_of_two) {
+  int comm_rank, comm_size;
+  MPI_Comm_rank(comm, &comm_rank);
+  MPI_Comm_size(comm, &comm_size);
+  int extra = comm_size - power_of_two;
+  if (comm_rank >= 2 * extra) {
+    return;
+  }
+  if (comm_rank % 2 == 0) {
+    MPI_Recv(data, count, datatype, comm_rank + 1, TMPI_ALLREDUCE_TAG, comm,
+             MPI_STATUS_IGNORE);
+  } else {
+    MPI_Send(data, count, datatype, comm_rank - 1, TMPI_ALLREDUCE_TAG, comm);
+  }
+}
+
+// Returns the rank in the communicator of a rank among the remaining
+// processes of fold_extra_processes
+static int get_folded_partner(int folded_rank, int extra) {
+  return folded_rank < extra ? folded_rank * 2 + 1 : folded_rank + extra;
+}
+
+// In every step, each process exchanges its whole vector with the process
+// whose rank differs in one bit and combines the two
+static void recursive_doubling_allreduce(char *data, int count,
+                                         MPI_Datatype datatype, MPI_Op op,
+                                         MPI_Comm comm) {
+  int comm_size;
+  MPI_Comm_size(comm, &comm_size);
+  int power_of_two = get_power_of_two(comm_size);
+  int extra = comm_size - power_of_two;
+  char *temp = malloc(get_buffer_size(datatype, count));
+
+  int folded_rank = fold_extra_processes(data, temp, count, datatype, op, comm,
+                                         power_of_two);
+  if (folded_rank >= 0) {
+    int mask;
+    for (mask = 1; mask < power_of_two; mask <<= 1) {
+      int partner = get_folded_partner(folded_rank ^ mask, extra);
+      MPI_Sendrecv(data, count, datatype, partner, TMPI_ALLREDUCE_TAG, temp,
+                   count, datatype, partner, TMPI_ALLREDUCE_TAG, comm,
+                   MPI_STATUS_IGNORE);
+      combine(temp, data, count, datatype, op);
+    }
+  }
+  unfold_extra_processes(data, count, datatype, comm, power_of_two);
+  free(temp);
+}
+
+// Reduce-scatters by recursive halving. In every step, a process keeps one
+// half of its current range of the vector, sends the other half to its
+// partner and combines the half it keeps with the one it receives. After
+// log(comm_size) steps every process holds one fully combined part, and the
+// steps are undone in reverse to allgather the parts.
+static void halving_doubling_allreduce(char *data, int count,
+                                       MPI_Datatype datatype, MPI_Op op,
+                                       MPI_Comm comm) {
+  int comm_size;
+  MPI_Comm_size(comm, &comm_size);
+  int power_of_two = get_power_of_two(comm_size);
+  int extra = comm_size - power_of_two;
+  char *temp = malloc(get_buffer_size(datatype, count));
+
+  int folded_rank = fold_extra_processes(data, temp, count, datatype, op, comm,
+                                         power_of_two);
+  if (folded_rank >= 0) {
+    // The range a process held before each step
+    int range_starts[32], range_counts[32];
+    int start = 0, range_count = count;
+    int step = 0;
+    int mask;
+    for (mask = power_of_two / 2; mask > 0; mask >>= 1, step++) {
+      int partner = get_folded_partner(folded_rank ^ mask, extra);
+      range_starts[step] = start;
+      range_counts[step] = range_count;
+      // The process with the bit cleared keeps the lower half
+      int lower_count = range_count / 2;
+      int keep_start, keep_count, send_start, send_count;
+      if ((folded_rank & mask) == 0) {
+        keep_start = start;
+        keep_count = lower_count;
+        send_start = start + lower_count;
+        send_count = range_count - lower_count;
+      } else {
+        keep_start = start + lower_count;
+        keep_count = range_count - lower_count;
+        send_start = start;
+        send_count = lower_count;
+      }
+      MPI_Sendrecv(element_address(data, datatype, send_start), send_count,
+                   datatype, partner, TMPI_ALLREDUCE_TAG, temp, keep_count,
+                   datatype, partner, TMPI_ALLREDUCE_TAG, comm,
+                   MPI_STATUS_IGNORE);
+      combine(temp, element_address(data, datatype, keep_start), keep_count,
+              datatype, op);
+      start = keep_start;
+      range_count = keep_count;
+    }
+
+    // The partner of a step holds the rest of the range from before the step
+    for (mask = 1; mask < power_of_two; mask <<= 1) {
+      step--;
+      int partner = get_folded_partner(folded_rank ^ mask, extra);
+      int other_start = start == range_starts[step] ?
+        start + range_count : range_starts[step];
+      MPI_Sendrecv(element_address(data, datatype, start), range_count,
+                   datatype, partner, TMPI_ALLREDUCE_TAG,
+                   element_address(data, datatype, other_start),
+                   range_counts[step] - range_count, datatype, partner,
+                   TMPI_ALLREDUCE_TAG, comm, MPI_STATUS_IGNORE);
+      start = range_starts[step];
+      range_count = range_counts[step];
+    }
+  }
+  unfold_extra_processes(data, count, datatype, comm, power_of_two);
+  free(temp);
+}
+
+// Returns the amount of elements in block "block" when count elements are
+// split into blocks of block_size elements. The last blocks may be partial or
+// empty.
+static int get_block_count(int count, int block_size, int block) {
+  long long block_start = (long long)block * block_size;
+  if (block_start >= count) {
+    return 0;
+  }
+  return count - block_start < block_size ? count - block_start : block_size;
+}
+
+// Sends the segments of a block to a process without waiting and returns the
+// amount of segments
+static int send_block_segments(char *block_data, int block_count,
+                               int segment_size, MPI_Datatype datatype,
+                               int dest, MPI_Comm comm, MPI_Request *requests) {
+  int num_segments = (block_count + segment_size - 1) / segment_size;
+  int segment;
+  for (segment = 0; segment < num_segments; segment++) {
+    MPI_Isend(element_address(block_data, datatype,
+                              (long long)segment * segment_size),
+              get_block_count(block_count, segment_size, segment), datatype,
+              dest, TMPI_ALLREDUCE_TAG, comm, &requests[segment]);
+  }
+  return num_segments;
+}
+
+// Passes blocks around the ring for comm_size - 1 steps. Every process first
+// sends block first_block to the right. In step "step" it receives block
+// first_block - step - 1 from the left and forwards it to the right in the
+// next step. If reduce is set, a received segment is combined with the
+// process' own copy of it first. Each segment is forwarded as soon as it has
+// arrived, so the segments of a block flow through the ring one behind the
+// other.
+static void ring_pass(char *data, char *temp, int count, MPI_Datatype datatype,
+                      MPI_Op op, int reduce, int first_block, int segment_size,
+                      MPI_Comm comm) {
+  int comm_rank, comm_size;
+  MPI_Comm_rank(comm, &comm_rank);
+  MPI_Comm_size(comm, &comm_size);
+  int left = (comm_rank - 1 + comm_size) % comm_size;
+  int right = (comm_rank + 1) % comm_size;
+  int block_size = (count + comm_size - 1) / comm_size;
+  int max_segments = (block_size + segment_size - 1) / segment_size;
+
+  // The sends of the current step and of the next one
+  MPI_Request *send_requests[2];
+  int num_sends[2] = {0, 0};
+  send_requests[0] = malloc(sizeof(MPI_Request) * max_segments);
+  send_requests[1] = malloc(sizeof(MPI_Request) * max_segments);
+  MPI_Request *recv_requests = malloc(sizeof(MPI_Request) * max_segments);
+
+  first_block %= comm_size;
+  num_sends[0] = send_block_segments(
+    element_address(data, datatype, (long long)first_block * block_size),
+    get_block_count(count, block_size, first_block), segment_size, datatype,
+    right, comm, send_requests[0]);
+
+  int step;
+  for (step = 0; step < comm_size - 1; step++) {
+    int recv_block = (first_block - step - 1 + 2 * comm_size) % comm_size;
+    int recv_count = get_block_count(count, block_size, recv_block);
+    char *block_data = element_address(data, datatype,
+                                       (long long)recv_block * block_size);
+    char *recv_data = reduce ? temp : block_data;
+    int num_segments = (recv_count + segment_size - 1) / segment_size;
+    int segment;
+    for (segment = 0; segment < num_segments; segment++) {
+      MPI_Irecv(element_address(recv_data, datatype,
+                                (long long)segment * segment_size),
+                get_block_count(recv_count, segment_size, segment), datatype,
+                left, TMPI_ALLREDUCE_TAG, comm, &recv_requests[segment]);
+    }
+
+    // Combine each segment while the later ones are still arriving, and
+    // forward it right away unless this is the last step
+    int next = (step + 1) % 2;
+    num_sends[next] = 0;
+    for (segment = 0; segment < num_segments; segment++) {
+      long long offset = (long long)segment * segment_size;
+      int segment_count = get_block_count(recv_count, segment_size, segment);
+      MPI_Wait(&recv_requests[segment], MPI_STATUS_IGNORE);
+      if (reduce) {
+        combine(element_address(temp, datatype, offset),
+                element_address(block_data, datatype, offset), segment_count,
+                datatype, op);
+      }
+      if (step < comm_size - 2) {
+        MPI_Isend(element_address(block_data, datatype, offset), segment_count,
+                  datatype, right, TMPI_ALLREDUCE_TAG, comm,
+                  &send_requests[next][num_sends[next]++]);
+      }
+    }
+    MPI_Waitall(num_sends[step % 2], send_requests[step % 2],
+                MPI_STATUSES_IGNORE);
+  }
+
+  free(send_requests[0]);
+  free(send_requests[1]);
+  free(recv_requests);
+}
+
+// Reduce-scatters the vector around a ring, after which process i holds the
+// combined block i + 1, and then allgathers the blocks around the ring
+static void ring_allreduce(char *data, int count, MPI_Datatype datatype,
+                           MPI_Op op, MPI_Comm comm) {
+  int comm_rank, comm_size;
+  MPI_Comm_rank(comm, &comm_rank);
+  MPI_Comm_size(comm, &comm_size);
+  int block_size = (count + comm_size - 1) / comm_size;
+
+  int datatype_size;
+  MPI_Type_size(datatype, &datatype_size);
+  int segment_size = datatype_size > 0 ?
+    get_tunable("TMPI_ALLREDUCE_SEGMENT_SIZE", 65536) / datatype_size : count;
+  if (segment_size < 1) {
+    segment_size = 1;
+  }
+
+  char *temp = malloc(get_buffer_size(datatype, block_size));
+  ring_pass(data, temp, count, datatype, op, 1, comm_rank, segment_size, comm);
+  ring_pass(data, temp, count, datatype, op, 0, comm_rank + 1, segment_size,
+            comm);
+  free(temp);
+}
+
+// Returns the algorithm TMPI_Allreduce uses for the message and communicator
+// size. Short messages use recursive doubling with its log(comm_size) steps.
+// Long messages use the ring, which keeps every link busy with segments, and
+// the messages in between use recursive halving and doubling, which needs
+// fewer steps than the ring.
+TMPI_Allreduce_algorithm TMPI_Allreduce_choose_algorithm(int message_size,
+                                                         int comm_size) {
+  if (comm_size <= 2 ||
+      message_size < get_tunable("TMPI_ALLREDUCE_SHORT_MSG", 8192)) {
+    return TMPI_ALLREDUCE_RECURSIVE_DOUBLING;
+  } else if (message_size >= get_tunable("TMPI_ALLREDUCE_LONG_MSG", 1048576)) {
+    return TMPI_ALLREDUCE_RING;
+  } else {
+    return TMPI_ALLREDUCE_HALVING_DOUBLING;
+  }
+}
+
+int TMPI_Allreduce_with_algorithm(const void *send_data, void *recv_data,
+                                  int count, MPI_Datatype datatype, MPI_Op op,
+                                  MPI_Comm comm,
+                                  TMPI_Allreduce_algorithm algorithm) {
+  int comm_size;
+  MPI_Comm_size(comm, &comm_size);
+  if (count < 0) {
+    return MPI_ERR_COUNT;
+  }
+  int commutative;
+  MPI_Op_commutative(op, &commutative);
+  if (!commutative) {
+    return MPI_Allreduce(send_data, recv_data, count, datatype, op, comm);
+  }
+  if (send_data != MPI_IN_PLACE) {
+    memcpy(recv_data, send_data, get_buffer_size(datatype, count));
+  }
+  if (comm_size == 1 || count == 0) {
+    return MPI_SUCCESS;
+  }
+
+  if (algorithm == TMPI_ALLREDUCE_AUTO) {
+    int datatype_size;
+    MPI_Type_size(datatype, &datatype_size);
+    long long message_size = (long long)count * datatype_size;
+    algorithm = TMPI_Allreduce_choose_algorithm(
+      message_size > 0x7FFFFFFF ? 0x7FFFFFFF : (int)message_size, comm_size);
+  }
+
+  if (algorithm == TMPI_ALLREDUCE_RECURSIVE_DOUBLING) {
+    recursive_doubling_allreduce(recv_data, count, datatype, op, comm);
+  } else if (algorithm == TMPI_ALLREDUCE_HALVING_DOUBLING) {
+    halving_doubling_allreduce(recv_data, count, datatype, op, comm);
+  } else if (algorithm == TMPI_ALLREDUCE_RING) {
+    ring_allreduce(recv_data, count, datatype, op, comm);
+  } else {
+    return MPI_ERR_ARG;
+  }
+  return MPI_SUCCESS;
+}
+
+int TMPI_Allreduce(const void *send_data, void *recv_data, int count,
+                   MPI_Datatype datatype, MPI_Op op, MPI_Comm comm) {
+  return TMPI_Allreduce_with_algorithm(send_data, recv_data, count, datatype,
+                                       op, comm, TMPI_ALLREDUCE_AUTO);
+}
@@ -0,0 +1,37 @@
+// Author: Wes Kendall
+// Copyright 2013 www.mpitutorial.com
+// This code is provided freely with the tutorials on mpitutorial.com. Feel
+// free to modify it for your own use. Any distribution of the code must
+// either provide a link to www.mpitutorial.com or keep this header intact.
+//
+// Header file for TMPI_Allreduce
+//
+#ifndef __TMPI_ALLREDUCE_H
+#define __TMPI_ALLREDUCE_H 1
+
+// The allreduce algorithms that TMPI_Allreduce can choose from
+typedef enum {
+  TMPI_ALLREDUCE_AUTO,
+  TMPI_ALLREDUCE_RECURSIVE_DOUBLING,
+  TMPI_ALLREDUCE_HALVING_DOUBLING,
+  TMPI_ALLREDUCE_RING
+} TMPI_Allreduce_algorithm;
+
+// Works like MPI_Allreduce with the algorithm that suits the message and
+// communicator size. The datatype must be contiguous. Operations that are not
+// commutative are passed on to MPI_Allreduce.
+int TMPI_Allreduce(const void *send_data, void *recv_data, int count,
+                   MPI_Datatype datatype, MPI_Op op, MPI_Comm comm);
+
+// Works like TMPI_Allreduce with the given algorithm
+int TMPI_Allreduce_with_algorithm(const void *send_data, void *recv_data,
+                                  int count, MPI_Datatype datatype, MPI_Op op,
+                                  MPI_Comm comm,
+                                  TMPI_Allreduce_algorithm algorithm);
+
+// Returns the algorithm TMPI_Allreduce uses for the message and communicator
+// size
+TMPI_Allreduce_algorithm TMPI_Allreduce_choose_algorithm(int message_size,
+                                                         int comm_size);
+
+#endif
@@ -0,0 +1,57 @@
+// Author: Wes Kendall
+// Copyright 2011 www.mpitutorial.com
+// This code is provided freely with the tutorials on mpitutorial.com. Feel
+// free to modify it for your own use. Any distribution of the code must
+// either provide a link to www.mpitutorial.com or keep this header intact.
+//
+// The timing loop that the benchmarks of the lessons share. A benchmark hands
+// one trial to TMPI_Bench_time as a function, and gets the sorted times of the
+// trials back to print whichever statistics it reports.
+//
+#include <stdlib.h>
+#include <mpi.h>
+#include "tmpi_bench.h"
+
+// Used for sorting the trial times
+static int compare_double(const void *a, const void *b) {
+  if (*(double *)a < *(double *)b) {
+    return -1;
+  } else if (*(double *)a > *(double *)b) {
+    return 1;
+  } else {
+    return 0;
+  }
+}
+
+double *TMPI_Bench_time(TMPI_Bench_function run, void *arg,
+                        int num_warmup_trials, int num_trials, MPI_Comm comm) {
+  int comm_rank;
+  MPI_Comm_rank(comm, &comm_rank);
+
+  // Warm up the connections and buffers before timing
+  int i;
+  for (i = 0; i < num_warmup_trials; i++) {
+    run(arg);
+  }
+
+  double *trial_times = (double *)malloc(sizeof(double) * num_trials);
+  for (i = 0; i < num_trials; i++) {
+    // Synchronize before starting timing
+    MPI_Barrier(comm);
+    trial_times[i] = -MPI_Wtime();
+    run(arg);
+    trial_times[i] += MPI_Wtime();
+  }
+
+  double *max_trial_times = NULL;
+  if (comm_rank == 0) {
+    max_trial_times = (double *)malloc(sizeof(double) * num_trials);
+  }
+  MPI_Reduce(trial_times, max_trial_times, num_trials, MPI_DOUBLE, MPI_MAX, 0,
+             comm);
+  if (comm_rank == 0) {
+    qsort(max_trial_times, num_trials, sizeof(double), &compare_double);
+  }
+  free(trial_times);
+  return max_trial_times;
+}
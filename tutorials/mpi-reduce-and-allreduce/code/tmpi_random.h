@@ -0,0 +1,56 @@
+// Author: Wes Kendall
+// Copyright 2014 www.mpitutorial.com
+// This code is provided freely with the tutorials on mpitutorial.com. Feel
+// free to modify it for your own use. Any distribution of the code must
+// either provide a link to www.mpitutorial.com or keep this header intact.
+//
+// Header file for TMPI_Random, a counter-based random number generator
+//
+#ifndef __TMPI_RANDOM_H
+#define __TMPI_RANDOM_H 1
+
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// The seed used by the programs when none is given
+#define TMPI_RANDOM_DEFAULT_SEED 2014
+
+// A stream of random numbers. Every (seed, stream) pair is an independent
+// sequence, so processes and threads can each use their own stream (for
+// example, world_rank * num_threads + thread) without any communication.
+typedef struct {
+  uint32_t key[2];
+  uint64_t stream;
+  uint64_t block;
+  uint32_t words[4];
+  int num_words_used;
+} TMPI_Random;
+
+void TMPI_Random_init(TMPI_Random *random, uint64_t seed, uint64_t stream);
+
+uint32_t TMPI_Random_uint32(TMPI_Random *random);
+
+// Returns a number in [0, 1)
+float TMPI_Random_float(TMPI_Random *random);
+
+// Returns a number in [0, max). max must be positive.
+int TMPI_Random_int(TMPI_Random *random, int max);
+
+// Fills data with elements first to first + count - 1 of a stream, with every
+// element in [0, 1). Element i of a stream is the same no matter how the
+// elements are split among processes, so a process that owns the elements
+// starting at first gets exactly the numbers a single process would.
+void TMPI_Random_fill_float(uint64_t seed, uint64_t stream, long long first,
+                            float *data, long long count);
+
+void TMPI_Random_fill_double(uint64_t seed, uint64_t stream, long long first,
+                             double *data, long long count);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
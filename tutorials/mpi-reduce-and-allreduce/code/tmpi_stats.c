@@ -0,0 +1,160 @@
+// Author: Wes Kendall
+// Copyright 2013 www.mpitutorial.com
+// This code is provided freely with the tutorials on mpitutorial.com. Feel
+// free to modify it for your own use. Any distribution of the code must
+// either provide a link to www.mpitutorial.com or keep this header intact.
+//
+// Statistics that are computed in a single pass over the numbers and a single
+// reduction. Instead of sums, which need the mean before the differences from
+// it can be summed, every process keeps the count, the mean and the sums of
+// the powers of the differences from the mean. Two sets of these can be
+// merged exactly with the formulas of Chan et al. (and Pebay for the third and
+// fourth powers), so a custom MPI_Op merges the statistics of all processes.
+//
+#include <stddef.h>
+#include <math.h>
+#include <mpi.h>
+#include "tmpi_stats.h"
+
+// The amount of numbers that TMPI_Stats_add_floats handles at a time. A block
+// stays in the cache, so its mean and moments can be computed in two passes
+// over it without reading the numbers from memory twice.
+#define TMPI_STATS_BLOCK_SIZE 4096
+
+void TMPI_Stats_init(TMPI_Stats *stats) {
+  stats->count = 0;
+  stats->mean = 0;
+  stats->m2 = 0;
+  stats->m3 = 0;
+  stats->m4 = 0;
+  stats->min = INFINITY;
+  stats->max = -INFINITY;
+}
+
+void TMPI_Stats_add(TMPI_Stats *stats, double number) {
+  double n = ++stats->count;
+  double delta = number - stats->mean;
+  double delta_n = delta / n;
+  double term = delta * delta_n * (n - 1);
+  stats->mean += delta_n;
+  stats->m4 += term * delta_n * delta_n * (n * n - 3 * n + 3) +
+    6 * delta_n * delta_n * stats->m2 - 4 * delta_n * stats->m3;
+  stats->m3 += term * delta_n * (n - 2) - 3 * delta_n * stats->m2;
+  stats->m2 += term;
+  stats->min = fmin(stats->min, number);
+  stats->max = fmax(stats->max, number);
+}
+
+// Computes the statistics of a block of at most TMPI_STATS_BLOCK_SIZE numbers
+static void block_stats(const float *data, int count, TMPI_Stats *stats) {
+  double sum = 0;
+  float min = data[0], max = data[0];
+  int i;
+  for (i = 0; i < count; i++) {
+    sum += data[i];
+    min = data[i] < min ? data[i] : min;
+    max = data[i] > max ? data[i] : max;
+  }
+  double mean = sum / count;
+  double m2 = 0, m3 = 0, m4 = 0;
+  for (i = 0; i < count; i++) {
+    double difference = data[i] - mean;
+    double square = difference * difference;
+    m2 += square;
+    m3 += square * difference;
+    m4 += square * square;
+  }
+  stats->count = count;
+  stats->mean = mean;
+  stats->m2 = m2;
+  stats->m3 = m3;
+  stats->m4 = m4;
+  stats->min = min;
+  stats->max = max;
+}
+
+void TMPI_Stats_add_floats(TMPI_Stats *stats, const float *data, long long count) {
+  long long start;
+  for (start = 0; start < count; start += TMPI_STATS_BLOCK_SIZE) {
+    TMPI_Stats block;
+    block_stats(data + start, count - start < TMPI_STATS_BLOCK_SIZE ?
+                count - start : TMPI_STATS_BLOCK_SIZE, &block);
+    TMPI_Stats_merge(stats, &block);
+  }
+}
+
+void TMPI_Stats_merge(TMPI_Stats *stats, const TMPI_Stats *other) {
+  if (other->count == 0) {
+    return;
+  }
+  if (stats->count == 0) {
+    *stats = *other;
+    return;
+  }
+  double na = stats->count, nb = other->count;
+  double n = na + nb;
+  double delta = other->mean - stats->mean;
+  double delta2 = delta * delta;
+  double m2 = stats->m2 + other->m2 + delta2 * na * nb / n;
+  double m3 = stats->m3 + other->m3 +
+    delta2 * delta * na * nb * (na - nb) / (n * n) +
+    3 * delta * (na * other->m2 - nb * stats->m2) / n;
+  double m4 = stats->m4 + other->m4 +
+    delta2 * delta2 * na * nb * (na * na - na * nb + nb * nb) / (n * n * n) +
+    6 * delta2 * (na * na * other->m2 + nb * nb * stats->m2) / (n * n) +
+    4 * delta * (na * other->m3 - nb * stats->m3) / n;
+  stats->count += other->count;
+  stats->mean += delta * nb / n;
+  stats->m2 = m2;
+  stats->m3 = m3;
+  stats->m4 = m4;
+  stats->min = fmin(stats->min, other->min);
+  stats->max = fmax(stats->max, other->max);
+}
+
+// The function of the MPI_Op. It merges every element of in into inout.
+static void merge_stats_op(void *in, void *inout, int *len,
+                           MPI_Datatype *datatype) {
+  // The datatype is always the one from TMPI_Stats_create_op
+  (void)datatype;
+  int i;
+  for (i = 0; i < *len; i++) {
+    TMPI_Stats_merge((TMPI_Stats *)inout + i, (TMPI_Stats *)in + i);
+  }
+}
+
+int TMPI_Stats_create_op(MPI_Datatype *datatype, MPI_Op *op) {
+  int block_lengths[2] = {1, 6};
+  MPI_Aint offsets[2] = {offsetof(TMPI_Stats, count), offsetof(TMPI_Stats, mean)};
+  MPI_Datatype types[2] = {MPI_LONG_LONG, MPI_DOUBLE};
+  MPI_Datatype struct_type;
+  MPI_Type_create_struct(2, block_lengths, offsets, types, &struct_type);
+  // Make sure the extent matches the struct, including any padding
+  MPI_Type_create_resized(struct_type, 0, sizeof(TMPI_Stats), datatype);
+  MPI_Type_free(&struct_type);
+  MPI_Type_commit(datatype);
+  // Merging is commutative, but it rounds differently depending on the order
+  return MPI_Op_create(&merge_stats_op, 1, op);
+}
+
+int TMPI_Stats_free_op(MPI_Datatype *datatype, MPI_Op *op) {
+  MPI_Type_free(datatype);
+  return MPI_Op_free(op);
+}
+
+double TMPI_Stats_variance(const TMPI_Stats *stats) {
+  return stats->count > 0 ? stats->m2 / stats->count : 0;
+}
+
+double TMPI_Stats_stddev(const TMPI_Stats *stats) {
+  return sqrt(TMPI_Stats_variance(stats));
+}
+
+double TMPI_Stats_skewness(const TMPI_Stats *stats) {
+  return stats->m2 > 0 ?
+    sqrt((double)stats->count) * stats->m3 / pow(stats->m2, 1.5) : 0;
+}
+
+double TMPI_Stats_kurtosis(const TMPI_Stats *stats) {
+  return stats->m2 > 0 ? stats->count * stats->m4 / (stats->m2 * stats->m2) : 0;
+}
@@ -0,0 +1,49 @@
+// Author: Wes Kendall
+// Copyright 2013 www.mpitutorial.com
+// This code is provided freely with the tutorials on mpitutorial.com. Feel
+// free to modify it for your own use. Any distribution of the code must
+// either provide a link to www.mpitutorial.com or keep this header intact.
+//
+// Header file for TMPI_Stats, statistics that are computed in one pass
+//
+#ifndef __TMPI_STATS_H
+#define __TMPI_STATS_H 1
+
+// The statistics of a set of numbers. m2, m3 and m4 are the sums of the
+// second, third and fourth powers of the differences from the mean.
+typedef struct {
+  long long count;
+  double mean;
+  double m2;
+  double m3;
+  double m4;
+  double min;
+  double max;
+} TMPI_Stats;
+
+// Initializes the statistics of an empty set of numbers
+void TMPI_Stats_init(TMPI_Stats *stats);
+
+// Adds a single number with Welford's update
+void TMPI_Stats_add(TMPI_Stats *stats, double number);
+
+// Adds count floats
+void TMPI_Stats_add_floats(TMPI_Stats *stats, const float *data, long long count);
+
+// Merges the statistics of other into stats with Chan's formulas
+void TMPI_Stats_merge(TMPI_Stats *stats, const TMPI_Stats *other);
+
+// Creates the datatype of TMPI_Stats and the operation that merges them, to
+// use in MPI_Reduce or MPI_Allreduce. Free them with TMPI_Stats_free_op.
+int TMPI_Stats_create_op(MPI_Datatype *datatype, MPI_Op *op);
+
+int TMPI_Stats_free_op(MPI_Datatype *datatype, MPI_Op *op);
+
+// The population variance and standard deviation, and the skewness and
+// (non-excess) kurtosis
+double TMPI_Stats_variance(const TMPI_Stats *stats);
+double TMPI_Stats_stddev(const TMPI_Stats *stats);
+double TMPI_Stats_skewness(const TMPI_Stats *stats);
+double TMPI_Stats_kurtosis(const TMPI_Stats *stats);
+
+#endif
@@ -5,91 +5,175 @@
 // either provide a link to www.mpitutorial.com or keep this header intact.
 //
 // Program that computes the average of an array of elements in parallel using
-// MPI_Scatter and MPI_Allgather
+// MPI_Scatter and MPI_Allgather. With --distributed, every process creates
+// its own part of the array instead and the average is computed with a single
+// MPI_Allreduce.
 //
 #include <stdio.h>
 #include <stdlib.h>
-#include <time.h>
+#include <string.h>
 #include <mpi.h>
 #include <assert.h>
+#include "tmpi_random.h"
+#include "tmpi_slice.h"
+#include "tmpi_sum.h"
 
-// Creates an array of random numbers. Each number has a value from 0 - 1
-float *create_rand_nums(int num_elements) {
+// Creates an array of random numbers. Each number has a value from 0 - 1. The
+// numbers are elements first to first + num_elements - 1 of a random stream,
+// so any part of the array can be created by any process.
+float *create_rand_nums(unsigned long long seed, long long first,
+                        int num_elements) {
   float *rand_nums = (float *)malloc(sizeof(float) * num_elements);
   assert(rand_nums != NULL);
-  int i;
-  for (i = 0; i < num_elements; i++) {
-    rand_nums[i] = (rand() / (float)RAND_MAX);
-  }
+  TMPI_Random_fill_float(seed, 0, first, rand_nums, num_elements);
   return rand_nums;
 }
 
-// Computes the average of an array of numbers
-float compute_avg(float *array, int num_elements) {
-  float sum = 0.f;
-  int i;
-  for (i = 0; i < num_elements; i++) {
-    sum += array[i];
-  }
-  return sum / num_elements;
-}
-
-int main(int argc, char** argv) {
-  if (argc != 2) {
-    fprintf(stderr, "Usage: avg num_elements_per_proc\n");
-    exit(1);
-  }
-
-  int num_elements_per_proc = atoi(argv[1]);
-  // Seed the random number generator to get different results each time
-  srand(time(NULL));
-
-  MPI_Init(NULL, NULL);
-
+// Creates the whole array on the root process, scatters it and gathers the
+// averages of the parts on all processes. The root process needs memory for
+// the whole array.
+void scatter_avg(unsigned long long seed, long long num_elements) {
   int world_rank;
   MPI_Comm_rank(MPI_COMM_WORLD, &world_rank);
   int world_size;
   MPI_Comm_size(MPI_COMM_WORLD, &world_size);
+  assert(num_elements <= 2147483647);
 
-  // Create a random array of elements on the root process. Its total
-  // size will be the number of elements per process times the number
-  // of processes
+  // Create a random array of elements on the root process
   float *rand_nums = NULL;
+  int *counts = NULL;
+  int *offsets = NULL;
   if (world_rank == 0) {
-    rand_nums = create_rand_nums(num_elements_per_proc * world_size);
+    rand_nums = create_rand_nums(seed, 0, num_elements);
+    counts = (int *)malloc(sizeof(int) * world_size);
+    offsets = (int *)malloc(sizeof(int) * world_size);
+    int i;
+    for (i = 0; i < world_size; i++) {
+      long long first;
+      TMPI_Slice_get(num_elements, i, world_size, &first, &counts[i]);
+      offsets[i] = first;
+    }
   }
 
   // For each process, create a buffer that will hold a subset of the entire
   // array
-  float *sub_rand_nums = (float *)malloc(sizeof(float) * num_elements_per_proc);
+  long long first;
+  int num_sub_elements;
+  TMPI_Slice_get(num_elements, world_rank, world_size, &first,
+                 &num_sub_elements);
+  float *sub_rand_nums = (float *)malloc(sizeof(float) * num_sub_elements);
   assert(sub_rand_nums != NULL);
 
   // Scatter the random numbers from the root process to all processes in
-  // the MPI world
-  MPI_Scatter(rand_nums, num_elements_per_proc, MPI_FLOAT, sub_rand_nums,
-              num_elements_per_proc, MPI_FLOAT, 0, MPI_COMM_WORLD);
+  // the MPI world. MPI_Scatterv is used since the parts can differ in size.
+  MPI_Scatterv(rand_nums, counts, offsets, MPI_FLOAT, sub_rand_nums,
+               num_sub_elements, MPI_FLOAT, 0, MPI_COMM_WORLD);
 
-  // Compute the average of your subset
-  float sub_avg = compute_avg(sub_rand_nums, num_elements_per_proc);
+  // Compute the sum of your subset. The sum and the count are sent instead of
+  // an average, since the average of a process without elements is not a
+  // number.
+  double sub_sum_and_count[2] = {
+    TMPI_Sum_float(sub_rand_nums, num_sub_elements), num_sub_elements
+  };
 
-  // Gather all partial averages down to all the processes
-  float *sub_avgs = (float *)malloc(sizeof(float) * world_size);
-  assert(sub_avgs != NULL);
-  MPI_Allgather(&sub_avg, 1, MPI_FLOAT, sub_avgs, 1, MPI_FLOAT, MPI_COMM_WORLD);
+  // Gather all partial sums and counts down to all the processes
+  double *sub_sums_and_counts =
+    (double *)malloc(sizeof(double) * 2 * world_size);
+  assert(sub_sums_and_counts != NULL);
+  MPI_Allgather(sub_sum_and_count, 2, MPI_DOUBLE, sub_sums_and_counts, 2,
+                MPI_DOUBLE, MPI_COMM_WORLD);
 
-  // Now that we have all of the partial averages, compute the
-  // total average of all numbers. Since we are assuming each process computed
-  // an average across an equal amount of elements, this computation will
-  // produce the correct answer.
-  float avg = compute_avg(sub_avgs, world_size);
-  printf("Avg of all elements from proc %d is %f\n", world_rank, avg);
+  // Now that we have all of the partial sums, compute the total average of
+  // all numbers
+  double sum = 0, count = 0;
+  int i;
+  for (i = 0; i < world_size; i++) {
+    sum += sub_sums_and_counts[2 * i];
+    count += sub_sums_and_counts[2 * i + 1];
+  }
+  printf("Avg of all elements from proc %d is %f\n", world_rank, sum / count);
 
   // Clean up
   if (world_rank == 0) {
     free(rand_nums);
+    free(counts);
+    free(offsets);
   }
-  free(sub_avgs);
+  free(sub_sums_and_counts);
   free(sub_rand_nums);
+}
+
+// Every process creates its own part of the array, and the sums and counts of
+// all parts are added with a single MPI_Allreduce. No process needs memory for
+// more than its own part.
+void distributed_avg(unsigned long long seed, long long num_elements) {
+  int world_rank;
+  MPI_Comm_rank(MPI_COMM_WORLD, &world_rank);
+  int world_size;
+  MPI_Comm_size(MPI_COMM_WORLD, &world_size);
+
+  long long first;
+  int num_sub_elements;
+  TMPI_Slice_get(num_elements, world_rank, world_size, &first,
+                 &num_sub_elements);
+  float *sub_rand_nums = create_rand_nums(seed, first, num_sub_elements);
+
+  // The count is reduced along with the sum so that the parts do not need to
+  // be equal in size
+  double local_sum_and_count[2] = {
+    TMPI_Sum_float(sub_rand_nums, num_sub_elements), num_sub_elements
+  };
+  double global_sum_and_count[2];
+  MPI_Allreduce(local_sum_and_count, global_sum_and_count, 2, MPI_DOUBLE,
+                MPI_SUM, MPI_COMM_WORLD);
+
+  printf("Avg of all elements from proc %d is %f\n", world_rank,
+         global_sum_and_count[0] / global_sum_and_count[1]);
+
+  free(sub_rand_nums);
+}
+
+int main(int argc, char** argv) {
+  if (argc < 2) {
+    fprintf(stderr, "Usage: all_avg num_elements_per_proc [--distributed] "
+            "[--total=num_elements] [--seed=seed]\n");
+    exit(1);
+  }
+
+  long long num_elements_per_proc = atoll(argv[1]);
+  long long num_elements = 0;
+  int distributed = 0;
+  unsigned long long seed = TMPI_RANDOM_DEFAULT_SEED;
+  int i;
+  for (i = 2; i < argc; i++) {
+    if (strcmp(argv[i], "--distributed") == 0) {
+      distributed = 1;
+    } else if (strncmp(argv[i], "--total=", 8) == 0) {
+      num_elements = atoll(argv[i] + 8);
+    } else if (strncmp(argv[i], "--seed=", 7) == 0) {
+      seed = strtoull(argv[i] + 7, NULL, 10);
+    } else {
+      fprintf(stderr, "Unknown option %s\n", argv[i]);
+      exit(1);
+    }
+  }
+
+  MPI_Init(NULL, NULL);
+
+  int world_size;
+  MPI_Comm_size(MPI_COMM_WORLD, &world_size);
+
+  // Unless the total size is given, it is the number of elements per process
+  // times the number of processes
+  if (num_elements <= 0) {
+    num_elements = num_elements_per_proc * world_size;
+  }
+
+  if (distributed) {
+    distributed_avg(seed, num_elements);
+  } else {
+    scatter_avg(seed, num_elements);
+  }
 
   MPI_Barrier(MPI_COMM_WORLD);
   MPI_Finalize();
@@ -5,100 +5,269 @@
 // either provide a link to www.mpitutorial.com or keep this header intact.
 //
 // Program that computes the average of an array of elements in parallel using
-// MPI_Scatter and MPI_Gather
+// MPI_Scatter and MPI_Gather. With --distributed, every process creates its
+// own part of the array instead and the average is computed with a single
+// MPI_Allreduce. With --shared, the array is created in memory that is shared
+// by the processes on the node of the root process, and only the parts of the
+// other nodes are sent to them. Every process reads its part of the array
+// directly from the shared memory of its node.
 //
 #include <stdio.h>
 #include <stdlib.h>
-#include <time.h>
+#include <string.h>
 #include <mpi.h>
 #include <assert.h>
+#include "tmpi_memory.h"
+#include "tmpi_random.h"
+#include "tmpi_slice.h"
+#include "tmpi_sum.h"
+#include "tmpi_topology.h"
 
-// Creates an array of random numbers. Each number has a value from 0 - 1
-float *create_rand_nums(int num_elements) {
-  float *rand_nums = (float *)malloc(sizeof(float) * num_elements);
+// Creates an array of random numbers. Each number has a value from 0 - 1. The
+// numbers are elements first to first + num_elements - 1 of a random stream,
+// so any part of the array can be created by any process.
+float *create_rand_nums(unsigned long long seed, long long first,
+                        int num_elements) {
+  float *rand_nums = (float *)TMPI_Alloc(sizeof(float) * num_elements);
   assert(rand_nums != NULL);
-  int i;
-  for (i = 0; i < num_elements; i++) {
-    rand_nums[i] = (rand() / (float)RAND_MAX);
-  }
+  TMPI_Random_fill_float(seed, 0, first, rand_nums, num_elements);
   return rand_nums;
 }
 
-// Computes the average of an array of numbers
+// Computes the average of an array of numbers. The sum is computed in double
+// precision, so it stays accurate for large arrays.
 float compute_avg(float *array, int num_elements) {
-  float sum = 0.f;
-  int i;
-  for (i = 0; i < num_elements; i++) {
-    sum += array[i];
-  }
-  return sum / num_elements;
+  return TMPI_Sum_float(array, num_elements) / num_elements;
 }
 
-int main(int argc, char** argv) {
-  if (argc != 2) {
-    fprintf(stderr, "Usage: avg num_elements_per_proc\n");
-    exit(1);
-  }
-
-  int num_elements_per_proc = atoi(argv[1]);
-  // Seed the random number generator to get different results each time
-  srand(time(NULL));
-
-  MPI_Init(NULL, NULL);
-
+// Creates the whole array on the root process, scatters it and gathers the
+// averages of the parts on the root process. The root process needs memory
+// for the whole array.
+void scatter_avg(unsigned long long seed, long long num_elements) {
   int world_rank;
   MPI_Comm_rank(MPI_COMM_WORLD, &world_rank);
   int world_size;
   MPI_Comm_size(MPI_COMM_WORLD, &world_size);
+  assert(num_elements <= 2147483647);
 
-  // Create a random array of elements on the root process. Its total
-  // size will be the number of elements per process times the number
-  // of processes
+  // Create a random array of elements on the root process
   float *rand_nums = NULL;
+  int *counts = NULL;
+  int *offsets = NULL;
   if (world_rank == 0) {
-    rand_nums = create_rand_nums(num_elements_per_proc * world_size);
+    rand_nums = create_rand_nums(seed, 0, num_elements);
+    counts = (int *)malloc(sizeof(int) * world_size);
+    offsets = (int *)malloc(sizeof(int) * world_size);
+    int i;
+    for (i = 0; i < world_size; i++) {
+      long long first;
+      TMPI_Slice_get(num_elements, i, world_size, &first, &counts[i]);
+      offsets[i] = first;
+    }
   }
 
   // For each process, create a buffer that will hold a subset of the entire
   // array
-  float *sub_rand_nums = (float *)malloc(sizeof(float) * num_elements_per_proc);
+  long long first;
+  int num_sub_elements;
+  TMPI_Slice_get(num_elements, world_rank, world_size, &first,
+                 &num_sub_elements);
+  float *sub_rand_nums = (float *)TMPI_Alloc(sizeof(float) * num_sub_elements);
   assert(sub_rand_nums != NULL);
 
   // Scatter the random numbers from the root process to all processes in
-  // the MPI world
-  MPI_Scatter(rand_nums, num_elements_per_proc, MPI_FLOAT, sub_rand_nums,
-              num_elements_per_proc, MPI_FLOAT, 0, MPI_COMM_WORLD);
+  // the MPI world. MPI_Scatterv is used since the parts can differ in size.
+  MPI_Scatterv(rand_nums, counts, offsets, MPI_FLOAT, sub_rand_nums,
+               num_sub_elements, MPI_FLOAT, 0, MPI_COMM_WORLD);
 
-  // Compute the average of your subset
-  float sub_avg = compute_avg(sub_rand_nums, num_elements_per_proc);
+  // Compute the sum of your subset. The sum and the count are sent instead of
+  // an average, since the average of a process without elements is not a
+  // number.
+  double sub_sum_and_count[2] = {
+    TMPI_Sum_float(sub_rand_nums, num_sub_elements), num_sub_elements
+  };
 
-  // Gather all partial averages down to the root process
-  float *sub_avgs = NULL;
+  // Gather all partial sums and counts down to the root process
+  double *sub_sums_and_counts = NULL;
   if (world_rank == 0) {
-    sub_avgs = (float *)malloc(sizeof(float) * world_size);
-    assert(sub_avgs != NULL);
+    sub_sums_and_counts = (double *)malloc(sizeof(double) * 2 * world_size);
+    assert(sub_sums_and_counts != NULL);
   }
-  MPI_Gather(&sub_avg, 1, MPI_FLOAT, sub_avgs, 1, MPI_FLOAT, 0, MPI_COMM_WORLD);
+  MPI_Gather(sub_sum_and_count, 2, MPI_DOUBLE, sub_sums_and_counts, 2,
+             MPI_DOUBLE, 0, MPI_COMM_WORLD);
 
-  // Now that we have all of the partial averages on the root, compute the
-  // total average of all numbers. Since we are assuming each process computed
-  // an average across an equal amount of elements, this computation will
-  // produce the correct answer.
+  // Now that we have all of the partial sums on the root, compute the total
+  // average of all numbers
   if (world_rank == 0) {
-    float avg = compute_avg(sub_avgs, world_size);
-    printf("Avg of all elements is %f\n", avg);
+    double sum = 0, count = 0;
+    int i;
+    for (i = 0; i < world_size; i++) {
+      sum += sub_sums_and_counts[2 * i];
+      count += sub_sums_and_counts[2 * i + 1];
+    }
+    printf("Avg of all elements is %f\n", sum / count);
     // Compute the average across the original data for comparison
-    float original_data_avg =
-      compute_avg(rand_nums, num_elements_per_proc * world_size);
+    float original_data_avg = compute_avg(rand_nums, num_elements);
     printf("Avg computed across original data is %f\n", original_data_avg);
   }
 
   // Clean up
   if (world_rank == 0) {
-    free(rand_nums);
-    free(sub_avgs);
+    TMPI_Free(rand_nums);
+    free(sub_sums_and_counts);
+    free(counts);
+    free(offsets);
+  }
+  TMPI_Free(sub_rand_nums);
+}
+
+// Creates the whole array in memory that is shared by the processes on the
+// node of the root process, and scatters the parts of the other nodes to
+// memory that is shared by their processes. Only the first processes of the
+// nodes take part in the scatter, and every process reads its part directly
+// from the memory of its node, so the array is never copied within a node.
+void shared_scatter_avg(unsigned long long seed, long long num_elements) {
+  int world_rank;
+  MPI_Comm_rank(MPI_COMM_WORLD, &world_rank);
+  assert(num_elements <= 2147483647);
+
+  TMPI_Node_slice slice;
+  TMPI_Node_slice_get(num_elements, MPI_COMM_WORLD, &slice);
+
+  // The memory of a node starts at the part of its first process. The node of
+  // the root process starts at zero and holds the whole array.
+  TMPI_Shared shared;
+  long long shared_elements = world_rank == 0 ? num_elements : slice.node_count;
+  TMPI_Shared_create(sizeof(float) * shared_elements, slice.node_comm, &shared);
+  float *node_nums = (float *)shared.data;
+  if (world_rank == 0) {
+    TMPI_Random_fill_float(seed, 0, 0, node_nums, num_elements);
+  }
+
+  if (slice.leader_comm != MPI_COMM_NULL) {
+    int num_nodes;
+    MPI_Comm_size(slice.leader_comm, &num_nodes);
+    int node_part[2] = {slice.node_first, slice.node_count};
+    int *node_parts = NULL;
+    int *counts = NULL;
+    int *offsets = NULL;
+    if (world_rank == 0) {
+      node_parts = (int *)malloc(sizeof(int) * 2 * num_nodes);
+      counts = (int *)malloc(sizeof(int) * num_nodes);
+      offsets = (int *)malloc(sizeof(int) * num_nodes);
+    }
+    MPI_Gather(node_part, 2, MPI_INT, node_parts, 2, MPI_INT, 0,
+               slice.leader_comm);
+    if (world_rank == 0) {
+      int i;
+      for (i = 0; i < num_nodes; i++) {
+        offsets[i] = node_parts[2 * i];
+        counts[i] = node_parts[2 * i + 1];
+      }
+    }
+    // The part of the root node is already in place
+    MPI_Scatterv(node_nums, counts, offsets, MPI_FLOAT,
+                 world_rank == 0 ? MPI_IN_PLACE : node_nums, slice.node_count,
+                 MPI_FLOAT, 0, slice.leader_comm);
+    free(node_parts);
+    free(counts);
+    free(offsets);
+  }
+  TMPI_Shared_sync(&shared);
+
+  // Sum your part where it is and add the sums on the root process
+  double sub_sum = TMPI_Sum_float(node_nums + (slice.first - slice.node_first),
+                                  slice.count);
+  double sum;
+  MPI_Reduce(&sub_sum, &sum, 1, MPI_DOUBLE, MPI_SUM, 0, MPI_COMM_WORLD);
+  if (world_rank == 0) {
+    printf("Avg of all elements is %f\n", sum / num_elements);
+    float original_data_avg = compute_avg(node_nums, num_elements);
+    printf("Avg computed across original data is %f\n", original_data_avg);
+  }
+
+  TMPI_Shared_free(&shared);
+  TMPI_Topology_free(MPI_COMM_WORLD);
+}
+
+// Every process creates its own part of the array, and the sums and counts of
+// all parts are added with a single MPI_Allreduce. No process needs memory for
+// more than its own part.
+void distributed_avg(unsigned long long seed, long long num_elements) {
+  int world_rank;
+  MPI_Comm_rank(MPI_COMM_WORLD, &world_rank);
+  int world_size;
+  MPI_Comm_size(MPI_COMM_WORLD, &world_size);
+
+  long long first;
+  int num_sub_elements;
+  TMPI_Slice_get(num_elements, world_rank, world_size, &first,
+                 &num_sub_elements);
+  float *sub_rand_nums = create_rand_nums(seed, first, num_sub_elements);
+
+  // The count is reduced along with the sum so that the parts do not need to
+  // be equal in size
+  double local_sum_and_count[2] = {
+    TMPI_Sum_float(sub_rand_nums, num_sub_elements), num_sub_elements
+  };
+  double global_sum_and_count[2];
+  MPI_Allreduce(local_sum_and_count, global_sum_and_count, 2, MPI_DOUBLE,
+                MPI_SUM, MPI_COMM_WORLD);
+
+  if (world_rank == 0) {
+    printf("Avg of all elements is %f\n",
+           global_sum_and_count[0] / global_sum_and_count[1]);
+  }
+
+  TMPI_Free(sub_rand_nums);
+}
+
+int main(int argc, char** argv) {
+  if (argc < 2) {
+    fprintf(stderr, "Usage: avg num_elements_per_proc [--distributed] "
+            "[--shared] [--total=num_elements] [--seed=seed]\n");
+    exit(1);
+  }
+
+  long long num_elements_per_proc = atoll(argv[1]);
+  long long num_elements = 0;
+  int distributed = 0;
+  int shared = 0;
+  unsigned long long seed = TMPI_RANDOM_DEFAULT_SEED;
+  int i;
+  for (i = 2; i < argc; i++) {
+    if (strcmp(argv[i], "--distributed") == 0) {
+      distributed = 1;
+    } else if (strcmp(argv[i], "--shared") == 0) {
+      shared = 1;
+    } else if (strncmp(argv[i], "--total=", 8) == 0) {
+      num_elements = atoll(argv[i] + 8);
+    } else if (strncmp(argv[i], "--seed=", 7) == 0) {
+      seed = strtoull(argv[i] + 7, NULL, 10);
+    } else {
+      fprintf(stderr, "Unknown option %s\n", argv[i]);
+      exit(1);
+    }
+  }
+
+  MPI_Init(NULL, NULL);
+
+  int world_size;
+  MPI_Comm_size(MPI_COMM_WORLD, &world_size);
+
+  // Unless the total size is given, it is the number of elements per process
+  // times the number of processes
+  if (num_elements <= 0) {
+    num_elements = num_elements_per_proc * world_size;
+  }
+
+  if (distributed) {
+    distributed_avg(seed, num_elements);
+  } else if (shared) {
+    shared_scatter_avg(seed, num_elements);
+  } else {
+    scatter_avg(seed, num_elements);
   }
-  free(sub_rand_nums);
 
   MPI_Barrier(MPI_COMM_WORLD);
   MPI_Finalize();
@@ -0,0 +1,228 @@
+// Author: Wes Kendall
+// Copyright 2012 www.mpitutorial.com
+// This code is provided freely with the tutorials on mpitutorial.com. Feel
+// free to modify it for your own use. Any distribution of the code must
+// either provide a link to www.mpitutorial.com or keep this header intact.
+//
+// Strong scaling benchmark of computing the average of a fixed amount of
+// random numbers. The scatter pipeline creates all numbers on the root
+// process, scatters them and gathers the partial sums. The distributed
+// pipeline creates the numbers on the processes that use them and adds the
+// partial sums with MPI_Allreduce. The shared pipeline creates all numbers in
+// memory shared by the processes on the node of the root process and only
+// sends the parts of the other nodes to them. Run it with different amounts of processes
+// and the same num_elements to see how each pipeline scales. The results are
+// printed as CSV.
+//
+#include <stdio.h>
+#include <stdlib.h>
+#include <mpi.h>
+#include <assert.h>
+#include "tmpi_bench.h"
+#include "tmpi_memory.h"
+#include "tmpi_random.h"
+#include "tmpi_slice.h"
+#include "tmpi_sum.h"
+#include "tmpi_topology.h"
+
+// Computes the average by creating all numbers on the root process and
+// scattering them
+double scatter_avg(int num_elements, float *rand_nums, int *counts,
+                   int *offsets, float *sub_rand_nums, int num_sub_elements) {
+  int world_rank;
+  MPI_Comm_rank(MPI_COMM_WORLD, &world_rank);
+  if (world_rank == 0) {
+    TMPI_Random_fill_float(TMPI_RANDOM_DEFAULT_SEED, 0, 0, rand_nums,
+                           num_elements);
+  }
+  MPI_Scatterv(rand_nums, counts, offsets, MPI_FLOAT, sub_rand_nums,
+               num_sub_elements, MPI_FLOAT, 0, MPI_COMM_WORLD);
+  double sub_sum = TMPI_Sum_float(sub_rand_nums, num_sub_elements);
+  double sum;
+  MPI_Reduce(&sub_sum, &sum, 1, MPI_DOUBLE, MPI_SUM, 0, MPI_COMM_WORLD);
+  return sum / num_elements;
+}
+
+// Computes the average by creating all numbers in the shared memory of the
+// root node and scattering the parts of the other nodes to their shared
+// memory. Every process sums its part where it is. The parts of the nodes are
+// in counts and offsets on the root process.
+double shared_avg(int num_elements, TMPI_Node_slice *slice,
+                  TMPI_Shared *shared, int *node_counts, int *node_offsets) {
+  int world_rank;
+  MPI_Comm_rank(MPI_COMM_WORLD, &world_rank);
+  float *node_nums = (float *)shared->data;
+  if (world_rank == 0) {
+    TMPI_Random_fill_float(TMPI_RANDOM_DEFAULT_SEED, 0, 0, node_nums,
+                           num_elements);
+  }
+  if (slice->leader_comm != MPI_COMM_NULL) {
+    MPI_Scatterv(node_nums, node_counts, node_offsets, MPI_FLOAT,
+                 world_rank == 0 ? MPI_IN_PLACE : node_nums, slice->node_count,
+                 MPI_FLOAT, 0, slice->leader_comm);
+  }
+  TMPI_Shared_sync(shared);
+  double sub_sum = TMPI_Sum_float(node_nums + (slice->first - slice->node_first),
+                                  slice->count);
+  double sum;
+  MPI_Reduce(&sub_sum, &sum, 1, MPI_DOUBLE, MPI_SUM, 0, MPI_COMM_WORLD);
+  // The root process writes the next numbers only after all processes read
+  // these
+  TMPI_Shared_sync(shared);
+  return sum / num_elements;
+}
+
+// Computes the average by creating the numbers on the processes that use
+// them and reducing the sums and counts
+double distributed_avg(long long first, float *sub_rand_nums,
+                       int num_sub_elements) {
+  TMPI_Random_fill_float(TMPI_RANDOM_DEFAULT_SEED, 0, first, sub_rand_nums,
+                         num_sub_elements);
+  double local_sum_and_count[2] = {
+    TMPI_Sum_float(sub_rand_nums, num_sub_elements), num_sub_elements
+  };
+  double global_sum_and_count[2];
+  MPI_Allreduce(local_sum_and_count, global_sum_and_count, 2, MPI_DOUBLE,
+                MPI_SUM, MPI_COMM_WORLD);
+  return global_sum_and_count[0] / global_sum_and_count[1];
+}
+
+// The data of all pipelines, and the pipeline that TMPI_Bench_time runs
+typedef struct {
+  int pipeline;
+  int num_elements;
+  float *rand_nums;
+  int *counts;
+  int *offsets;
+  long long first;
+  float *sub_rand_nums;
+  int num_sub_elements;
+  TMPI_Node_slice *slice;
+  TMPI_Shared *shared;
+  int *node_counts;
+  int *node_offsets;
+  // The average that the last trial computed
+  double avg;
+} AvgTrial;
+
+void run_pipeline(void *arg) {
+  AvgTrial *trial = (AvgTrial *)arg;
+  if (trial->pipeline == 0) {
+    trial->avg = scatter_avg(trial->num_elements, trial->rand_nums,
+                             trial->counts, trial->offsets,
+                             trial->sub_rand_nums, trial->num_sub_elements);
+  } else if (trial->pipeline == 1) {
+    trial->avg = distributed_avg(trial->first, trial->sub_rand_nums,
+                                 trial->num_sub_elements);
+  } else {
+    trial->avg = shared_avg(trial->num_elements, trial->slice, trial->shared,
+                            trial->node_counts, trial->node_offsets);
+  }
+}
+
+int main(int argc, char** argv) {
+  if (argc != 3) {
+    fprintf(stderr, "Usage: bench_avg num_elements num_trials\n");
+    exit(1);
+  }
+
+  int num_elements = atoi(argv[1]);
+  int num_trials = atoi(argv[2]);
+  if (num_trials < 1) {
+    num_trials = 1;
+  }
+
+  MPI_Init(NULL, NULL);
+
+  int world_rank;
+  MPI_Comm_rank(MPI_COMM_WORLD, &world_rank);
+  int world_size;
+  MPI_Comm_size(MPI_COMM_WORLD, &world_size);
+
+  long long first;
+  int num_sub_elements;
+  TMPI_Slice_get(num_elements, world_rank, world_size, &first,
+                 &num_sub_elements);
+  float *sub_rand_nums = (float *)TMPI_Alloc(sizeof(float) * num_sub_elements);
+  assert(sub_rand_nums != NULL);
+  float *rand_nums = NULL;
+  int *counts = NULL;
+  int *offsets = NULL;
+  if (world_rank == 0) {
+    rand_nums = (float *)TMPI_Alloc(sizeof(float) * num_elements);
+    assert(rand_nums != NULL);
+    counts = (int *)malloc(sizeof(int) * world_size);
+    offsets = (int *)malloc(sizeof(int) * world_size);
+    int i;
+    for (i = 0; i < world_size; i++) {
+      long long slice_first;
+      TMPI_Slice_get(num_elements, i, world_size, &slice_first, &counts[i]);
+      offsets[i] = slice_first;
+    }
+    printf("pipeline,procs,elements,root_bytes,avg,min_us,median_us,max_us\n");
+  }
+
+  // The shared memory of the root node holds all numbers and the memory of
+  // the other nodes holds their parts
+  TMPI_Node_slice slice;
+  TMPI_Node_slice_get(num_elements, MPI_COMM_WORLD, &slice);
+  TMPI_Shared shared;
+  TMPI_Shared_create(sizeof(float) * (world_rank == 0 ? (long long)num_elements :
+                                      slice.node_count),
+                     slice.node_comm, &shared);
+  int *node_counts = NULL;
+  int *node_offsets = NULL;
+  if (slice.leader_comm != MPI_COMM_NULL) {
+    int num_nodes;
+    MPI_Comm_size(slice.leader_comm, &num_nodes);
+    if (world_rank == 0) {
+      node_counts = (int *)malloc(sizeof(int) * num_nodes);
+      node_offsets = (int *)malloc(sizeof(int) * num_nodes);
+    }
+    int node_offset = slice.node_first;
+    MPI_Gather(&slice.node_count, 1, MPI_INT, node_counts, 1, MPI_INT, 0,
+               slice.leader_comm);
+    MPI_Gather(&node_offset, 1, MPI_INT, node_offsets, 1, MPI_INT, 0,
+               slice.leader_comm);
+  }
+
+  AvgTrial trial = {0, num_elements, rand_nums, counts, offsets, first,
+                    sub_rand_nums, num_sub_elements, &slice, &shared,
+                    node_counts, node_offsets, 0};
+  const char *pipelines[3] = {"scatter", "distributed", "shared"};
+  for (trial.pipeline = 0; trial.pipeline < 3; trial.pipeline++) {
+    // The first trial is not timed so that the memory is touched
+    double *sorted_times = TMPI_Bench_time(&run_pipeline, &trial, 1,
+                                           num_trials, MPI_COMM_WORLD);
+    if (world_rank == 0) {
+      // The root process holds all numbers and its own part in the scatter
+      // pipeline, only its own part in the distributed pipeline, and all
+      // numbers for its whole node in the shared pipeline
+      long long root_bytes = sizeof(float) *
+        (trial.pipeline == 1 ? (long long)num_sub_elements :
+         (long long)num_elements + (trial.pipeline == 0 ? num_sub_elements : 0));
+      printf("%s,%d,%d,%lld,%f,%.3f,%.3f,%.3f\n",
+             pipelines[trial.pipeline], world_size, num_elements,
+             root_bytes, trial.avg, sorted_times[0] * 1e6,
+             sorted_times[num_trials / 2] * 1e6,
+             sorted_times[num_trials - 1] * 1e6);
+      fflush(stdout);
+      free(sorted_times);
+    }
+  }
+
+  // Clean up
+  if (world_rank == 0) {
+    TMPI_Free(rand_nums);
+    free(counts);
+    free(offsets);
+    free(node_counts);
+    free(node_offsets);
+  }
+  TMPI_Free(sub_rand_nums);
+  TMPI_Shared_free(&shared);
+  TMPI_Topology_free(MPI_COMM_WORLD);
+
+  MPI_Barrier(MPI_COMM_WORLD);
+  MPI_Finalize();
+}
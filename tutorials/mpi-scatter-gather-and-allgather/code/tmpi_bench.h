@@ -0,0 +1,27 @@
+// Author: Wes Kendall
+// Copyright 2011 www.mpitutorial.com
+// This code is provided freely with the tutorials on mpitutorial.com. Feel
+// free to modify it for your own use. Any distribution of the code must
+// either provide a link to www.mpitutorial.com or keep this header intact.
+//
+// Header file for TMPI_Bench_time, the timing loop of the benchmarks
+//
+#ifndef __TMPI_BENCH_H
+#define __TMPI_BENCH_H 1
+
+#include <mpi.h>
+
+// A function that runs one trial of a benchmark. arg is passed through from
+// TMPI_Bench_time.
+typedef void (*TMPI_Bench_function)(void *arg);
+
+// Calls run num_warmup_trials times without timing it, and then times
+// num_trials calls. The processes of comm synchronize before every timed
+// trial, and the time of a trial is the time of its slowest process. Returns
+// the trial times in seconds sorted in ascending order on rank zero of comm,
+// and NULL on the other processes. The times must be freed with free. This is
+// collective over comm.
+double *TMPI_Bench_time(TMPI_Bench_function run, void *arg,
+                        int num_warmup_trials, int num_trials, MPI_Comm comm);
+
+#endif
@@ -0,0 +1,142 @@
+// Author: Wes Kendall
+// Copyright 2014 www.mpitutorial.com
+// This code is provided freely with the tutorials on mpitutorial.com. Feel
+// free to modify it for your own use. Any distribution of the code must
+// either provide a link to www.mpitutorial.com or keep this header intact.
+//
+// Memory functions for large runs. Memory from malloc is placed wherever the
+// system likes, and every process of a node keeps its own copy of data that
+// they all read. TMPI_Alloc maps large arrays directly, so that they are backed
+// by huge pages and their pages are placed by the threads that write them
+// first. TMPI_Shared uses MPI_Win_allocate_shared so that the processes of a
+// node can read one copy of the data.
+//
+#include <stdlib.h>
+#include <mpi.h>
+#include "tmpi_memory.h"
+#if defined(__unix__) || defined(__APPLE__)
+#include <sys/mman.h>
+#endif
+
+// Arrays of at least this many bytes are mapped directly. This is the size of
+// a huge page on most systems.
+#define TMPI_ALLOC_LARGE_SIZE (1 << 21)
+
+// The size of the header in front of the memory. It keeps the memory aligned
+// to a cache line.
+#define TMPI_ALLOC_HEADER_SIZE 64
+
+// The header in front of every array from TMPI_Alloc. It holds the memory that
+// was allocated, which starts before the array. mapped_size is zero if the
+// memory came from malloc.
+typedef struct {
+  void *start;
+  size_t mapped_size;
+} AllocHeader;
+
+// Rounds size up to a multiple of alignment, which is a power of two
+static size_t align_up(size_t size, size_t alignment) {
+  return (size + alignment - 1) & ~(alignment - 1);
+}
+
+// Maps size bytes of pages that are not touched yet. Returns NULL if the
+// system cannot map them.
+static void *map_pages(size_t size) {
+#if defined(MAP_ANONYMOUS)
+  void *data = mmap(NULL, size, PROT_READ | PROT_WRITE,
+                    MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+  return data == MAP_FAILED ? NULL : data;
+#else
+  return NULL;
+#endif
+}
+
+void *TMPI_Alloc(size_t size) {
+  char *data = NULL;
+  char *start = NULL;
+  size_t mapped_size = 0;
+  if (size + TMPI_ALLOC_HEADER_SIZE >= TMPI_ALLOC_LARGE_SIZE) {
+    // The system only aligns mappings to small pages, so one more huge page
+    // is mapped. The array starts at the first huge page boundary after the
+    // header, so that all of it can be backed by huge pages.
+    size_t huge_size = align_up(size, TMPI_ALLOC_LARGE_SIZE);
+    mapped_size = huge_size + TMPI_ALLOC_LARGE_SIZE;
+    start = (char *)map_pages(mapped_size);
+    if (start != NULL) {
+      data = start + align_up((size_t)start + TMPI_ALLOC_HEADER_SIZE,
+                              TMPI_ALLOC_LARGE_SIZE) - (size_t)start;
+#ifdef MADV_HUGEPAGE
+      // Huge pages need far fewer TLB entries for large arrays. The advice is
+      // ignored where they are not enabled.
+      madvise(data, huge_size, MADV_HUGEPAGE);
+#endif
+    }
+  }
+  if (data == NULL) {
+    mapped_size = 0;
+    start = (char *)malloc(size + TMPI_ALLOC_HEADER_SIZE);
+    if (start == NULL) {
+      return NULL;
+    }
+    data = start + TMPI_ALLOC_HEADER_SIZE;
+  }
+  // Only the page of the header is touched here
+  AllocHeader *header = (AllocHeader *)(data - TMPI_ALLOC_HEADER_SIZE);
+  header->start = start;
+  header->mapped_size = mapped_size;
+  return data;
+}
+
+void TMPI_Free(void *data) {
+  if (data == NULL) {
+    return;
+  }
+  AllocHeader *header =
+    (AllocHeader *)((char *)data - TMPI_ALLOC_HEADER_SIZE);
+  if (header->mapped_size == 0) {
+    free(header->start);
+  } else {
+#if defined(MAP_ANONYMOUS)
+    munmap(header->start, header->mapped_size);
+#endif
+  }
+}
+
+int TMPI_Shared_create(MPI_Aint size, MPI_Comm node_comm, TMPI_Shared *shared) {
+  int node_rank;
+  MPI_Comm_rank(node_comm, &node_rank);
+  MPI_Bcast(&size, 1, MPI_AINT, 0, node_comm);
+  shared->node_comm = node_comm;
+  shared->size = size;
+
+  // Only the first process allocates memory. The others ask for its address
+  // in their own address space.
+  void *local_data;
+  int result = MPI_Win_allocate_shared(node_rank == 0 ? size : 0, 1,
+                                       MPI_INFO_NULL, node_comm, &local_data,
+                                       &shared->win);
+  if (result != MPI_SUCCESS) {
+    return result;
+  }
+  MPI_Aint first_size;
+  int disp_unit;
+  MPI_Win_shared_query(shared->win, 0, &first_size, &disp_unit, &shared->data);
+
+  // The processes access the memory directly with loads and stores. An epoch
+  // stays open for the whole lifetime of the window so that MPI_Win_sync can
+  // order those accesses.
+  MPI_Win_lock_all(MPI_MODE_NOCHECK, shared->win);
+  return MPI_SUCCESS;
+}
+
+int TMPI_Shared_sync(TMPI_Shared *shared) {
+  MPI_Win_sync(shared->win);
+  MPI_Barrier(shared->node_comm);
+  MPI_Win_sync(shared->win);
+  return MPI_SUCCESS;
+}
+
+int TMPI_Shared_free(TMPI_Shared *shared) {
+  MPI_Win_unlock_all(shared->win);
+  return MPI_Win_free(&shared->win);
+}
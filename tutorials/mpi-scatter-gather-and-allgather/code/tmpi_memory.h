@@ -0,0 +1,57 @@
+// Author: Wes Kendall
+// Copyright 2014 www.mpitutorial.com
+// This code is provided freely with the tutorials on mpitutorial.com. Feel
+// free to modify it for your own use. Any distribution of the code must
+// either provide a link to www.mpitutorial.com or keep this header intact.
+//
+// Header file for the TMPI memory functions. TMPI_Alloc allocates large arrays
+// that are placed close to the threads that first write them, and TMPI_Shared
+// is memory that all processes of a node can read without copying it.
+//
+#ifndef __TMPI_MEMORY_H
+#define __TMPI_MEMORY_H 1
+
+#include <stddef.h>
+#include <mpi.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// Allocates size bytes. Large arrays get pages of their own that start at a
+// huge page boundary, so that they are backed by huge pages where the system
+// supports it. Their pages are not touched until the array is first written,
+// so every page is placed on the NUMA node of the thread that writes it first.
+// Returns NULL if the memory cannot be allocated.
+void *TMPI_Alloc(size_t size);
+
+// Frees memory from TMPI_Alloc
+void TMPI_Free(void *data);
+
+// Memory that is allocated by the first process of a node and can be read and
+// written by all processes of the node
+typedef struct {
+  MPI_Comm node_comm;
+  MPI_Win win;
+  // The start of the memory, which is at a different address on every process
+  void *data;
+  MPI_Aint size;
+} TMPI_Shared;
+
+// Allocates size bytes of memory on the first process of node_comm, which must
+// only contain processes of one node (see MPI_Comm_split_type). The size of
+// the first process is used. This is collective over node_comm.
+int TMPI_Shared_create(MPI_Aint size, MPI_Comm node_comm, TMPI_Shared *shared);
+
+// Makes the writes of every process of the node visible to the others. This is
+// collective over the node_comm of the memory, and has to be called between
+// writing the memory on one process and reading it on another.
+int TMPI_Shared_sync(TMPI_Shared *shared);
+
+int TMPI_Shared_free(TMPI_Shared *shared);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
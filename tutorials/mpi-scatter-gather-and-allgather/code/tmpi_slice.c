@@ -0,0 +1,61 @@
+// Author: Wes Kendall
+// Copyright 2014 www.mpitutorial.com
+// This code is provided freely with the tutorials on mpitutorial.com. Feel
+// free to modify it for your own use. Any distribution of the code must
+// either provide a link to www.mpitutorial.com or keep this header intact.
+//
+// Functions that split an array among processes. TMPI_Slice_get splits it by
+// rank. TMPI_Node_slice numbers the processes node by node instead, so that
+// a node can hold the parts of all its processes in one piece of shared
+// memory. The nodes come from the topology that TMPI_Topology caches on the
+// communicator.
+//
+#include <mpi.h>
+#include "tmpi_slice.h"
+#include "tmpi_topology.h"
+
+void TMPI_Slice_get(long long num_elements, int rank, int num_procs,
+                    long long *first, int *count) {
+  long long base = num_elements / num_procs;
+  int remainder = num_elements % num_procs;
+  *first = base * rank + (rank < remainder ? rank : remainder);
+  *count = base + (rank < remainder ? 1 : 0);
+}
+
+int TMPI_Node_slice_get(long long num_elements, MPI_Comm comm,
+                        TMPI_Node_slice *slice) {
+  int comm_size;
+  MPI_Comm_size(comm, &comm_size);
+  TMPI_Topology *topology;
+  TMPI_Topology_get(comm, &topology);
+  slice->node_comm = topology->node_comm;
+  slice->leader_comm = topology->leader_comm;
+  int node_rank, node_size;
+  MPI_Comm_rank(slice->node_comm, &node_rank);
+  MPI_Comm_size(slice->node_comm, &node_size);
+
+  // The processes of a node come after the processes of the nodes before it
+  int node_start = 0;
+  if (slice->leader_comm != MPI_COMM_NULL) {
+    MPI_Exscan(&node_size, &node_start, 1, MPI_INT, MPI_SUM,
+               slice->leader_comm);
+    int leader_rank;
+    MPI_Comm_rank(slice->leader_comm, &leader_rank);
+    if (leader_rank == 0) {
+      node_start = 0;
+    }
+  }
+  MPI_Bcast(&node_start, 1, MPI_INT, 0, slice->node_comm);
+
+  TMPI_Slice_get(num_elements, node_start + node_rank, comm_size,
+                 &slice->first, &slice->count);
+  int first_count;
+  TMPI_Slice_get(num_elements, node_start, comm_size, &slice->node_first,
+                 &first_count);
+  long long last_first;
+  int last_count;
+  TMPI_Slice_get(num_elements, node_start + node_size - 1, comm_size,
+                 &last_first, &last_count);
+  slice->node_count = last_first + last_count - slice->node_first;
+  return MPI_SUCCESS;
+}
@@ -0,0 +1,43 @@
+// Author: Wes Kendall
+// Copyright 2014 www.mpitutorial.com
+// This code is provided freely with the tutorials on mpitutorial.com. Feel
+// free to modify it for your own use. Any distribution of the code must
+// either provide a link to www.mpitutorial.com or keep this header intact.
+//
+// Header file for the functions that split an array among processes
+//
+#ifndef __TMPI_SLICE_H
+#define __TMPI_SLICE_H 1
+
+#include <mpi.h>
+
+// Computes the part of an array of num_elements that process rank of
+// num_procs handles. When the array cannot be split evenly, the first
+// processes get one more element.
+void TMPI_Slice_get(long long num_elements, int rank, int num_procs,
+                    long long *first, int *count);
+
+// The part of an array that a process handles when the parts are handed out
+// node by node, along with the communicators of its node
+typedef struct {
+  // The processes on the same node as this process, and the first process of
+  // every node or MPI_COMM_NULL on other processes. They belong to the
+  // topology that TMPI_Topology caches on the communicator and must not be
+  // freed.
+  MPI_Comm node_comm;
+  MPI_Comm leader_comm;
+  long long first;
+  int count;
+  // The parts of all processes of the node
+  long long node_first;
+  int node_count;
+} TMPI_Node_slice;
+
+// Computes the part of an array of num_elements that a process of comm
+// handles when the processes are numbered node by node, so that the parts of
+// a node are next to each other. The first processes of the nodes are ordered
+// by rank, so the node of rank 0 comes first. This is collective over comm.
+int TMPI_Node_slice_get(long long num_elements, MPI_Comm comm,
+                        TMPI_Node_slice *slice);
+
+#endif
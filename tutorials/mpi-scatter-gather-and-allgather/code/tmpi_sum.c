@@ -0,0 +1,76 @@
+// Author: Wes Kendall
+// Copyright 2013 www.mpitutorial.com
+// This code is provided freely with the tutorials on mpitutorial.com. Feel
+// free to modify it for your own use. Any distribution of the code must
+// either provide a link to www.mpitutorial.com or keep this header intact.
+//
+// Kernels that sum arrays of floats quickly and accurately. Adding numbers
+// one at a time to a float loses more precision the larger the sum gets, and
+// every addition has to wait for the previous one. These kernels instead
+// split the numbers into blocks, and sum every block in several independent
+// double accumulators (lanes) that the compiler can keep in vector registers.
+// The sums of the blocks are then added with compensated (Kahan-Babuska)
+// summation, which keeps track of the rounding error of every addition.
+//
+#include <math.h>
+#include "tmpi_sum.h"
+
+// The amount of independent accumulators in a block
+#define TMPI_SUM_LANES 8
+
+// The amount of numbers in a block. Every lane adds up at most
+// TMPI_SUM_BLOCK_SIZE / TMPI_SUM_LANES numbers, so its error stays small.
+#define TMPI_SUM_BLOCK_SIZE 4096
+
+// A sum along with the rounding error of the additions that made it
+typedef struct {
+  double sum;
+  double compensation;
+} CompensatedSum;
+
+// Adds a number to a compensated sum. The rounding error of the addition is
+// computed exactly from whichever of the two numbers is larger.
+static void compensated_add(CompensatedSum *total, double number) {
+  double sum = total->sum + number;
+  if (fabs(total->sum) >= fabs(number)) {
+    total->compensation += (total->sum - sum) + number;
+  } else {
+    total->compensation += (number - sum) + total->sum;
+  }
+  total->sum = sum;
+}
+
+// Returns the amount of numbers in the block starting at index start
+static int get_block_size(long long start, long long count) {
+  return count - start < TMPI_SUM_BLOCK_SIZE ? count - start : TMPI_SUM_BLOCK_SIZE;
+}
+
+// Sums a block of at most TMPI_SUM_BLOCK_SIZE numbers. The numbers that do not
+// fill all lanes at the end are added to the first lane.
+static double sum_block(const float *data, int size) {
+  double lanes[TMPI_SUM_LANES] = {0};
+  int i, lane;
+  int lane_end = size - size % TMPI_SUM_LANES;
+  for (i = 0; i < lane_end; i += TMPI_SUM_LANES) {
+    for (lane = 0; lane < TMPI_SUM_LANES; lane++) {
+      lanes[lane] += data[i + lane];
+    }
+  }
+  for (; i < size; i++) {
+    lanes[0] += data[i];
+  }
+  double sum = 0;
+  for (lane = 0; lane < TMPI_SUM_LANES; lane++) {
+    sum += lanes[lane];
+  }
+  return sum;
+}
+
+double TMPI_Sum_float(const float *data, long long count) {
+  CompensatedSum total = {0, 0};
+  long long start;
+  for (start = 0; start < count; start += TMPI_SUM_BLOCK_SIZE) {
+    compensated_add(&total, sum_block(data + start, get_block_size(start, count)));
+  }
+  return total.sum + total.compensation;
+}
@@ -0,0 +1,15 @@
+// Author: Wes Kendall
+// Copyright 2013 www.mpitutorial.com
+// This code is provided freely with the tutorials on mpitutorial.com. Feel
+// free to modify it for your own use. Any distribution of the code must
+// either provide a link to www.mpitutorial.com or keep this header intact.
+//
+// Header file for the local summation kernels
+//
+#ifndef __TMPI_SUM_H
+#define __TMPI_SUM_H 1
+
+// Returns the sum of count floats
+double TMPI_Sum_float(const float *data, long long count);
+
+#endif
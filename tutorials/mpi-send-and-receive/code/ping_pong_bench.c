@@ -0,0 +1,322 @@
+// Author: Wes Kendall
+// Copyright 2011 www.mpitutorial.com
+// This code is provided freely with the tutorials on mpitutorial.com. Feel
+// free to modify it for your own use. Any distribution of the code must
+// either provide a link to www.mpitutorial.com or keep this header intact.
+//
+// Point-to-point benchmark built on the ping pong example. For every message
+// size it measures the half round trip latency of blocking, non-blocking,
+// synchronous, persistent, and one-sided (MPI_Put) communication, and the
+// streaming bandwidth of windowed non-blocking sends in one direction, in both
+// directions, and over many pairs of processes at once.
+//
+// Processes are paired up as (i, i + world_size / 2). The latency and single
+// pair bandwidth tests run on the first pair only, while the multi-pair test
+// runs on all pairs.
+//
+#include <mpi.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+
+// The amount of messages in flight in the bandwidth tests
+#define WINDOW_SIZE 64
+// The bandwidth tests use smaller windows when a window would take more memory
+#define MAX_WINDOW_BYTES (64 * 1024 * 1024)
+// Warmup iterations before every test
+#define WARMUP_ITERATIONS 10
+
+typedef enum {
+  BLOCKING,
+  NON_BLOCKING,
+  SYNCHRONOUS,
+  PERSISTENT,
+  ONE_SIDED,
+  NUM_LATENCY_MODES
+} LatencyMode;
+
+const char *latency_mode_names[] = {
+  "send_recv_us", "isend_irecv_us", "ssend_us", "persistent_us", "put_us"
+};
+
+// Holds the pairing information of a process. The pair communicator holds only
+// the process and its partner, with the initiator as rank zero.
+typedef struct {
+  int partner;
+  int is_initiator;
+  int pair_index;
+  MPI_Comm pair_comm;
+} Pair;
+
+// Runs one ping pong with the given mode. The initiator sends first and the
+// responder answers with a message of the same size. Messages are sent from
+// send_buffer and received into recv_buffer, since a buffer must not be
+// written by a receive while a send of it is still in progress.
+void ping_pong(LatencyMode mode, Pair *pair, char *send_buffer,
+               char *recv_buffer, int message_size,
+               MPI_Request *persistent_requests, MPI_Win window) {
+  MPI_Request requests[2];
+  if (mode == BLOCKING) {
+    if (pair->is_initiator) {
+      MPI_Send(send_buffer, message_size, MPI_BYTE, pair->partner, 0, MPI_COMM_WORLD);
+      MPI_Recv(recv_buffer, message_size, MPI_BYTE, pair->partner, 0, MPI_COMM_WORLD,
+               MPI_STATUS_IGNORE);
+    } else {
+      MPI_Recv(recv_buffer, message_size, MPI_BYTE, pair->partner, 0, MPI_COMM_WORLD,
+               MPI_STATUS_IGNORE);
+      MPI_Send(send_buffer, message_size, MPI_BYTE, pair->partner, 0, MPI_COMM_WORLD);
+    }
+  } else if (mode == NON_BLOCKING) {
+    if (pair->is_initiator) {
+      // Post the receive for the answer before sending so it is ready on arrival
+      MPI_Irecv(recv_buffer, message_size, MPI_BYTE, pair->partner, 0, MPI_COMM_WORLD,
+                &requests[0]);
+      MPI_Isend(send_buffer, message_size, MPI_BYTE, pair->partner, 0, MPI_COMM_WORLD,
+                &requests[1]);
+      MPI_Waitall(2, requests, MPI_STATUSES_IGNORE);
+    } else {
+      MPI_Irecv(recv_buffer, message_size, MPI_BYTE, pair->partner, 0, MPI_COMM_WORLD,
+                &requests[0]);
+      MPI_Wait(&requests[0], MPI_STATUS_IGNORE);
+      MPI_Isend(send_buffer, message_size, MPI_BYTE, pair->partner, 0, MPI_COMM_WORLD,
+                &requests[1]);
+      MPI_Wait(&requests[1], MPI_STATUS_IGNORE);
+    }
+  } else if (mode == SYNCHRONOUS) {
+    if (pair->is_initiator) {
+      MPI_Ssend(send_buffer, message_size, MPI_BYTE, pair->partner, 0, MPI_COMM_WORLD);
+      MPI_Recv(recv_buffer, message_size, MPI_BYTE, pair->partner, 0, MPI_COMM_WORLD,
+               MPI_STATUS_IGNORE);
+    } else {
+      MPI_Recv(recv_buffer, message_size, MPI_BYTE, pair->partner, 0, MPI_COMM_WORLD,
+               MPI_STATUS_IGNORE);
+      MPI_Ssend(send_buffer, message_size, MPI_BYTE, pair->partner, 0, MPI_COMM_WORLD);
+    }
+  } else if (mode == PERSISTENT) {
+    // persistent_requests holds a send request and a receive request that were
+    // set up once with MPI_Send_init and MPI_Recv_init
+    if (pair->is_initiator) {
+      MPI_Start(&persistent_requests[1]);
+      MPI_Start(&persistent_requests[0]);
+      MPI_Waitall(2, persistent_requests, MPI_STATUSES_IGNORE);
+    } else {
+      MPI_Start(&persistent_requests[1]);
+      MPI_Wait(&persistent_requests[1], MPI_STATUS_IGNORE);
+      MPI_Start(&persistent_requests[0]);
+      MPI_Wait(&persistent_requests[0], MPI_STATUS_IGNORE);
+    }
+  } else if (mode == ONE_SIDED) {
+    // Each process puts the message into the window of the other one. The
+    // fences complete the puts and tell the target that the data arrived.
+    if (pair->is_initiator) {
+      MPI_Put(send_buffer, message_size, MPI_BYTE, 1, 0, message_size, MPI_BYTE, window);
+    }
+    MPI_Win_fence(0, window);
+    if (!pair->is_initiator) {
+      MPI_Put(send_buffer, message_size, MPI_BYTE, 0, 0, message_size, MPI_BYTE, window);
+    }
+    MPI_Win_fence(0, window);
+  }
+}
+
+// Returns the half round trip latency of the mode in microseconds
+double measure_latency(LatencyMode mode, Pair *pair, char *send_buffer,
+                       char *recv_buffer, int message_size, int iterations) {
+  MPI_Request persistent_requests[2];
+  MPI_Win window = MPI_WIN_NULL;
+  char *window_buffer = NULL;
+  if (mode == PERSISTENT) {
+    MPI_Send_init(send_buffer, message_size, MPI_BYTE, pair->partner, 0, MPI_COMM_WORLD,
+                  &persistent_requests[0]);
+    MPI_Recv_init(recv_buffer, message_size, MPI_BYTE, pair->partner, 0, MPI_COMM_WORLD,
+                  &persistent_requests[1]);
+  } else if (mode == ONE_SIDED) {
+    MPI_Alloc_mem(message_size, MPI_INFO_NULL, &window_buffer);
+    MPI_Win_create(window_buffer, message_size, 1, MPI_INFO_NULL, pair->pair_comm,
+                   &window);
+    MPI_Win_fence(0, window);
+  }
+
+  int i;
+  for (i = 0; i < WARMUP_ITERATIONS; i++) {
+    ping_pong(mode, pair, send_buffer, recv_buffer, message_size,
+              persistent_requests, window);
+  }
+  MPI_Barrier(pair->pair_comm);
+  double time = -MPI_Wtime();
+  for (i = 0; i < iterations; i++) {
+    ping_pong(mode, pair, send_buffer, recv_buffer, message_size,
+              persistent_requests, window);
+  }
+  time += MPI_Wtime();
+
+  if (mode == PERSISTENT) {
+    MPI_Request_free(&persistent_requests[0]);
+    MPI_Request_free(&persistent_requests[1]);
+  } else if (mode == ONE_SIDED) {
+    MPI_Win_free(&window);
+    MPI_Free_mem(window_buffer);
+  }
+  return time * 1e6 / (2.0 * iterations);
+}
+
+// Sends one window of messages. In a unidirectional test the initiator sends and
+// the responder receives, then acknowledges the window with an empty message so
+// that the next window does not start before this one is received. In a
+// bidirectional test both processes send and receive a window at the same time.
+void send_window(Pair *pair, char *send_buffer, char *recv_buffer, int message_size,
+                 int window_size, int bidirectional) {
+  MPI_Request requests[2 * WINDOW_SIZE];
+  int request_count = 0;
+  int w;
+  if (bidirectional || !pair->is_initiator) {
+    for (w = 0; w < window_size; w++) {
+      MPI_Irecv(recv_buffer + (long long)w * message_size, message_size, MPI_BYTE,
+                pair->partner, 1, MPI_COMM_WORLD, &requests[request_count++]);
+    }
+  }
+  if (bidirectional || pair->is_initiator) {
+    for (w = 0; w < window_size; w++) {
+      MPI_Isend(send_buffer, message_size, MPI_BYTE, pair->partner, 1, MPI_COMM_WORLD,
+                &requests[request_count++]);
+    }
+  }
+  MPI_Waitall(request_count, requests, MPI_STATUSES_IGNORE);
+  if (!bidirectional) {
+    if (pair->is_initiator) {
+      MPI_Recv(NULL, 0, MPI_BYTE, pair->partner, 2, MPI_COMM_WORLD, MPI_STATUS_IGNORE);
+    } else {
+      MPI_Send(NULL, 0, MPI_BYTE, pair->partner, 2, MPI_COMM_WORLD);
+    }
+  }
+}
+
+// Returns the bandwidth in MB/s that this pair achieves with windows of
+// non-blocking sends. A bidirectional test counts the data of both directions.
+double measure_bandwidth(Pair *pair, char *send_buffer, char *recv_buffer,
+                         int message_size, int iterations, int bidirectional) {
+  int window_size = WINDOW_SIZE;
+  while (window_size > 1 && (long long)window_size * message_size > MAX_WINDOW_BYTES) {
+    window_size /= 2;
+  }
+
+  int i;
+  for (i = 0; i < WARMUP_ITERATIONS; i++) {
+    send_window(pair, send_buffer, recv_buffer, message_size, window_size, bidirectional);
+  }
+  MPI_Barrier(pair->pair_comm);
+  double time = -MPI_Wtime();
+  for (i = 0; i < iterations; i++) {
+    send_window(pair, send_buffer, recv_buffer, message_size, window_size, bidirectional);
+  }
+  time += MPI_Wtime();
+
+  double bytes = (double)message_size * window_size * iterations * (bidirectional ? 2 : 1);
+  return bytes / time / 1e6;
+}
+
+int main(int argc, char** argv) {
+  if (argc != 3) {
+    fprintf(stderr, "Usage: ping_pong_bench max_message_size num_iterations\n");
+    exit(1);
+  }
+
+  int max_message_size = atoi(argv[1]);
+  int num_iterations = atoi(argv[2]);
+
+  // Initialize the MPI environment
+  MPI_Init(NULL, NULL);
+  // Find out rank, size
+  int world_rank;
+  MPI_Comm_rank(MPI_COMM_WORLD, &world_rank);
+  int world_size;
+  MPI_Comm_size(MPI_COMM_WORLD, &world_size);
+
+  // We are assuming an even amount of processes so that everyone has a partner
+  if (world_size < 2 || world_size % 2 != 0) {
+    fprintf(stderr, "World size must be even for %s\n", argv[0]);
+    MPI_Abort(MPI_COMM_WORLD, 1);
+  }
+
+  Pair pair;
+  int half = world_size / 2;
+  pair.is_initiator = world_rank < half;
+  pair.partner = pair.is_initiator ? world_rank + half : world_rank - half;
+  pair.pair_index = pair.is_initiator ? world_rank : world_rank - half;
+  MPI_Comm_split(MPI_COMM_WORLD, pair.pair_index, !pair.is_initiator, &pair.pair_comm);
+
+  char *send_buffer = malloc(max_message_size);
+  char *recv_buffer = malloc(MAX_WINDOW_BYTES > max_message_size ?
+                             MAX_WINDOW_BYTES : max_message_size);
+  assert(send_buffer != NULL && recv_buffer != NULL);
+  memset(send_buffer, 0, max_message_size);
+
+  if (world_rank == 0) {
+    printf("%10s", "bytes");
+    int mode;
+    for (mode = 0; mode < NUM_LATENCY_MODES; mode++) {
+      printf(" %15s", latency_mode_names[mode]);
+    }
+    printf(" %15s %15s %15s\n", "bw_MBps", "bibw_MBps", "multi_bw_MBps");
+  }
+
+  int message_size;
+  for (message_size = 1; message_size <= max_message_size; message_size *= 2) {
+    // Use fewer iterations for large messages to keep the run time in check
+    int iterations = num_iterations;
+    if (message_size > 65536) {
+      iterations = (long long)num_iterations * 65536 / message_size;
+      if (iterations < 4) {
+        iterations = 4;
+      }
+    }
+
+    double latencies[NUM_LATENCY_MODES];
+    double bandwidth = 0, bidirectional_bandwidth = 0;
+    if (pair.pair_index == 0) {
+      int mode;
+      for (mode = 0; mode < NUM_LATENCY_MODES; mode++) {
+        latencies[mode] = measure_latency(mode, &pair, send_buffer, recv_buffer,
+                                          message_size, iterations);
+      }
+      bandwidth = measure_bandwidth(&pair, send_buffer, recv_buffer, message_size,
+                                    iterations, 0);
+      bidirectional_bandwidth = measure_bandwidth(&pair, send_buffer, recv_buffer,
+                                                  message_size, iterations, 1);
+    }
+
+    // Run the unidirectional bandwidth test on all pairs at once and add up
+    // the bandwidth the initiators measured
+    MPI_Barrier(MPI_COMM_WORLD);
+    double pair_bandwidth = measure_bandwidth(&pair, send_buffer, recv_buffer,
+                                              message_size, iterations, 0);
+    if (!pair.is_initiator) {
+      pair_bandwidth = 0;
+    }
+    double multi_pair_bandwidth;
+    MPI_Reduce(&pair_bandwidth, &multi_pair_bandwidth, 1, MPI_DOUBLE, MPI_SUM, 0,
+               MPI_COMM_WORLD);
+
+    if (world_rank == 0) {
+      printf("%10d", message_size);
+      int mode;
+      for (mode = 0; mode < NUM_LATENCY_MODES; mode++) {
+        printf(" %15.3f", latencies[mode]);
+      }
+      printf(" %15.3f %15.3f %15.3f\n", bandwidth, bidirectional_bandwidth,
+             multi_pair_bandwidth);
+      fflush(stdout);
+    }
+
+    // Stop before overflowing the message size
+    if (message_size > max_message_size / 2) {
+      break;
+    }
+  }
+
+  free(send_buffer);
+  free(recv_buffer);
+  MPI_Comm_free(&pair.pair_comm);
+  MPI_Finalize();
+}
@@ -0,0 +1,105 @@
+// Author: Wes Kendall
+// Copyright 2013 www.mpitutorial.com
+// This code is provided freely with the tutorials on mpitutorial.com. Feel
+// free to modify it for your own use. Any distribution of the code must
+// either provide a link to www.mpitutorial.com or keep this header intact.
+//
+// Comparison of sorting numbers for TMPI_Rank with qsort and with the radix
+// sort in radix_sort.c
+//
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <mpi.h>
+#include <assert.h>
+#include "radix_sort.h"
+
+// The struct and comparison function that TMPI_Rank sorted with qsort before
+// it used the radix sort. The number is kept along with its owner.
+typedef struct {
+  unsigned long long key;
+  int comm_rank;
+  int index;
+} CommRankNumber;
+
+int compare_comm_rank_number(const void *a, const void *b) {
+  CommRankNumber *comm_rank_number_a = (CommRankNumber *)a;
+  CommRankNumber *comm_rank_number_b = (CommRankNumber *)b;
+  if (comm_rank_number_a->key != comm_rank_number_b->key) {
+    return comm_rank_number_a->key < comm_rank_number_b->key ? -1 : 1;
+  } else if (comm_rank_number_a->comm_rank != comm_rank_number_b->comm_rank) {
+    return comm_rank_number_a->comm_rank < comm_rank_number_b->comm_rank ? -1 : 1;
+  } else if (comm_rank_number_a->index != comm_rank_number_b->index) {
+    return comm_rank_number_a->index < comm_rank_number_b->index ? -1 : 1;
+  } else {
+    return 0;
+  }
+}
+
+// Creates random keys the same way TMPI_Rank creates keys for random floats
+// between 0 and 1. The owners are in ascending order like in TMPI_Rank.
+void create_random_keys(unsigned long long *keys, unsigned long long *owners,
+                        int count) {
+  int i;
+  for (i = 0; i < count; i++) {
+    double number = (float)(rand() / (float)RAND_MAX);
+    unsigned long long bits;
+    memcpy(&bits, &number, sizeof(bits));
+    keys[i] = bits | 0x8000000000000000ULL;
+    owners[i] = i;
+  }
+}
+
+int main(int argc, char** argv) {
+  if (argc != 2) {
+    fprintf(stderr, "Usage: compare_sort max_num_elements\n");
+    exit(1);
+  }
+
+  int max_num_elements = atoi(argv[1]);
+
+  // The sort uses threads, but only the main thread calls MPI
+  int provided;
+  MPI_Init_thread(NULL, NULL, MPI_THREAD_FUNNELED, &provided);
+
+  int num_elements;
+  for (num_elements = 10000; num_elements <= max_num_elements; num_elements *= 10) {
+    unsigned long long *keys = malloc(sizeof(unsigned long long) * num_elements);
+    unsigned long long *owners = malloc(sizeof(unsigned long long) * num_elements);
+    CommRankNumber *comm_rank_numbers = malloc(sizeof(CommRankNumber) * num_elements);
+    assert(keys != NULL && owners != NULL && comm_rank_numbers != NULL);
+    create_random_keys(keys, owners, num_elements);
+    int i;
+    for (i = 0; i < num_elements; i++) {
+      comm_rank_numbers[i].key = keys[i];
+      comm_rank_numbers[i].comm_rank = 0;
+      comm_rank_numbers[i].index = i;
+    }
+
+    // Time qsort
+    double qsort_time = -MPI_Wtime();
+    qsort(comm_rank_numbers, num_elements, sizeof(CommRankNumber),
+          &compare_comm_rank_number);
+    qsort_time += MPI_Wtime();
+
+    // Time the radix sort
+    double radix_sort_time = -MPI_Wtime();
+    radix_sort_key_values(keys, owners, num_elements);
+    radix_sort_time += MPI_Wtime();
+
+    // Make sure both sorts produced the same order
+    for (i = 0; i < num_elements; i++) {
+      assert(keys[i] == comm_rank_numbers[i].key &&
+             owners[i] == (unsigned long long)comm_rank_numbers[i].index);
+    }
+
+    printf("Elements = %d, qsort time = %lf, radix sort time = %lf\n",
+           num_elements, qsort_time, radix_sort_time);
+
+    free(keys);
+    free(owners);
+    free(comm_rank_numbers);
+  }
+
+  MPI_Finalize();
+}
@@ -0,0 +1,206 @@
+// Author: Wes Kendall
+// Copyright 2013 www.mpitutorial.com
+// This code is provided freely with the tutorials on mpitutorial.com. Feel
+// free to modify it for your own use. Any distribution of the code must
+// either provide a link to www.mpitutorial.com or keep this header intact.
+//
+// An LSD radix sort of unsigned 64-bit keys that carries a value array along
+// with the keys. Keys and values are kept in separate arrays so that every
+// pass only streams through the memory it needs.
+//
+#include <stdlib.h>
+#include <string.h>
+#include "radix_sort.h"
+#ifdef _OPENMP
+#include <omp.h>
+#endif
+
+#define RADIX_BITS 8
+#define RADIX_BUCKETS (1 << RADIX_BITS)
+#define RADIX_PASSES (64 / RADIX_BITS)
+
+// Inputs with at least this many keys are sorted by all threads
+#define RADIX_SORT_PARALLEL_INPUT (1 << 16)
+
+// Sorts small inputs by key and then by value. The comparisons are written out
+// directly instead of going through a comparison function like qsort, which
+// lets the compiler inline them.
+static void insertion_sort_key_values(unsigned long long *keys, unsigned long long *values,
+                                      int count) {
+  int i;
+  for (i = 1; i < count; i++) {
+    unsigned long long key = keys[i];
+    unsigned long long value = values[i];
+    int j = i - 1;
+    while (j >= 0 && (keys[j] > key || (keys[j] == key && values[j] > value))) {
+      keys[j + 1] = keys[j];
+      values[j + 1] = values[j];
+      j--;
+    }
+    keys[j + 1] = key;
+    values[j + 1] = value;
+  }
+}
+
+// Returns the amount of threads that sort an input of count keys. Small inputs
+// are sorted by one thread.
+static int get_num_sort_threads(int count) {
+#ifdef _OPENMP
+  if (count >= RADIX_SORT_PARALLEL_INPUT) {
+    return omp_get_max_threads();
+  }
+#endif
+  return 1;
+}
+
+// Returns the amount of threads in the calling parallel region
+static int get_team_size() {
+#ifdef _OPENMP
+  return omp_get_num_threads();
+#else
+  return 1;
+#endif
+}
+
+// Returns the number of the calling thread
+static int get_thread_num() {
+#ifdef _OPENMP
+  return omp_get_thread_num();
+#else
+  return 0;
+#endif
+}
+
+// Gets the range of keys that a thread counts and scatters. Every thread gets
+// a contiguous part of the keys.
+static void get_thread_range(int thread, int num_threads, int count, int *start,
+                             int *end) {
+  *start = (long long)count * thread / num_threads;
+  *end = (long long)count * (thread + 1) / num_threads;
+}
+
+// Sorts the keys in ascending order and moves every value along with its key.
+// The radix sort is stable, so keys that are equal keep the order they had in the
+// input. Callers that need equal keys ordered by value must pass them in that order
+// (small inputs are always ordered by value). Large inputs are sorted by all
+// threads. Every thread counts and scatters its own part of the keys, and the
+// keys of a digit from one thread are placed after the ones from the threads
+// before it, so the result is the same as with one thread.
+void radix_sort_key_values(unsigned long long *keys, unsigned long long *values,
+                           int count) {
+  if (count <= RADIX_SORT_SMALL_INPUT) {
+    insertion_sort_key_values(keys, values, count);
+    return;
+  }
+  int num_threads = get_num_sort_threads(count);
+  size_t (*digit_counts)[RADIX_PASSES][RADIX_BUCKETS] = NULL;
+  size_t digit_totals[RADIX_PASSES][RADIX_BUCKETS];
+  int skip_pass[RADIX_PASSES];
+  int num_passes = 0;
+  unsigned long long *key_buffer = malloc(sizeof(unsigned long long) * count);
+  unsigned long long *value_buffer = malloc(sizeof(unsigned long long) * count);
+#pragma omp parallel num_threads(num_threads)
+  {
+    // The system may start fewer threads than were asked for (for example
+    // with OMP_THREAD_LIMIT), so the keys are split among the threads that
+    // actually run
+#pragma omp single
+    {
+      num_threads = get_team_size();
+      digit_counts = calloc(num_threads, sizeof(*digit_counts));
+    }
+    int thread = get_thread_num();
+    int start, end;
+    get_thread_range(thread, num_threads, count, &start, &end);
+
+    // Count the digits of every pass in one read of the keys
+    int i, pass;
+    for (i = start; i < end; i++) {
+      unsigned long long key = keys[i];
+      for (pass = 0; pass < RADIX_PASSES; pass++) {
+        digit_counts[thread][pass][(key >> (pass * RADIX_BITS)) & (RADIX_BUCKETS - 1)]++;
+      }
+    }
+#pragma omp barrier
+
+    // Sum the counts of the threads. Skip a pass when every key has the same
+    // digit. This is common since the order keys of ints and floats leave many
+    // bits constant.
+#pragma omp single
+    for (pass = 0; pass < RADIX_PASSES; pass++) {
+      skip_pass[pass] = 0;
+      int digit, other;
+      for (digit = 0; digit < RADIX_BUCKETS; digit++) {
+        digit_totals[pass][digit] = 0;
+        for (other = 0; other < num_threads; other++) {
+          digit_totals[pass][digit] += digit_counts[other][pass][digit];
+        }
+        if (digit_totals[pass][digit] == (size_t)count) {
+          skip_pass[pass] = 1;
+        }
+      }
+      num_passes += !skip_pass[pass];
+    }
+
+    unsigned long long *src_keys = keys, *src_values = values;
+    unsigned long long *dst_keys = key_buffer, *dst_values = value_buffer;
+    int first_pass = 1;
+    for (pass = 0; pass < RADIX_PASSES; pass++) {
+      if (skip_pass[pass]) {
+        continue;
+      }
+      int shift = pass * RADIX_BITS;
+
+      // The keys of a thread's range change with every pass, so the counts from
+      // the first read only hold for the first pass that is not skipped
+      if (!first_pass && num_threads > 1) {
+        size_t *counts = digit_counts[thread][pass];
+        memset(counts, 0, sizeof(size_t) * RADIX_BUCKETS);
+        for (i = start; i < end; i++) {
+          counts[(src_keys[i] >> shift) & (RADIX_BUCKETS - 1)]++;
+        }
+#pragma omp barrier
+      }
+      first_pass = 0;
+
+      // The keys of a digit go after the keys of smaller digits and after the
+      // keys of the same digit from earlier threads
+      size_t offsets[RADIX_BUCKETS];
+      size_t offset = 0;
+      int digit, other;
+      for (digit = 0; digit < RADIX_BUCKETS; digit++) {
+        offsets[digit] = offset;
+        for (other = 0; other < thread; other++) {
+          offsets[digit] += digit_counts[other][pass][digit];
+        }
+        offset += digit_totals[pass][digit];
+      }
+
+      // Scatter the keys and values to their positions for this digit
+      for (i = start; i < end; i++) {
+        size_t position = offsets[(src_keys[i] >> shift) & (RADIX_BUCKETS - 1)]++;
+        dst_keys[position] = src_keys[i];
+        dst_values[position] = src_values[i];
+      }
+
+      unsigned long long *swap = src_keys;
+      src_keys = dst_keys;
+      dst_keys = swap;
+      swap = src_values;
+      src_values = dst_values;
+      dst_values = swap;
+      // The next pass reads keys that other threads wrote
+#pragma omp barrier
+    }
+  }
+
+  // Copy the result back if the last pass left it in the buffers
+  if (num_passes % 2 == 1) {
+    memcpy(keys, key_buffer, sizeof(unsigned long long) * count);
+    memcpy(values, value_buffer, sizeof(unsigned long long) * count);
+  }
+
+  free(digit_counts);
+  free(key_buffer);
+  free(value_buffer);
+}
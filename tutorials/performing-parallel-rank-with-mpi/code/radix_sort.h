@@ -0,0 +1,18 @@
+// Author: Wes Kendall
+// Copyright 2013 www.mpitutorial.com
+// This code is provided freely with the tutorials on mpitutorial.com. Feel
+// free to modify it for your own use. Any distribution of the code must
+// either provide a link to www.mpitutorial.com or keep this header intact.
+//
+// Header file for the local sort used by TMPI_Rank
+//
+#ifndef __RADIX_SORT_H
+#define __RADIX_SORT_H 1
+
+// Inputs with at most this many keys are sorted with an insertion sort
+#define RADIX_SORT_SMALL_INPUT 64
+
+void radix_sort_key_values(unsigned long long *keys, unsigned long long *values,
+                           int count);
+
+#endif
@@ -10,20 +10,29 @@
 #include <stdlib.h>
 #include <mpi.h>
 #include "tmpi_rank.h"
-#include <time.h>
+#include "tmpi_random.h"
 
 int main(int argc, char** argv) {
-  MPI_Init(NULL, NULL);
+  if (argc > 2) {
+    fprintf(stderr, "Usage: random_rank [seed]\n");
+    exit(1);
+  }
+  unsigned long long seed = argc == 2 ? strtoull(argv[1], NULL, 10) :
+    TMPI_RANDOM_DEFAULT_SEED;
+
+  // The sort uses threads, but only the main thread calls MPI
+  int provided;
+  MPI_Init_thread(NULL, NULL, MPI_THREAD_FUNNELED, &provided);
 
   int world_rank;
   MPI_Comm_rank(MPI_COMM_WORLD, &world_rank);
   int world_size;
   MPI_Comm_size(MPI_COMM_WORLD, &world_size);
 
-  // Seed the random number generator to get different results each time
-  srand(time(NULL) * world_rank);
-
-  float rand_num = rand() / (float)RAND_MAX;
+  // Every process takes the number at its rank from the same random stream, so
+  // the numbers only depend on the seed
+  float rand_num;
+  TMPI_Random_fill_float(seed, 0, world_rank, &rand_num, 1);
   int rank;
   TMPI_Rank(&rand_num, &rank, MPI_FLOAT, MPI_COMM_WORLD);
   printf("Rank for %f on process %d - %d\n", rand_num, world_rank, rank);
@@ -0,0 +1,163 @@
+// Author: Wes Kendall
+// Copyright 2014 www.mpitutorial.com
+// This code is provided freely with the tutorials on mpitutorial.com. Feel
+// free to modify it for your own use. Any distribution of the code must
+// either provide a link to www.mpitutorial.com or keep this header intact.
+//
+// A counter-based random number generator (Philox4x32-10). Instead of
+// updating a hidden state like rand(), every block of four random words is
+// computed from its position in the stream. Any part of a stream can be
+// generated without generating the parts before it, and blocks can be
+// generated independently of each other.
+//
+#include "tmpi_random.h"
+
+// The multipliers and key increments of Philox4x32
+#define PHILOX_M0 0xD2511F53U
+#define PHILOX_M1 0xCD9E8D57U
+#define PHILOX_W0 0x9E3779B9U
+#define PHILOX_W1 0xBB67AE85U
+#define PHILOX_ROUNDS 10
+
+// The amount of blocks the fill functions generate at a time
+#define TMPI_RANDOM_BATCH_SIZE 16
+
+// Generates num_blocks blocks of a stream starting at first_block. The four
+// words of block b are stored in words[4 * b] to words[4 * b + 3]. The rounds
+// go over all blocks of the batch in loops without branches so that the
+// compiler can vectorize them.
+static void philox_blocks(const uint32_t key[2], uint64_t stream,
+                          uint64_t first_block, int num_blocks,
+                          uint32_t *words) {
+  uint32_t c0[TMPI_RANDOM_BATCH_SIZE], c1[TMPI_RANDOM_BATCH_SIZE];
+  uint32_t c2[TMPI_RANDOM_BATCH_SIZE], c3[TMPI_RANDOM_BATCH_SIZE];
+  int b;
+  // The counter of a block is its index in the lower words and the stream in
+  // the upper words
+  for (b = 0; b < num_blocks; b++) {
+    c0[b] = (uint32_t)(first_block + b);
+    c1[b] = (uint32_t)((first_block + b) >> 32);
+    c2[b] = (uint32_t)stream;
+    c3[b] = (uint32_t)(stream >> 32);
+  }
+
+  uint32_t k0 = key[0], k1 = key[1];
+  int round;
+  for (round = 0; round < PHILOX_ROUNDS; round++) {
+    for (b = 0; b < num_blocks; b++) {
+      uint64_t product0 = (uint64_t)PHILOX_M0 * c0[b];
+      uint64_t product1 = (uint64_t)PHILOX_M1 * c2[b];
+      uint32_t x0 = (uint32_t)(product1 >> 32) ^ c1[b] ^ k0;
+      uint32_t x2 = (uint32_t)(product0 >> 32) ^ c3[b] ^ k1;
+      c1[b] = (uint32_t)product1;
+      c3[b] = (uint32_t)product0;
+      c0[b] = x0;
+      c2[b] = x2;
+    }
+    k0 += PHILOX_W0;
+    k1 += PHILOX_W1;
+  }
+
+  for (b = 0; b < num_blocks; b++) {
+    words[4 * b] = c0[b];
+    words[4 * b + 1] = c1[b];
+    words[4 * b + 2] = c2[b];
+    words[4 * b + 3] = c3[b];
+  }
+}
+
+// Converts a random word to a float in [0, 1). Only the upper 24 bits are
+// used so that the result is exact and never rounds up to one.
+static float word_to_float(uint32_t word) {
+  return (word >> 8) * (1.0f / 16777216.0f);
+}
+
+// Converts two random words to a double in [0, 1) using 53 bits
+static double words_to_double(uint32_t low, uint32_t high) {
+  uint64_t bits = ((uint64_t)high << 32) | low;
+  return (bits >> 11) * (1.0 / 9007199254740992.0);
+}
+
+void TMPI_Random_init(TMPI_Random *random, uint64_t seed, uint64_t stream) {
+  random->key[0] = (uint32_t)seed;
+  random->key[1] = (uint32_t)(seed >> 32);
+  random->stream = stream;
+  random->block = 0;
+  random->num_words_used = 4;
+}
+
+uint32_t TMPI_Random_uint32(TMPI_Random *random) {
+  if (random->num_words_used == 4) {
+    philox_blocks(random->key, random->stream, random->block, 1, random->words);
+    random->block++;
+    random->num_words_used = 0;
+  }
+  return random->words[random->num_words_used++];
+}
+
+float TMPI_Random_float(TMPI_Random *random) {
+  return word_to_float(TMPI_Random_uint32(random));
+}
+
+int TMPI_Random_int(TMPI_Random *random, int max) {
+  // Scale instead of taking the remainder so that the upper bits are used
+  return (int)(((uint64_t)TMPI_Random_uint32(random) * (uint32_t)max) >> 32);
+}
+
+// Generates words first_word to first_word + count - 1 of a stream, one batch
+// of blocks at a time, and passes each batch to convert along with the index
+// of its first word relative to first_word.
+static void fill_words(uint64_t seed, uint64_t stream, long long first_word,
+                       long long count, void *data,
+                       void (*convert)(const uint32_t *words, long long index,
+                                       int num_words, void *data)) {
+  uint32_t key[2] = {(uint32_t)seed, (uint32_t)(seed >> 32)};
+  uint32_t words[4 * TMPI_RANDOM_BATCH_SIZE];
+  uint64_t block = first_word / 4;
+  // Words before first_word in the first block are skipped
+  int skip = first_word % 4;
+  long long index = 0;
+  while (index < count) {
+    long long blocks_left = (count - index + skip + 3) / 4;
+    int num_blocks = blocks_left < TMPI_RANDOM_BATCH_SIZE ?
+      (int)blocks_left : TMPI_RANDOM_BATCH_SIZE;
+    philox_blocks(key, stream, block, num_blocks, words);
+    int num_words = 4 * num_blocks - skip;
+    if (num_words > count - index) {
+      num_words = count - index;
+    }
+    convert(words + skip, index, num_words, data);
+    index += num_words;
+    block += num_blocks;
+    skip = 0;
+  }
+}
+
+static void convert_floats(const uint32_t *words, long long index,
+                           int num_words, void *data) {
+  float *floats = (float *)data + index;
+  int i;
+  for (i = 0; i < num_words; i++) {
+    floats[i] = word_to_float(words[i]);
+  }
+}
+
+// Doubles use two words, so index and num_words are always even
+static void convert_doubles(const uint32_t *words, long long index,
+                            int num_words, void *data) {
+  double *doubles = (double *)data + index / 2;
+  int i;
+  for (i = 0; i < num_words / 2; i++) {
+    doubles[i] = words_to_double(words[2 * i], words[2 * i + 1]);
+  }
+}
+
+void TMPI_Random_fill_float(uint64_t seed, uint64_t stream, long long first,
+                            float *data, long long count) {
+  fill_words(seed, stream, first, count, data, &convert_floats);
+}
+
+void TMPI_Random_fill_double(uint64_t seed, uint64_t stream, long long first,
+                             double *data, long long count) {
+  fill_words(seed, stream, 2 * first, 2 * count, data, &convert_doubles);
+}
@@ -9,129 +9,385 @@
 #include <stdlib.h>
 #include <mpi.h>
 #include <string.h>
+#include "tmpi_rank.h"
+#include "radix_sort.h"
 
-// Holds the communicator rank of a process along with the corresponding number.
-// This struct is used for sorting the values and keeping the owning process information
-// intact.
+// The amount of evenly spaced samples each process contributes when choosing
+// the splitters for the sample sort. More samples give better balanced
+// buckets at the cost of a larger MPI_Allgatherv.
+#define TMPI_RANK_SAMPLES_PER_PROC 32
+
+// Holds a computed rank along with the index of the number it belongs to. This
+// is what gets sent back to the process that owns the number.
 typedef struct {
-  int comm_rank;
-  union {
-    float f;
-    int i;
-  } number;
-} CommRankNumber;
-
-// Gathers numbers for TMPI_Rank to process zero. Allocates enough space given the MPI datatype and
-// returns a void * buffer to process 0. It returns NULL to all other processes.
-void *gather_numbers_to_root(void *number, MPI_Datatype datatype, MPI_Comm comm) {
-  int comm_rank, comm_size;
-  MPI_Comm_rank(comm, &comm_rank);
-  MPI_Comm_size(comm, &comm_size);
+  long long rank;
+  int index;
+} IndexRank;
 
-  // Allocate an array on the root process of a size depending on the MPI datatype being used.
-  int datatype_size;
-  MPI_Type_size(datatype, &datatype_size);
-  void *gathered_numbers;
-  if (comm_rank == 0) {
-    gathered_numbers = malloc(datatype_size * comm_size);
+// Functions that convert a number to an unsigned key with the same ordering as the
+// number itself. Signed integers have their sign bit flipped so that negative numbers
+// come first. Floating point numbers have all bits flipped when they are negative
+// (larger magnitudes are smaller numbers) and only the sign bit flipped otherwise.
+unsigned long long TMPI_Signed_order_key(long long number) {
+  return (unsigned long long)number ^ 0x8000000000000000ULL;
+}
+
+unsigned long long TMPI_Double_order_key(double number) {
+  unsigned long long bits;
+  memcpy(&bits, &number, sizeof(bits));
+  return (bits & 0x8000000000000000ULL) ? ~bits : bits | 0x8000000000000000ULL;
+}
+
+unsigned long long int_order_key(const void *number) {
+  return TMPI_Signed_order_key(*(int *)number);
+}
+
+unsigned long long long_order_key(const void *number) {
+  return TMPI_Signed_order_key(*(long *)number);
+}
+
+unsigned long long long_long_order_key(const void *number) {
+  return TMPI_Signed_order_key(*(long long *)number);
+}
+
+unsigned long long unsigned_order_key(const void *number) {
+  return *(unsigned *)number;
+}
+
+unsigned long long unsigned_long_order_key(const void *number) {
+  return *(unsigned long *)number;
+}
+
+unsigned long long unsigned_long_long_order_key(const void *number) {
+  return *(unsigned long long *)number;
+}
+
+unsigned long long float_order_key(const void *number) {
+  // Every float is exactly representable as a double
+  return TMPI_Double_order_key(*(float *)number);
+}
+
+unsigned long long double_number_order_key(const void *number) {
+  return TMPI_Double_order_key(*(double *)number);
+}
+
+// Returns the function that creates order keys for the datatype, or NULL if
+// the datatype is not supported.
+unsigned long long (*get_order_key_function(MPI_Datatype datatype))(const void *) {
+  if (datatype == MPI_INT) {
+    return &int_order_key;
+  } else if (datatype == MPI_LONG) {
+    return &long_order_key;
+  } else if (datatype == MPI_LONG_LONG) {
+    return &long_long_order_key;
+  } else if (datatype == MPI_UNSIGNED) {
+    return &unsigned_order_key;
+  } else if (datatype == MPI_UNSIGNED_LONG) {
+    return &unsigned_long_order_key;
+  } else if (datatype == MPI_UNSIGNED_LONG_LONG) {
+    return &unsigned_long_long_order_key;
+  } else if (datatype == MPI_FLOAT) {
+    return &float_order_key;
+  } else if (datatype == MPI_DOUBLE) {
+    return &double_number_order_key;
   }
+  return NULL;
+}
 
-  // Gather all of the numbers on the root process
-  MPI_Gather(number, 1, datatype, gathered_numbers, 1, datatype, 0, comm);
+// Numbers are sorted as two separate arrays: the order keys of the numbers (see
+// get_order_key_function) and their owners. The owner of a number packs the
+// communicator rank of the process that owns it in the upper 32 bits and the
+// position of the number in that process's send buffer in the lower 32 bits.
+// Comparing owners therefore compares by process first and position second.
+unsigned long long make_owner(int comm_rank, int index) {
+  return ((unsigned long long)comm_rank << 32) | (unsigned)index;
+}
 
-  return gathered_numbers;
+int get_owner_comm_rank(unsigned long long owner) {
+  return (int)(owner >> 32);
 }
 
-// A comparison function for sorting float CommRankNumber values
-int compare_float_comm_rank_number(const void *a, const void *b) {
-  CommRankNumber *comm_rank_number_a = (CommRankNumber *)a;
-  CommRankNumber *comm_rank_number_b = (CommRankNumber *)b;
-  if (comm_rank_number_a->number.f < comm_rank_number_b->number.f) {
-    return -1;
-  } else if (comm_rank_number_a->number.f > comm_rank_number_b->number.f) {
-    return 1;
+int get_owner_index(unsigned long long owner) {
+  return (int)(owner & 0xFFFFFFFFULL);
+}
+
+// Compares two numbers by their keys. Ties between two equal numbers are broken by
+// their owners. This gives every number a unique place in the global order, so equal
+// numbers still receive distinct ranks no matter which process ends up sorting them.
+int compare_key_owner(unsigned long long key_a, unsigned long long owner_a,
+                      unsigned long long key_b, unsigned long long owner_b) {
+  if (key_a != key_b) {
+    return key_a < key_b ? -1 : 1;
+  } else if (owner_a != owner_b) {
+    return owner_a < owner_b ? -1 : 1;
   } else {
     return 0;
   }
 }
 
-// A comparison function for sorting int CommRankNumber values
-int compare_int_comm_rank_number(const void *a, const void *b) {
-  CommRankNumber *comm_rank_number_a = (CommRankNumber *)a;
-  CommRankNumber *comm_rank_number_b = (CommRankNumber *)b;
-  if (comm_rank_number_a->number.i < comm_rank_number_b->number.i) {
-    return -1;
-  } else if (comm_rank_number_a->number.i > comm_rank_number_b->number.i) {
-    return 1;
-  } else {
-    return 0;
+// Creates the keys and owners of the numbers of this process and sorts them.
+// Attaching the owner to every number lets us send the rank back to the process
+// that owns it once the global order is known. If a key function is given, it is
+// used to get the key of every element instead of the datatype. The owners are
+// created in ascending order, so the stable radix sort breaks ties by owner.
+void create_sorted_keys(void *numbers, int count, MPI_Datatype datatype,
+                        TMPI_Key_function key_function, MPI_Comm comm,
+                        unsigned long long **keys, unsigned long long **owners) {
+  int comm_rank;
+  MPI_Comm_rank(comm, &comm_rank);
+  // Use the extent so that elements of derived datatypes are stepped over correctly
+  MPI_Aint lower_bound, datatype_extent;
+  MPI_Type_get_extent(datatype, &lower_bound, &datatype_extent);
+  unsigned long long (*order_key)(const void *) = get_order_key_function(datatype);
+
+  *keys = malloc((count + 1) * sizeof(unsigned long long));
+  *owners = malloc((count + 1) * sizeof(unsigned long long));
+  int i;
+  for (i = 0; i < count; i++) {
+    const void *number = (char *)numbers + i * datatype_extent;
+    (*keys)[i] = key_function ? key_function(number) : order_key(number);
+    (*owners)[i] = make_owner(comm_rank, i);
   }
+  radix_sort_key_values(*keys, *owners, count);
 }
 
-// This function sorts the gathered numbers on the root process and returns an array of
-// ordered by the process's rank in its communicator. Note - this function is only
-// executed on the root process.
-int *get_ranks(void *gathered_numbers, int gathered_number_count, MPI_Datatype datatype) {
-  int datatype_size;
-  MPI_Type_size(datatype, &datatype_size);
+// Chooses the comm_size - 1 splitters of the sample sort. Every process takes evenly
+// spaced samples from its sorted numbers, the samples are gathered to all processes,
+// and the splitters are then picked evenly from the sorted samples. Every process
+// computes the same splitters, so no process has to act as a root. The amount of
+// splitters is returned in splitter_count.
+void choose_splitters(unsigned long long *sorted_keys, unsigned long long *sorted_owners,
+                      int count, MPI_Comm comm, unsigned long long **splitter_keys,
+                      unsigned long long **splitter_owners, int *splitter_count) {
+  int comm_size;
+  MPI_Comm_size(comm, &comm_size);
 
-  // Convert the gathered number array to an array of CommRankNumbers. This allows us to
-  // sort the numbers and also keep the information of the processes that own the numbers
-  // intact.
-  CommRankNumber *comm_rank_numbers = malloc(gathered_number_count * sizeof(CommRankNumber));
+  // Take evenly spaced samples from the local numbers
+  int sample_count = count < TMPI_RANK_SAMPLES_PER_PROC ? count : TMPI_RANK_SAMPLES_PER_PROC;
+  unsigned long long *sample_keys = malloc((sample_count + 1) * sizeof(unsigned long long));
+  unsigned long long *sample_owners = malloc((sample_count + 1) * sizeof(unsigned long long));
   int i;
-  for (i = 0; i < gathered_number_count; i++) {
-    comm_rank_numbers[i].comm_rank = i;
-    memcpy(&(comm_rank_numbers[i].number), gathered_numbers + (i * datatype_size), datatype_size);
+  for (i = 0; i < sample_count; i++) {
+    sample_keys[i] = sorted_keys[(long long)i * count / sample_count];
+    sample_owners[i] = sorted_owners[(long long)i * count / sample_count];
   }
 
-  // Sort the comm rank numbers based on the datatype
-  if (datatype == MPI_FLOAT) {
-    qsort(comm_rank_numbers, gathered_number_count, sizeof(CommRankNumber), &compare_float_comm_rank_number);
-  } else {
-    qsort(comm_rank_numbers, gathered_number_count, sizeof(CommRankNumber), &compare_int_comm_rank_number);
+  // Gather the samples of every process on every process. The samples arrive
+  // ordered by process and sorted within each process, so equal keys are
+  // already ordered by owner for the radix sort.
+  int *sample_counts = malloc(comm_size * sizeof(int));
+  int *sample_offsets = malloc(comm_size * sizeof(int));
+  MPI_Allgather(&sample_count, 1, MPI_INT, sample_counts, 1, MPI_INT, comm);
+  int total_sample_count = 0;
+  for (i = 0; i < comm_size; i++) {
+    sample_offsets[i] = total_sample_count;
+    total_sample_count += sample_counts[i];
   }
+  unsigned long long *all_sample_keys =
+    malloc((total_sample_count + 1) * sizeof(unsigned long long));
+  unsigned long long *all_sample_owners =
+    malloc((total_sample_count + 1) * sizeof(unsigned long long));
+  MPI_Allgatherv(sample_keys, sample_count, MPI_UNSIGNED_LONG_LONG, all_sample_keys,
+                 sample_counts, sample_offsets, MPI_UNSIGNED_LONG_LONG, comm);
+  MPI_Allgatherv(sample_owners, sample_count, MPI_UNSIGNED_LONG_LONG, all_sample_owners,
+                 sample_counts, sample_offsets, MPI_UNSIGNED_LONG_LONG, comm);
+  radix_sort_key_values(all_sample_keys, all_sample_owners, total_sample_count);
 
-  // Now that the comm_rank_numbers are sorted, create an array of rank values for each process. The ith
-  // element of this array contains the rank value for the number sent by process i.
-  int *ranks = (int *)malloc(sizeof(int) * gathered_number_count);
-  for (i = 0; i < gathered_number_count; i++) {
-    ranks[comm_rank_numbers[i].comm_rank] = i;
+  // Pick the splitters evenly from the sorted samples. If there are no
+  // samples at all, there is nothing to split and every bucket is empty.
+  *splitter_count = total_sample_count > 0 ? comm_size - 1 : 0;
+  *splitter_keys = malloc((*splitter_count + 1) * sizeof(unsigned long long));
+  *splitter_owners = malloc((*splitter_count + 1) * sizeof(unsigned long long));
+  for (i = 0; i < *splitter_count; i++) {
+    long long sample = (long long)(i + 1) * total_sample_count / comm_size;
+    (*splitter_keys)[i] = all_sample_keys[sample];
+    (*splitter_owners)[i] = all_sample_owners[sample];
   }
 
-  // Clean up and return the rank array
-  free(comm_rank_numbers);
-  return ranks;
+  free(sample_keys);
+  free(sample_owners);
+  free(sample_counts);
+  free(sample_offsets);
+  free(all_sample_keys);
+  free(all_sample_owners);
 }
 
-// Gets the rank of the send_data, which is of type datatype. The rank is returned
-// in recv_data and is of type datatype.
-int TMPI_Rank(void *send_data, void *recv_data, MPI_Datatype datatype, MPI_Comm comm) {
-  // Check base cases first - Only support MPI_INT and MPI_FLOAT for this function.
-  if (datatype != MPI_INT && datatype != MPI_FLOAT) {
-    return MPI_ERR_TYPE;
+// Counts how many of the sorted numbers go to each process. Process i receives the
+// numbers between splitters i - 1 and i. Since the numbers are sorted, one pass
+// over the numbers and the splitters is enough.
+int *get_send_counts(unsigned long long *sorted_keys, unsigned long long *sorted_owners,
+                     int count, unsigned long long *splitter_keys,
+                     unsigned long long *splitter_owners, int splitter_count,
+                     MPI_Comm comm) {
+  int comm_size;
+  MPI_Comm_size(comm, &comm_size);
+
+  int *send_counts = calloc(comm_size, sizeof(int));
+  int bucket = 0;
+  int i;
+  for (i = 0; i < count; i++) {
+    while (bucket < splitter_count &&
+           compare_key_owner(sorted_keys[i], sorted_owners[i], splitter_keys[bucket],
+                             splitter_owners[bucket]) >= 0) {
+      bucket++;
+    }
+    send_counts[bucket]++;
+  }
+  return send_counts;
+}
+
+// Given an array (of size "size") of counts, return the prefix sum of the
+// counts.
+int *prefix_sum(int *counts, int size) {
+  int *prefix_sum_result = malloc(sizeof(int) * size);
+  prefix_sum_result[0] = 0;
+  int i;
+  for (i = 1; i < size; i++) {
+    prefix_sum_result[i] = prefix_sum_result[i - 1] + counts[i - 1];
   }
+  return prefix_sum_result;
+}
 
-  int comm_size, comm_rank;
+// Ranks count numbers of type datatype on every process with a distributed sample
+// sort. The numbers are split into comm_size buckets, each bucket is sent to one
+// process with MPI_Alltoallv and sorted there, and a prefix scan over the bucket
+// sizes turns the local positions into global ranks. The ranks are then sent back
+// to the owning processes with a second MPI_Alltoallv. No process ever holds more
+// than its bucket of numbers.
+void sample_sort_ranks(void *numbers, int count, MPI_Datatype datatype,
+                       TMPI_Key_function key_function, long long *ranks, MPI_Comm comm) {
+  int comm_size;
   MPI_Comm_size(comm, &comm_size);
-  MPI_Comm_rank(comm, &comm_rank);
 
-  // To calculate the rank, we must gather the numbers to one process, sort the numbers, and then
-  // scatter the resulting rank values. Start by gathering the numbers on process 0 of comm.
-  void *gathered_numbers = gather_numbers_to_root(send_data, datatype, comm);
+  // Create the datatype used to send IndexRanks
+  MPI_Datatype index_rank_type;
+  MPI_Type_contiguous(sizeof(IndexRank), MPI_BYTE, &index_rank_type);
+  MPI_Type_commit(&index_rank_type);
+
+  // Sort the local numbers and choose which process owns which part of the
+  // global order
+  unsigned long long *sorted_keys, *sorted_owners;
+  create_sorted_keys(numbers, count, datatype, key_function, comm, &sorted_keys,
+                     &sorted_owners);
+  unsigned long long *splitter_keys, *splitter_owners;
+  int splitter_count;
+  choose_splitters(sorted_keys, sorted_owners, count, comm, &splitter_keys,
+                   &splitter_owners, &splitter_count);
+
+  // Find out how many numbers go to and come from every process
+  int *send_counts = get_send_counts(sorted_keys, sorted_owners, count, splitter_keys,
+                                     splitter_owners, splitter_count, comm);
+  int *recv_counts = malloc(comm_size * sizeof(int));
+  MPI_Alltoall(send_counts, 1, MPI_INT, recv_counts, 1, MPI_INT, comm);
+  int *send_offsets = prefix_sum(send_counts, comm_size);
+  int *recv_offsets = prefix_sum(recv_counts, comm_size);
+  int bucket_count = recv_offsets[comm_size - 1] + recv_counts[comm_size - 1];
+
+  // Send every number to the process that owns its bucket and sort the bucket.
+  // The bucket arrives ordered by process and sorted within each process, so
+  // equal keys are already ordered by owner for the radix sort.
+  unsigned long long *bucket_keys = malloc((bucket_count + 1) * sizeof(unsigned long long));
+  unsigned long long *bucket_owners = malloc((bucket_count + 1) * sizeof(unsigned long long));
+  MPI_Alltoallv(sorted_keys, send_counts, send_offsets, MPI_UNSIGNED_LONG_LONG,
+                bucket_keys, recv_counts, recv_offsets, MPI_UNSIGNED_LONG_LONG, comm);
+  MPI_Alltoallv(sorted_owners, send_counts, send_offsets, MPI_UNSIGNED_LONG_LONG,
+                bucket_owners, recv_counts, recv_offsets, MPI_UNSIGNED_LONG_LONG, comm);
+  radix_sort_key_values(bucket_keys, bucket_owners, bucket_count);
 
-  // Get the ranks of each process
-  int *ranks = NULL;
+  // The buckets are ordered by process, so the global rank of the first number
+  // in this bucket is the amount of numbers in the buckets of all lower processes
+  long long long_bucket_count = bucket_count;
+  long long rank_offset = 0;
+  MPI_Exscan(&long_bucket_count, &rank_offset, 1, MPI_LONG_LONG, MPI_SUM, comm);
+  int comm_rank;
+  MPI_Comm_rank(comm, &comm_rank);
   if (comm_rank == 0) {
-    ranks = get_ranks(gathered_numbers, comm_size, datatype);
+    // MPI_Exscan leaves the result undefined on the first process
+    rank_offset = 0;
   }
 
-  // Scatter the rank results
-  MPI_Scatter(ranks, 1, MPI_INT, recv_data, 1, MPI_INT, 0, comm);
+  // Group the ranks by the process owning the number. The amount of ranks going
+  // back to each process is the amount of numbers that were received from it.
+  IndexRank *rank_replies = malloc((bucket_count + 1) * sizeof(IndexRank));
+  int *reply_positions = prefix_sum(recv_counts, comm_size);
+  int i;
+  for (i = 0; i < bucket_count; i++) {
+    int position = reply_positions[get_owner_comm_rank(bucket_owners[i])]++;
+    rank_replies[position].index = get_owner_index(bucket_owners[i]);
+    rank_replies[position].rank = rank_offset + i;
+  }
+
+  // Send the ranks back to the owning processes and put them in place
+  IndexRank *my_ranks = malloc((count + 1) * sizeof(IndexRank));
+  MPI_Alltoallv(rank_replies, recv_counts, recv_offsets, index_rank_type,
+                my_ranks, send_counts, send_offsets, index_rank_type, comm);
+  for (i = 0; i < count; i++) {
+    ranks[my_ranks[i].index] = my_ranks[i].rank;
+  }
 
   // Do clean up
-  if (comm_rank == 0) {
-    free(gathered_numbers);
-    free(ranks);
+  MPI_Type_free(&index_rank_type);
+  free(sorted_keys);
+  free(sorted_owners);
+  free(splitter_keys);
+  free(splitter_owners);
+  free(send_counts);
+  free(recv_counts);
+  free(send_offsets);
+  free(recv_offsets);
+  free(bucket_keys);
+  free(bucket_owners);
+  free(rank_replies);
+  free(reply_positions);
+  free(my_ranks);
+}
+
+// Gets the rank of the send_data, which is of type datatype. The rank is returned
+// in recv_data and is of type MPI_INT.
+int TMPI_Rank(void *send_data, void *recv_data, MPI_Datatype datatype, MPI_Comm comm) {
+  // Check base cases first - Only support MPI_INT and MPI_FLOAT for this function.
+  if (datatype != MPI_INT && datatype != MPI_FLOAT) {
+    return MPI_ERR_TYPE;
+  }
+
+  // To calculate the rank, the numbers are sorted across all processes with a
+  // sample sort. Every process ends up with the rank of its own number without
+  // any process having to gather all of the numbers.
+  long long rank;
+  sample_sort_ranks(send_data, 1, datatype, NULL, &rank, comm);
+  *(int *)recv_data = (int)rank;
+  return MPI_SUCCESS;
+}
+
+// Gets the ranks of the count numbers in send_data, which are of type datatype.
+// The ranks are returned in recv_data, which must have room for count ranks.
+// Ranking all of the numbers of a process in one call takes the same amount of
+// collective calls as ranking a single number.
+int TMPI_Rank_many(void *send_data, int count, MPI_Datatype datatype,
+                   long long *recv_data, MPI_Comm comm) {
+  if (get_order_key_function(datatype) == NULL) {
+    return MPI_ERR_TYPE;
+  }
+  if (count < 0) {
+    return MPI_ERR_COUNT;
+  }
+  sample_sort_ranks(send_data, count, datatype, NULL, recv_data, comm);
+  return MPI_SUCCESS;
+}
+
+// Like TMPI_Rank_many, but the numbers are ranked by the key that key_function
+// returns for each element. This allows ranking elements of any datatype, such as
+// structs described by a derived datatype. The keys are compared as unsigned
+// 64-bit integers, so all 64 bits of integer keys keep their order.
+int TMPI_Rank_many_by_key(void *send_data, int count, MPI_Datatype datatype,
+                          TMPI_Key_function key_function, long long *recv_data,
+                          MPI_Comm comm) {
+  if (key_function == NULL) {
+    return MPI_ERR_ARG;
+  }
+  if (count < 0) {
+    return MPI_ERR_COUNT;
   }
+  sample_sort_ranks(send_data, count, datatype, key_function, recv_data, comm);
+  return MPI_SUCCESS;
 }
@@ -9,6 +9,25 @@
 #ifndef __PARALLEL_RANK_H
 #define __PARALLEL_RANK_H 1
 
+// Returns the key used to rank an element with TMPI_Rank_many_by_key. Elements
+// are ranked by comparing their keys as unsigned numbers. Keys of signed or
+// floating point numbers come from TMPI_Signed_order_key and
+// TMPI_Double_order_key, which keep the order of the numbers.
+typedef unsigned long long (*TMPI_Key_function)(const void *element);
+
+unsigned long long TMPI_Signed_order_key(long long number);
+
+unsigned long long TMPI_Double_order_key(double number);
+
 int TMPI_Rank(void *send_data, void *recv_data, MPI_Datatype datatype, MPI_Comm comm);
 
+// Supports MPI_INT, MPI_LONG, MPI_LONG_LONG, MPI_UNSIGNED, MPI_UNSIGNED_LONG,
+// MPI_UNSIGNED_LONG_LONG, MPI_FLOAT and MPI_DOUBLE.
+int TMPI_Rank_many(void *send_data, int count, MPI_Datatype datatype,
+                   long long *recv_data, MPI_Comm comm);
+
+int TMPI_Rank_many_by_key(void *send_data, int count, MPI_Datatype datatype,
+                          TMPI_Key_function key_function, long long *recv_data,
+                          MPI_Comm comm);
+
 #endif
@@ -5,164 +5,1083 @@
 // either provide a link to www.mpitutorial.com or keep this header intact.
 //
 // Example application of random walking using MPI_Send, MPI_Recv, and
-// MPI_Probe.
+// MPI_Probe. Passing --async runs the walk as a pipeline of non-blocking
+// sends and receives instead. Passing --detect-termination stops the walk as
+// soon as all walkers are finished instead of after a fixed amount of rounds.
+// Passing --balance splits the walkers among several rings of processes
+// during the walk when some processes walk much more than others.
 //
+// Walkers are sent with a committed MPI datatype instead of as bytes, and the
+// walker buffers are reused for every exchange. They only grow, so once they
+// fit the largest exchange no more memory is allocated. The amount of
+// allocations is printed at the end to verify it.
+//
+// When the program is built with OpenMP, large rounds are walked by all
+// threads of a process. Only the main thread calls MPI.
+//
+#include <algorithm>
 #include <iostream>
+#include <list>
+#include <memory>
+#include <new>
+#include <string>
 #include <vector>
+#include <cstddef>
 #include <cstdlib>
-#include <time.h>
 #include <mpi.h>
+#include "tmpi_random.h"
+#ifdef _OPENMP
+#include <omp.h>
+#endif
 
 using namespace std;
 
+// The amount of walkers sent in one message in async mode
+const int WALKER_CHUNK_SIZE = 1024;
+// The amount of receives that are posted at once in async mode
+const int NUM_RECV_BUFFERS = 4;
+// The amount of walkers that are walked at once
+const int WALK_BATCH_SIZE = 256;
+// Rounds with at least this many batches are walked by all threads
+const int WALK_PARALLEL_BATCHES = 64;
+// The amount of rounds between checking the load balance with --balance
+const int REBALANCE_INTERVAL = 2;
+// The domain is rebalanced when the rounds since the last check took this many
+// times as long as perfectly balanced rounds
+const double REBALANCE_THRESHOLD = 1.5;
+
 typedef struct {
   int location;
   int num_steps_left_in_walk;
 } Walker;
 
-void decompose_domain(int domain_size, int world_rank,
-                      int world_size, int* subdomain_start,
-                      int* subdomain_size) {
-  if (world_size > domain_size) {
-    // Don't worry about this special case. Assume the domain size
-    // is greater than the world size.
-    MPI_Abort(MPI_COMM_WORLD, 1);
+// The MPI datatype of a Walker, created by create_walker_datatype
+MPI_Datatype walker_datatype;
+
+// The amount of times memory was allocated for walkers on this process
+long long num_walker_allocations = 0;
+
+// The allocator of walker vectors. Unlike the standard allocator, it leaves
+// the new walkers of a vector that grows uninitialized, so that a receive
+// buffer is not filled with zeros right before MPI overwrites it. It also
+// counts the allocations.
+template <typename T>
+struct WalkerAllocator : public allocator<T> {
+  template <typename U>
+  struct rebind {
+    typedef WalkerAllocator<U> other;
+  };
+
+  WalkerAllocator() {}
+
+  template <typename U>
+  WalkerAllocator(const WalkerAllocator<U>& other) {}
+
+  T* allocate(size_t n) {
+    // Threads grow their own walker buffers at the same time
+#pragma omp atomic
+    num_walker_allocations++;
+    return allocator<T>::allocate(n);
   }
-  *subdomain_start = domain_size / world_size * world_rank;
-  *subdomain_size = domain_size / world_size;
-  if (world_rank == world_size - 1) {
-    // Give remainder to last process
-    *subdomain_size += domain_size % world_size;
+
+  void construct(T* p) {
+    ::new ((void*)p) T;
+  }
+
+  void construct(T* p, const T& value) {
+    ::new ((void*)p) T(value);
   }
+};
+
+typedef vector<Walker, WalkerAllocator<Walker> > WalkerVector;
+
+// The subdomains of all processes. The processes form num_lanes rings (lanes)
+// of num_segments processes each, and every lane splits the domain the same
+// way. Segment i holds the locations from starts[i] up to starts[i + 1], and
+// starts[num_segments] is the domain size. Process p walks segment
+// p % num_segments in lane p / num_segments. Every walker belongs to one lane,
+// so the walkers of one location can be walked by several processes.
+// Segments can be empty.
+typedef struct {
+  int domain_size;
+  int num_lanes;
+  int num_segments;
+  vector<int> starts;
+} Decomposition;
+
+// A batch of walkers stored as a struct of arrays, so that the walking kernel
+// works on contiguous locations and step counts
+typedef struct {
+  int locations[WALK_BATCH_SIZE];
+  int steps_left[WALK_BATCH_SIZE];
+  int leaving[WALK_BATCH_SIZE];
+} WalkerBatch;
+
+// Counts the walker steps taken on this process in the current round
+typedef struct {
+  long long round_steps;
+} StepCounter;
+
+// Creates and commits the MPI datatype of a Walker. Its extent is the size of
+// the struct, so arrays of walkers can be sent without packing them.
+void create_walker_datatype() {
+  int block_lengths[2] = {1, 1};
+  MPI_Aint offsets[2] = {offsetof(Walker, location),
+                         offsetof(Walker, num_steps_left_in_walk)};
+  MPI_Datatype types[2] = {MPI_INT, MPI_INT};
+  MPI_Datatype struct_datatype;
+  MPI_Type_create_struct(2, block_lengths, offsets, types, &struct_datatype);
+  MPI_Type_create_resized(struct_datatype, 0, sizeof(Walker), &walker_datatype);
+  MPI_Type_free(&struct_datatype);
+  MPI_Type_commit(&walker_datatype);
 }
 
+// Makes room for at least size walkers. The capacity at least doubles when it
+// grows, so a buffer only grows a few times before it fits every exchange.
+void reserve_walkers(WalkerVector* walkers, int size) {
+  if (size > walkers->capacity()) {
+    walkers->reserve(max((size_t)size, 2 * walkers->capacity()));
+  }
+}
+
+// Splits the domain into equal segments for num_lanes lanes, which must
+// divide world_size
+void decompose_domain(int domain_size, int num_lanes, int world_size,
+                      Decomposition* decomposition) {
+  int num_segments = world_size / num_lanes;
+  decomposition->domain_size = domain_size;
+  decomposition->num_lanes = num_lanes;
+  decomposition->num_segments = num_segments;
+  decomposition->starts.resize(num_segments + 1);
+  for (int i = 0; i < num_segments; i++) {
+    if (num_segments > domain_size) {
+      // Give one location to each of the first segments. The others are
+      // empty at the end of the domain.
+      decomposition->starts[i] = min(i, domain_size);
+    } else {
+      // Give remainder to last segment
+      decomposition->starts[i] = domain_size / num_segments * i;
+    }
+  }
+  decomposition->starts[num_segments] = domain_size;
+}
+
+void get_subdomain(const Decomposition* decomposition, int world_rank,
+                   int* subdomain_start, int* subdomain_size) {
+  int segment = world_rank % decomposition->num_segments;
+  *subdomain_start = decomposition->starts[segment];
+  *subdomain_size = decomposition->starts[segment + 1] - *subdomain_start;
+}
+
+// Returns the process of a lane that owns a location. When empty segments
+// start at the location, the owner is the process of the segment after them.
+int get_owner(const Decomposition* decomposition, int location, int lane) {
+  int segment = upper_bound(decomposition->starts.begin(),
+                            decomposition->starts.end() - 1, location) -
+                decomposition->starts.begin() - 1;
+  return lane * decomposition->num_segments + segment;
+}
+
+// Finds the processes that this process sends walkers to and receives walkers
+// from. Walkers leave a subdomain at its end, so they go to the owner of the
+// location after it in the same lane. Processes with empty subdomains do not
+// take part, and sends_first alternates between the processes of a lane that
+// do to avoid deadlock.
+void get_ring_neighbors(const Decomposition* decomposition, int world_rank,
+                        int* outgoing_rank, int* incoming_rank,
+                        bool* sends_first) {
+  int subdomain_start, subdomain_size;
+  get_subdomain(decomposition, world_rank, &subdomain_start, &subdomain_size);
+  if (subdomain_size == 0) {
+    *outgoing_rank = MPI_PROC_NULL;
+    *incoming_rank = MPI_PROC_NULL;
+    *sends_first = true;
+    return;
+  }
+  int domain_size = decomposition->domain_size;
+  int lane = world_rank / decomposition->num_segments;
+  *outgoing_rank = get_owner(decomposition,
+                             (subdomain_start + subdomain_size) % domain_size,
+                             lane);
+  *incoming_rank = get_owner(decomposition,
+                             (subdomain_start + domain_size - 1) % domain_size,
+                             lane);
+  int ring_position = 0;
+  for (int i = 0; i < world_rank % decomposition->num_segments; i++) {
+    if (decomposition->starts[i + 1] > decomposition->starts[i]) {
+      ring_position++;
+    }
+  }
+  *sends_first = ring_position % 2 == 0;
+}
+
+// Initializes walkers at the start of the subdomain. Processes with empty
+// subdomains at the end of the domain start them at zero. With skewed, the
+// walkers start at random locations in the first skewed_size locations of the
+// domain instead.
 void initialize_walkers(int num_walkers_per_proc, int max_walk_size,
-                        int subdomain_start,
-                        vector<Walker>* incoming_walkers) {
+                        int subdomain_start, int domain_size, bool skewed,
+                        int skewed_size, TMPI_Random* random,
+                        WalkerVector* incoming_walkers) {
   Walker walker;
   for (int i = 0; i < num_walkers_per_proc; i++) {
-    // Initialize walkers at the start of the subdomain
-    walker.location = subdomain_start;
-    walker.num_steps_left_in_walk =
-      (rand() / (float)RAND_MAX) * max_walk_size;
+    if (skewed) {
+      walker.location = TMPI_Random_int(random, skewed_size);
+    } else {
+      walker.location = subdomain_start % domain_size;
+    }
+    walker.num_steps_left_in_walk = TMPI_Random_int(random, max_walk_size + 1);
     incoming_walkers->push_back(walker);
   }
 }
 
-void walk(Walker* walker, int subdomain_start, int subdomain_size,
-          int domain_size, vector<Walker>* outgoing_walkers) {
-  while (walker->num_steps_left_in_walk > 0) {
-    if (walker->location == subdomain_start + subdomain_size) {
-      // Take care of the case when the walker is at the end
-      // of the domain by wrapping it around to the beginning
-      if (walker->location == domain_size) {
-        walker->location = 0;
+// Walks the walkers from walkers[0] up to walkers[count - 1], which must be
+// at most WALK_BATCH_SIZE. Walkers walk to the right until they are finished
+// or reach the end of the subdomain, so the steps of a walker are the minimum
+// of its steps left and its distance to the end. They are computed at once
+// instead of stepping one location at a time. The walkers are first copied to
+// a struct of arrays, and the loops over it have no branches so that the
+// compiler can vectorize them. The walkers that leave the subdomain are packed
+// at the end of outgoing_walkers. Returns the amount of walkers that finished.
+int walk_batch(const Walker* walkers, int count, int subdomain_start,
+               int subdomain_size, int domain_size,
+               WalkerVector* outgoing_walkers, StepCounter* counter) {
+  WalkerBatch batch;
+  for (int i = 0; i < count; i++) {
+    batch.locations[i] = walkers[i].location;
+    batch.steps_left[i] = walkers[i].num_steps_left_in_walk;
+  }
+
+  int subdomain_end = subdomain_start + subdomain_size;
+  int num_steps = 0;
+  int num_leaving = 0;
+  for (int i = 0; i < count; i++) {
+    int distance = subdomain_end - batch.locations[i];
+    int steps = min(batch.steps_left[i], distance);
+    batch.locations[i] += steps;
+    batch.steps_left[i] -= steps;
+    batch.leaving[i] = batch.steps_left[i] > 0;
+    num_steps += steps;
+    num_leaving += batch.leaving[i];
+  }
+  counter->round_steps += num_steps;
+
+  // Every walker is written to the next free place of outgoing_walkers, but
+  // the place only moves on for walkers that leave. Walkers that leave the end
+  // of the domain wrap around to the beginning.
+  int first_outgoing = outgoing_walkers->size();
+  outgoing_walkers->resize(first_outgoing + num_leaving + 1);
+  Walker* outgoing = outgoing_walkers->data() + first_outgoing;
+  int next = 0;
+  for (int i = 0; i < count; i++) {
+    outgoing[next].location =
+      batch.locations[i] == domain_size ? 0 : batch.locations[i];
+    outgoing[next].num_steps_left_in_walk = batch.steps_left[i];
+    next += batch.leaving[i];
+  }
+  outgoing_walkers->resize(first_outgoing + num_leaving);
+  return count - num_leaving;
+}
+
+// Returns the amount of threads that walk num_batches batches of walkers.
+// Small rounds are walked by one thread.
+int get_num_walk_threads(int num_batches) {
+#ifdef _OPENMP
+  if (num_batches >= WALK_PARALLEL_BATCHES) {
+    return min(omp_get_max_threads(), num_batches);
+  }
+#endif
+  return 1;
+}
+
+// Walks all walkers in batches of WALK_BATCH_SIZE. Returns the amount of
+// walkers that finished. Large rounds are split into one contiguous range of
+// batches per thread. Every thread packs the walkers that leave into its own
+// buffer, and the buffers are appended in thread order, so the outgoing
+// walkers are in the same order as when one thread walks them. The thread
+// buffers are kept for the next rounds.
+int walk_walkers(const WalkerVector& walkers, int subdomain_start,
+                 int subdomain_size, int domain_size,
+                 WalkerVector* outgoing_walkers, StepCounter* counter) {
+  // At most every walker leaves, so make room for all of them at once
+  reserve_walkers(outgoing_walkers,
+                  outgoing_walkers->size() + walkers.size() + 1);
+  int num_batches = (walkers.size() + WALK_BATCH_SIZE - 1) / WALK_BATCH_SIZE;
+  int num_threads = get_num_walk_threads(num_batches);
+  int num_finished = 0;
+  if (num_threads == 1) {
+    for (int i = 0; i < walkers.size(); i += WALK_BATCH_SIZE) {
+      num_finished += walk_batch(walkers.data() + i,
+                                 min((int)walkers.size() - i, WALK_BATCH_SIZE),
+                                 subdomain_start, subdomain_size, domain_size,
+                                 outgoing_walkers, counter);
+    }
+    return num_finished;
+  }
+
+  static vector<WalkerVector> thread_outgoing_walkers;
+  if (thread_outgoing_walkers.size() < num_threads) {
+    thread_outgoing_walkers.resize(num_threads);
+  }
+  long long num_steps = 0;
+#pragma omp parallel num_threads(num_threads) reduction(+:num_finished, num_steps)
+  {
+    // The system may start fewer threads than were asked for (for example
+    // with OMP_THREAD_LIMIT), so a thread also walks the ranges of the
+    // threads that are missing
+    int thread = 0, team_size = 1;
+#ifdef _OPENMP
+    thread = omp_get_thread_num();
+    team_size = omp_get_num_threads();
+#endif
+    StepCounter thread_counter;
+    thread_counter.round_steps = 0;
+    for (; thread < num_threads; thread += team_size) {
+      int first_walker = (long long)num_batches * thread / num_threads *
+                         WALK_BATCH_SIZE;
+      int last_walker = min((long long)walkers.size(),
+                            (long long)num_batches * (thread + 1) /
+                            num_threads * WALK_BATCH_SIZE);
+      WalkerVector* thread_outgoing = &thread_outgoing_walkers[thread];
+      thread_outgoing->clear();
+      reserve_walkers(thread_outgoing, last_walker - first_walker + 1);
+      for (int i = first_walker; i < last_walker; i += WALK_BATCH_SIZE) {
+        num_finished += walk_batch(walkers.data() + i,
+                                   min(last_walker - i, WALK_BATCH_SIZE),
+                                   subdomain_start, subdomain_size,
+                                   domain_size, thread_outgoing,
+                                   &thread_counter);
       }
-      outgoing_walkers->push_back(*walker);
-      break;
-    } else {
-      walker->num_steps_left_in_walk--;
-      walker->location++;
     }
+    num_steps += thread_counter.round_steps;
+  }
+  counter->round_steps += num_steps;
+  for (int thread = 0; thread < num_threads; thread++) {
+    outgoing_walkers->insert(outgoing_walkers->end(),
+                             thread_outgoing_walkers[thread].begin(),
+                             thread_outgoing_walkers[thread].end());
   }
+  return num_finished;
 }
 
-void send_outgoing_walkers(vector<Walker>* outgoing_walkers,
-                           int world_rank, int world_size) {
-  // Send the data as an array of MPI_BYTEs to the next process.
-  // The last process sends to process zero.
-  MPI_Send((void*)outgoing_walkers->data(),
-           outgoing_walkers->size() * sizeof(Walker), MPI_BYTE,
-           (world_rank + 1) % world_size, 0, MPI_COMM_WORLD);
-  // Clear the outgoing walkers list
+void send_outgoing_walkers(WalkerVector* outgoing_walkers,
+                           int outgoing_rank) {
+  // Send the data as an array of walkers to the next process.
+  // The last process sends to the owner of location zero.
+  MPI_Send((void*)outgoing_walkers->data(), outgoing_walkers->size(),
+           walker_datatype, outgoing_rank, 0, MPI_COMM_WORLD);
+  // Clear the outgoing walkers list. Its memory is kept for the next round.
   outgoing_walkers->clear();
 }
 
-void receive_incoming_walkers(vector<Walker>* incoming_walkers,
-                              int world_rank, int world_size) {
-  // Probe for new incoming walkers
+void receive_incoming_walkers(WalkerVector* incoming_walkers,
+                              int incoming_rank) {
+  // Probe for new incoming walkers from the process before you. The matched
+  // probe removes the message from the queue, so MPI_Mrecv receives exactly
+  // the probed message.
+  MPI_Message message;
   MPI_Status status;
-  // Receive from the process before you. If you are process zero,
-  // receive from the last process
-  int incoming_rank =
-    (world_rank == 0) ? world_size - 1 : world_rank - 1;
-  MPI_Probe(incoming_rank, 0, MPI_COMM_WORLD, &status);
+  MPI_Mprobe(incoming_rank, 0, MPI_COMM_WORLD, &message, &status);
   // Resize your incoming walker buffer based on how much data is
-  // being received
+  // being received. It only allocates when the buffer has to grow.
+  int incoming_walkers_size;
+  MPI_Get_count(&status, walker_datatype, &incoming_walkers_size);
+  reserve_walkers(incoming_walkers, incoming_walkers_size);
+  incoming_walkers->resize(incoming_walkers_size);
+  MPI_Mrecv((void*)incoming_walkers->data(), incoming_walkers_size,
+            walker_datatype, &message, MPI_STATUS_IGNORE);
+}
+
+// Returns the lane of walker i of a process. The walkers of a process are
+// dealt out to the lanes in turn, so the lanes get about the same amount of
+// walkers from every location.
+int get_walker_lane(const Decomposition* decomposition, int i,
+                    int world_rank) {
+  return (i + world_rank) % decomposition->num_lanes;
+}
+
+// Sends every walker to the process of its lane that owns its location
+void migrate_walkers(const Decomposition* decomposition,
+                     WalkerVector* walkers, int world_rank, int world_size) {
+  // Order the walkers by their new owners
+  vector<int> send_counts(world_size, 0);
+  for (int i = 0; i < walkers->size(); i++) {
+    send_counts[get_owner(decomposition, (*walkers)[i].location,
+                          get_walker_lane(decomposition, i, world_rank))]++;
+  }
+  vector<int> send_offsets(world_size, 0);
+  for (int i = 1; i < world_size; i++) {
+    send_offsets[i] = send_offsets[i - 1] + send_counts[i - 1];
+  }
+  WalkerVector send_walkers(walkers->size());
+  vector<int> positions = send_offsets;
+  for (int i = 0; i < walkers->size(); i++) {
+    int owner = get_owner(decomposition, (*walkers)[i].location,
+                          get_walker_lane(decomposition, i, world_rank));
+    send_walkers[positions[owner]++] = (*walkers)[i];
+  }
+
+  // Exchange the walker counts and then the walkers
+  vector<int> recv_counts(world_size);
+  MPI_Alltoall(send_counts.data(), 1, MPI_INT, recv_counts.data(), 1, MPI_INT,
+               MPI_COMM_WORLD);
+  vector<int> recv_offsets(world_size, 0);
+  for (int i = 1; i < world_size; i++) {
+    recv_offsets[i] = recv_offsets[i - 1] + recv_counts[i - 1];
+  }
+  int num_recv_walkers =
+    recv_offsets[world_size - 1] + recv_counts[world_size - 1];
+  reserve_walkers(walkers, num_recv_walkers);
+  walkers->resize(num_recv_walkers);
+  MPI_Alltoallv((void*)send_walkers.data(), send_counts.data(),
+                send_offsets.data(), walker_datatype, (void*)walkers->data(),
+                recv_counts.data(), recv_offsets.data(), walker_datatype,
+                MPI_COMM_WORLD);
+}
+
+// Returns how many times longer the last REBALANCE_INTERVAL rounds took than
+// perfectly balanced rounds. Every round takes as long as its busiest process,
+// so the steps of the busiest process are compared round by round. Walkers
+// that move in bunches keep one process busy per round, even when every
+// process walks the same amount of steps over all the rounds.
+double get_imbalance(const vector<long long>& steps_per_round,
+                     int world_size) {
+  vector<long long> round_steps(steps_per_round.end() - REBALANCE_INTERVAL,
+                                steps_per_round.end());
+  vector<long long> max_steps(REBALANCE_INTERVAL);
+  MPI_Allreduce(round_steps.data(), max_steps.data(), REBALANCE_INTERVAL,
+                MPI_LONG_LONG, MPI_MAX, MPI_COMM_WORLD);
+  MPI_Allreduce(MPI_IN_PLACE, round_steps.data(), REBALANCE_INTERVAL,
+                MPI_LONG_LONG, MPI_SUM, MPI_COMM_WORLD);
+  long long busiest_steps = 0, total_steps = 0;
+  for (int m = 0; m < REBALANCE_INTERVAL; m++) {
+    busiest_steps += max_steps[m];
+    total_steps += round_steps[m];
+  }
+  return total_steps > 0 ? busiest_steps * world_size / (double)total_steps
+                         : 1;
+}
+
+// Returns the smallest amount of lanes that is at least min_lanes and divides
+// the processes evenly
+int get_num_lanes(int min_lanes, int world_size) {
+  int num_lanes = max(min_lanes, 1);
+  while (num_lanes < world_size && world_size % num_lanes != 0) {
+    num_lanes++;
+  }
+  return min(num_lanes, world_size);
+}
+
+// Places the segment boundaries so that every segment gets about the same
+// amount of the steps that are left to walk. Walkers only move to the right,
+// so the steps they will take are known from their locations and walk sizes.
+// The steps left per location of the whole domain are summed on every
+// process, so every process computes the same boundaries from their prefix
+// sum. The steps walked in the past would lag behind the walkers. The
+// boundaries are kept if they are balanced well enough.
+void place_segments(Decomposition* decomposition, const WalkerVector& walkers) {
+  // Count the steps per location in a difference array, so every walker only
+  // changes a few entries. Walks longer than the domain wrap around it.
+  int domain_size = decomposition->domain_size;
+  vector<long long> location_steps(domain_size + 1, 0);
+  long long num_laps = 0;
+  for (int i = 0; i < walkers.size(); i++) {
+    int location = walkers[i].location;
+    int num_steps = walkers[i].num_steps_left_in_walk;
+    num_laps += num_steps / domain_size;
+    num_steps %= domain_size;
+    if (location + num_steps <= domain_size) {
+      location_steps[location]++;
+      location_steps[location + num_steps]--;
+    } else {
+      location_steps[location]++;
+      location_steps[0]++;
+      location_steps[location + num_steps - domain_size]--;
+    }
+  }
+  location_steps[0] += num_laps;
+  MPI_Allreduce(MPI_IN_PLACE, location_steps.data(), domain_size + 1,
+                MPI_LONG_LONG, MPI_SUM, MPI_COMM_WORLD);
+
+  // Segment i starts at the first location where the prefix sum of the steps
+  // reaches i / num_segments of all steps
+  int num_segments = decomposition->num_segments;
+  vector<long long> prefix_steps(domain_size + 1, 0);
+  long long steps = 0;
+  for (int i = 0; i < domain_size; i++) {
+    steps += location_steps[i];
+    prefix_steps[i + 1] = prefix_steps[i] + steps;
+  }
+  long long total_steps = prefix_steps[domain_size];
+  long long max_steps = 0;
+  for (int i = 0; i < num_segments; i++) {
+    max_steps = max(max_steps, prefix_steps[decomposition->starts[i + 1]] -
+                               prefix_steps[decomposition->starts[i]]);
+  }
+  if (max_steps * num_segments > REBALANCE_THRESHOLD * total_steps) {
+    int location = 0;
+    for (int i = 1; i < num_segments; i++) {
+      while (prefix_steps[location] * num_segments < total_steps * i) {
+        location++;
+      }
+      decomposition->starts[i] = location;
+    }
+  }
+}
+
+// Spreads the walking over more processes when the busiest process walked
+// imbalance times the average since the last check. Segments that get the
+// same amount of steps in total still walk them one after another when the
+// walkers move in bunches, since a bunch leaves a segment together and
+// arrives together at the start of the next one. So the amount of lanes is
+// multiplied by about the imbalance, and every lane walks its share of every
+// bunch at the same time as the others. More lanes mean fewer and larger
+// segments, and with as many lanes as processes, every process walks its
+// walkers through the whole domain without sending them. The amount of lanes
+// never shrinks. The segment boundaries are then placed by the steps that are
+// left, and the walkers are sent to their new owners.
+void rebalance_domain(Decomposition* decomposition, WalkerVector* walkers,
+                      double imbalance, int world_rank, int world_size) {
+  int num_lanes = get_num_lanes(
+    (int)(decomposition->num_lanes * imbalance + 0.5), world_size);
+  if (num_lanes != decomposition->num_lanes) {
+    decompose_domain(decomposition->domain_size, num_lanes, world_size,
+                     decomposition);
+  }
+  place_segments(decomposition, *walkers);
+  migrate_walkers(decomposition, walkers, world_rank, world_size);
+}
+
+// Counts the finished walkers of all processes with a non-blocking
+// MPI_Iallreduce. Every walker finishes on exactly one process, so the walk is
+// over once the count reaches the total amount of walkers. The local counts only
+// grow, so a sum of counts taken at different times can only reach the total
+// when all walkers are finished.
+typedef struct {
+  long long local_finished;
+  long long reduced_finished;
+  long long global_finished;
+  long long total_walkers;
+  MPI_Request request;
+} TerminationDetector;
+
+void start_termination_check(TerminationDetector* detector) {
+  // The count keeps changing while the reduction is in progress, so reduce a
+  // copy of it
+  detector->reduced_finished = detector->local_finished;
+  MPI_Iallreduce(&detector->reduced_finished, &detector->global_finished, 1,
+                 MPI_LONG_LONG, MPI_SUM, MPI_COMM_WORLD, &detector->request);
+}
+
+// Waits for the reduction started by start_termination_check and returns true
+// if all walkers are finished. All processes get the same answer, so they stop
+// in the same round.
+bool finish_termination_check(TerminationDetector* detector) {
+  MPI_Wait(&detector->request, MPI_STATUS_IGNORE);
+  return detector->global_finished == detector->total_walkers;
+}
+
+// A message of walkers along with the request that sends or receives it
+typedef struct {
+  WalkerVector walkers;
+  MPI_Request request;
+} WalkerMessage;
+
+// Holds the state of the non-blocking exchange used in async mode. Walkers are
+// sent in chunks of WALKER_CHUNK_SIZE as soon as a chunk fills up, and up to
+// NUM_RECV_BUFFERS chunks can arrive before they are processed. An empty message
+// marks the end of a round. Messages whose sends completed are kept in
+// free_sends along with their buffers and reused for later sends.
+typedef struct {
+  int outgoing_rank;
+  int incoming_rank;
+  list<WalkerMessage> pending_sends;
+  list<WalkerMessage> free_sends;
+  WalkerMessage recvs[NUM_RECV_BUFFERS];
+  int next_recv;
+} AsyncExchange;
+
+void post_walker_recv(AsyncExchange* exchange, int i) {
+  WalkerMessage* recv = &exchange->recvs[i];
+  recv->walkers.resize(WALKER_CHUNK_SIZE);
+  MPI_Irecv((void*)recv->walkers.data(), WALKER_CHUNK_SIZE, walker_datatype,
+            exchange->incoming_rank, 0, MPI_COMM_WORLD, &recv->request);
+}
+
+void start_async_exchange(AsyncExchange* exchange, int outgoing_rank,
+                          int incoming_rank) {
+  exchange->outgoing_rank = outgoing_rank;
+  exchange->incoming_rank = incoming_rank;
+  for (int i = 0; i < NUM_RECV_BUFFERS; i++) {
+    post_walker_recv(exchange, i);
+  }
+  exchange->next_recv = 0;
+}
+
+// Moves the sends that have completed to the free sends
+void complete_walker_sends(AsyncExchange* exchange) {
+  list<WalkerMessage>::iterator it = exchange->pending_sends.begin();
+  while (it != exchange->pending_sends.end()) {
+    int completed;
+    MPI_Test(&it->request, &completed, MPI_STATUS_IGNORE);
+    list<WalkerMessage>::iterator next = it;
+    ++next;
+    if (completed) {
+      exchange->free_sends.splice(exchange->free_sends.end(),
+                                  exchange->pending_sends, it);
+    }
+    it = next;
+  }
+}
+
+// Returns a message to send that is pending from now on. A free message is
+// reused if there is one.
+WalkerMessage* get_send_message(AsyncExchange* exchange) {
+  complete_walker_sends(exchange);
+  if (exchange->free_sends.empty()) {
+    exchange->pending_sends.push_back(WalkerMessage());
+  } else {
+    exchange->pending_sends.splice(exchange->pending_sends.end(),
+                                   exchange->free_sends,
+                                   exchange->free_sends.begin());
+  }
+  return &exchange->pending_sends.back();
+}
+
+// Starts sending the walkers of a message to the next process without waiting
+// for the send to finish
+void start_walker_send(AsyncExchange* exchange, WalkerMessage* send) {
+  MPI_Isend((void*)send->walkers.data(), send->walkers.size(), walker_datatype,
+            exchange->outgoing_rank, 0, MPI_COMM_WORLD, &send->request);
+}
+
+// Starts sending the walkers to the next process. The walkers vector is left
+// empty, and it gets the buffer of a free message in exchange.
+void send_walkers_async(AsyncExchange* exchange, WalkerVector* walkers) {
+  WalkerMessage* send = get_send_message(exchange);
+  send->walkers.swap(*walkers);
+  walkers->clear();
+  start_walker_send(exchange, send);
+}
+
+// Sends the outgoing walkers in chunks until less than a chunk is left. More
+// than a chunk is only left when the walkers were kept while checking the
+// load balance.
+void send_full_chunks(AsyncExchange* exchange,
+                      WalkerVector* outgoing_walkers) {
+  while (outgoing_walkers->size() > WALKER_CHUNK_SIZE) {
+    WalkerMessage* send = get_send_message(exchange);
+    send->walkers.assign(outgoing_walkers->end() - WALKER_CHUNK_SIZE,
+                         outgoing_walkers->end());
+    outgoing_walkers->resize(outgoing_walkers->size() - WALKER_CHUNK_SIZE);
+    start_walker_send(exchange, send);
+  }
+  if (outgoing_walkers->size() == WALKER_CHUNK_SIZE) {
+    send_walkers_async(exchange, outgoing_walkers);
+  }
+}
+
+// Walks the walkers and sends out the ones that leave the subdomain in chunks
+// as soon as a chunk is full. Every walker leaves at most once, so a batch
+// never holds more walkers than fit in the current chunk. If exchange is NULL,
+// the walkers that leave are kept in outgoing_walkers instead.
+void walk_and_send_async(const WalkerVector& walkers, int subdomain_start,
+                         int subdomain_size, int domain_size,
+                         WalkerVector* outgoing_walkers,
+                         AsyncExchange* exchange, StepCounter* counter,
+                         long long* num_finished) {
+  if (exchange == NULL) {
+    *num_finished += walk_walkers(walkers, subdomain_start, subdomain_size,
+                                  domain_size, outgoing_walkers, counter);
+    return;
+  }
+  int i = 0;
+  while (i < walkers.size()) {
+    send_full_chunks(exchange, outgoing_walkers);
+    outgoing_walkers->reserve(WALKER_CHUNK_SIZE + 1);
+    int count = min((int)walkers.size() - i,
+                    min(WALK_BATCH_SIZE,
+                        WALKER_CHUNK_SIZE - (int)outgoing_walkers->size()));
+    *num_finished += walk_batch(walkers.data() + i, count, subdomain_start,
+                                subdomain_size, domain_size, outgoing_walkers,
+                                counter);
+    i += count;
+  }
+  send_full_chunks(exchange, outgoing_walkers);
+}
+
+// Sends the remaining outgoing walkers in chunks followed by the empty message
+// that marks the end of the round
+void send_end_of_round(AsyncExchange* exchange,
+                       WalkerVector* outgoing_walkers) {
+  send_full_chunks(exchange, outgoing_walkers);
+  if (!outgoing_walkers->empty()) {
+    send_walkers_async(exchange, outgoing_walkers);
+  }
+  WalkerMessage* end_of_round = get_send_message(exchange);
+  end_of_round->walkers.clear();
+  start_walker_send(exchange, end_of_round);
+}
+
+// Checks whether the next chunk of walkers arrived without waiting for it.
+// Returns true and puts the walkers in incoming_walkers if it did, and sets
+// end_of_round if the chunk was the end of round marker.
+bool test_incoming_walkers(AsyncExchange* exchange,
+                           WalkerVector* incoming_walkers,
+                           bool* end_of_round) {
+  WalkerMessage* recv = &exchange->recvs[exchange->next_recv];
+  int completed;
+  MPI_Status status;
+  MPI_Test(&recv->request, &completed, &status);
+  if (!completed) {
+    return false;
+  }
   int incoming_walkers_size;
-  MPI_Get_count(&status, MPI_BYTE, &incoming_walkers_size);
-  incoming_walkers->resize(incoming_walkers_size / sizeof(Walker));
-  MPI_Recv((void*)incoming_walkers->data(), incoming_walkers_size,
-           MPI_BYTE, incoming_rank, 0, MPI_COMM_WORLD,
-           MPI_STATUS_IGNORE);
+  MPI_Get_count(&status, walker_datatype, &incoming_walkers_size);
+  recv->walkers.resize(incoming_walkers_size);
+  incoming_walkers->swap(recv->walkers);
+  *end_of_round = incoming_walkers->empty();
+  // Messages from the same process arrive in order, so post a new receive
+  // behind the other ones and move on to the next buffer
+  post_walker_recv(exchange, exchange->next_recv);
+  exchange->next_recv = (exchange->next_recv + 1) % NUM_RECV_BUFFERS;
+  return true;
+}
+
+// Cancels the receives that are still posted and waits for all sends
+void finish_async_exchange(AsyncExchange* exchange) {
+  for (int i = 0; i < NUM_RECV_BUFFERS; i++) {
+    MPI_Cancel(&exchange->recvs[i].request);
+    MPI_Wait(&exchange->recvs[i].request, MPI_STATUS_IGNORE);
+  }
+  while (!exchange->pending_sends.empty()) {
+    MPI_Wait(&exchange->pending_sends.front().request, MPI_STATUS_IGNORE);
+    exchange->pending_sends.pop_front();
+  }
+}
+
+// Runs the walk with blocking sends and receives. Every other process sends
+// before receiving and the others do the opposite to avoid deadlock. Runs
+// maximum_sends_recvs rounds, or until all walkers are finished when a
+// termination detector is given. With balance, the load balance is checked
+// every REBALANCE_INTERVAL rounds. The steps and walker allocations of every
+// round are appended to steps_per_round and allocations_per_round.
+void run_sync_walk(WalkerVector* incoming_walkers,
+                   Decomposition* decomposition, int maximum_sends_recvs,
+                   TerminationDetector* detector, bool balance,
+                   vector<long long>* steps_per_round,
+                   vector<long long>* allocations_per_round, int world_rank,
+                   int world_size) {
+  int domain_size = decomposition->domain_size;
+  int subdomain_start, subdomain_size;
+  get_subdomain(decomposition, world_rank, &subdomain_start, &subdomain_size);
+  int outgoing_rank, incoming_rank;
+  bool sends_first;
+  get_ring_neighbors(decomposition, world_rank, &outgoing_rank, &incoming_rank,
+                     &sends_first);
+  StepCounter counter;
+  WalkerVector outgoing_walkers;
+  long long num_finished = 0;
+  long long previous_allocations = num_walker_allocations;
+  for (int m = 0; detector != NULL || m < maximum_sends_recvs; m++) {
+    // Process all incoming walkers
+    counter.round_steps = 0;
+    num_finished += walk_walkers(*incoming_walkers, subdomain_start,
+                                 subdomain_size, domain_size,
+                                 &outgoing_walkers, &counter);
+    steps_per_round->push_back(counter.round_steps);
+    allocations_per_round->push_back(num_walker_allocations -
+                                     previous_allocations);
+    previous_allocations = num_walker_allocations;
+    // Count the finished walkers while the walkers are exchanged. If all
+    // walkers are finished now, nothing is sent in this round.
+    if (detector != NULL) {
+      detector->local_finished = num_finished;
+      start_termination_check(detector);
+    }
+    if (outgoing_rank == world_rank) {
+      // The only process of the lane with a subdomain keeps its walkers.
+      // Sending them to itself with a blocking send could deadlock.
+      incoming_walkers->swap(outgoing_walkers);
+      outgoing_walkers.clear();
+    } else if (outgoing_rank != MPI_PROC_NULL) {
+      cout << "Process " << world_rank << " sending "
+           << outgoing_walkers.size() << " outgoing walkers to process "
+           << outgoing_rank << endl;
+      if (sends_first) {
+        // Send all outgoing walkers to the next process.
+        send_outgoing_walkers(&outgoing_walkers, outgoing_rank);
+        // Receive all the new incoming walkers
+        receive_incoming_walkers(incoming_walkers, incoming_rank);
+      } else {
+        // Receive all the new incoming walkers
+        receive_incoming_walkers(incoming_walkers, incoming_rank);
+        // Send all outgoing walkers to the next process.
+        send_outgoing_walkers(&outgoing_walkers, outgoing_rank);
+      }
+      cout << "Process " << world_rank << " received "
+           << incoming_walkers->size() << " incoming walkers" << endl;
+    }
+    if (detector != NULL && finish_termination_check(detector)) {
+      return;
+    }
+
+    double imbalance = 1;
+    if (balance && (m + 1) % REBALANCE_INTERVAL == 0) {
+      imbalance = get_imbalance(*steps_per_round, world_size);
+    }
+    if (imbalance > REBALANCE_THRESHOLD) {
+      rebalance_domain(decomposition, incoming_walkers, imbalance, world_rank,
+                       world_size);
+      get_subdomain(decomposition, world_rank, &subdomain_start,
+                    &subdomain_size);
+      get_ring_neighbors(decomposition, world_rank, &outgoing_rank,
+                         &incoming_rank, &sends_first);
+    }
+  }
+}
+
+// Runs the walk as a pipeline of non-blocking sends and receives. Walkers leave
+// in chunks while the rest are still walking, and walkers that arrive are walked
+// right away while the process waits for the end of the round. A round ends when
+// the end of round marker from the previous process arrives. Walkers walked after
+// this process sent its own marker belong to the next round, so walkers move at
+// least as fast as in the blocking version and the same amount of rounds suffices.
+// With a termination detector, the rounds go on until all walkers are finished.
+// With balance, the load balance is checked every REBALANCE_INTERVAL rounds. The
+// steps and walker allocations of every round are appended to steps_per_round
+// and allocations_per_round.
+void run_async_walk(WalkerVector* incoming_walkers,
+                    Decomposition* decomposition, int maximum_sends_recvs,
+                    TerminationDetector* detector, bool balance,
+                    vector<long long>* steps_per_round,
+                    vector<long long>* allocations_per_round, int world_rank,
+                    int world_size) {
+  int domain_size = decomposition->domain_size;
+  int subdomain_start, subdomain_size;
+  get_subdomain(decomposition, world_rank, &subdomain_start, &subdomain_size);
+  int outgoing_rank, incoming_rank;
+  bool sends_first;
+  get_ring_neighbors(decomposition, world_rank, &outgoing_rank, &incoming_rank,
+                     &sends_first);
+  AsyncExchange exchange;
+  start_async_exchange(&exchange, outgoing_rank, incoming_rank);
+  StepCounter counter;
+  WalkerVector outgoing_walkers, received_walkers;
+  outgoing_walkers.reserve(WALKER_CHUNK_SIZE);
+  long long num_finished = 0;
+  long long previous_allocations = num_walker_allocations;
+  for (int m = 0; detector != NULL || m < maximum_sends_recvs; m++) {
+    // Walk the walkers that are left from the previous round and end the round
+    counter.round_steps = 0;
+    walk_and_send_async(*incoming_walkers, subdomain_start, subdomain_size,
+                        domain_size, &outgoing_walkers, &exchange, &counter,
+                        &num_finished);
+    incoming_walkers->clear();
+    send_end_of_round(&exchange, &outgoing_walkers);
+    // Count the finished walkers while waiting for the end of the round
+    if (detector != NULL) {
+      detector->local_finished = num_finished;
+      start_termination_check(detector);
+    }
+
+    // Walk incoming walkers as they arrive until the previous process ends
+    // the round. Before rebalancing, keep the walkers that leave until the
+    // end of the round so that no messages are left after the end of round
+    // markers.
+    bool check_balance = balance && (m + 1) % REBALANCE_INTERVAL == 0;
+    int received_count = 0;
+    bool end_of_round = false;
+    while (!end_of_round) {
+      if (test_incoming_walkers(&exchange, &received_walkers, &end_of_round)) {
+        received_count += received_walkers.size();
+        walk_and_send_async(received_walkers, subdomain_start, subdomain_size,
+                            domain_size, &outgoing_walkers,
+                            check_balance ? NULL : &exchange, &counter,
+                            &num_finished);
+      }
+    }
+    steps_per_round->push_back(counter.round_steps);
+    allocations_per_round->push_back(num_walker_allocations -
+                                     previous_allocations);
+    previous_allocations = num_walker_allocations;
+    if (incoming_rank != MPI_PROC_NULL) {
+      cout << "Process " << world_rank << " received " << received_count
+           << " incoming walkers in round " << m << endl;
+    }
+    if (detector != NULL && finish_termination_check(detector)) {
+      break;
+    }
+
+    double imbalance = 1;
+    if (check_balance) {
+      imbalance = get_imbalance(*steps_per_round, world_size);
+    }
+    if (imbalance > REBALANCE_THRESHOLD) {
+      // Start a new exchange between the new neighbors. The kept walkers
+      // go to the owners of their locations.
+      finish_async_exchange(&exchange);
+      incoming_walkers->swap(outgoing_walkers);
+      outgoing_walkers.clear();
+      rebalance_domain(decomposition, incoming_walkers, imbalance, world_rank,
+                       world_size);
+      get_subdomain(decomposition, world_rank, &subdomain_start,
+                    &subdomain_size);
+      get_ring_neighbors(decomposition, world_rank, &outgoing_rank,
+                         &incoming_rank, &sends_first);
+      start_async_exchange(&exchange, outgoing_rank, incoming_rank);
+    }
+  }
+  finish_async_exchange(&exchange);
 }
 
 int main(int argc, char** argv) {
   int domain_size;
   int max_walk_size;
   int num_walkers_per_proc;
+  bool async = false;
+  bool detect_termination = false;
+  bool balance = false;
+  bool skewed = false;
+  unsigned long long seed = TMPI_RANDOM_DEFAULT_SEED;
 
   if (argc < 4) {
     cerr << "Usage: random_walk domain_size max_walk_size "
-         << "num_walkers_per_proc" << endl;
+         << "num_walkers_per_proc [--async] [--detect-termination] "
+         << "[--balance] [--skewed] [--seed=N]" << endl;
     exit(1);
   }
   domain_size = atoi(argv[1]);
   max_walk_size = atoi(argv[2]);
   num_walkers_per_proc = atoi(argv[3]);
+  for (int a = 4; a < argc; a++) {
+    if (string(argv[a]) == "--async") {
+      async = true;
+    } else if (string(argv[a]) == "--detect-termination") {
+      detect_termination = true;
+    } else if (string(argv[a]) == "--balance") {
+      // The rounds needed to finish depend on the subdomain sizes, which
+      // change when balancing
+      balance = true;
+      detect_termination = true;
+    } else if (string(argv[a]) == "--skewed") {
+      skewed = true;
+    } else if (string(argv[a]).compare(0, 7, "--seed=") == 0) {
+      seed = strtoull(argv[a] + 7, NULL, 10);
+    } else {
+      cerr << "Unknown option " << argv[a] << endl;
+      exit(1);
+    }
+  }
 
-  MPI_Init(NULL, NULL);
+  // Only the main thread calls MPI
+  int provided;
+  MPI_Init_thread(NULL, NULL, MPI_THREAD_FUNNELED, &provided);
+#ifdef _OPENMP
+  if (provided < MPI_THREAD_FUNNELED) {
+    omp_set_num_threads(1);
+  }
+#endif
   int world_size;
   MPI_Comm_size(MPI_COMM_WORLD, &world_size);
   int world_rank;
   MPI_Comm_rank(MPI_COMM_WORLD, &world_rank);
+  create_walker_datatype();
 
-  srand(time(NULL) * world_rank);
+  // Every process draws from its own stream of the seed
+  TMPI_Random random;
+  TMPI_Random_init(&random, seed, world_rank);
+  Decomposition decomposition;
   int subdomain_start, subdomain_size;
-  vector<Walker> incoming_walkers, outgoing_walkers;
+  WalkerVector incoming_walkers;
 
   // Find your part of the domain
-  decompose_domain(domain_size, world_rank, world_size,
-                   &subdomain_start, &subdomain_size);
-  // Initialize walkers in your subdomain
+  decompose_domain(domain_size, 1, world_size, &decomposition);
+  get_subdomain(&decomposition, world_rank, &subdomain_start, &subdomain_size);
+  // Initialize walkers in your subdomain, or all of them in the first part
+  // of the domain for a skewed start. Walkers that start outside of your
+  // subdomain are sent to their owners.
   initialize_walkers(num_walkers_per_proc, max_walk_size, subdomain_start,
+                     domain_size, skewed, max(domain_size / 8, 1), &random,
                      &incoming_walkers);
+  migrate_walkers(&decomposition, &incoming_walkers, world_rank, world_size);
+  if (balance) {
+    rebalance_domain(&decomposition, &incoming_walkers, 1, world_rank,
+                     world_size);
+    get_subdomain(&decomposition, world_rank, &subdomain_start,
+                  &subdomain_size);
+  }
 
-  cout << "Process " << world_rank << " initiated " << num_walkers_per_proc
+  cout << "Process " << world_rank << " initiated " << incoming_walkers.size()
        << " walkers in subdomain " << subdomain_start << " - "
        << subdomain_start + subdomain_size - 1 << endl;
 
   // Determine the maximum amount of sends and receives needed to
   // complete all walkers
-  int maximum_sends_recvs = max_walk_size / (domain_size / world_size) + 1;
-  for (int m = 0; m < maximum_sends_recvs; m++) {
-    // Process all incoming walkers
-    for (int i = 0; i < incoming_walkers.size(); i++) {
-       walk(&incoming_walkers[i], subdomain_start, subdomain_size,
-            domain_size, &outgoing_walkers);
+  int maximum_sends_recvs =
+    max_walk_size / max(domain_size / world_size, 1) + 1;
+  // Or stop when the walkers of all processes are finished
+  TerminationDetector detector;
+  detector.local_finished = 0;
+  detector.total_walkers = (long long)num_walkers_per_proc * world_size;
+  TerminationDetector* detector_ptr = detect_termination ? &detector : NULL;
+
+  MPI_Barrier(MPI_COMM_WORLD);
+  double walk_time = -MPI_Wtime();
+  vector<long long> steps_per_round, allocations_per_round;
+  if (async) {
+    run_async_walk(&incoming_walkers, &decomposition, maximum_sends_recvs,
+                   detector_ptr, balance, &steps_per_round,
+                   &allocations_per_round, world_rank, world_size);
+  } else {
+    run_sync_walk(&incoming_walkers, &decomposition, maximum_sends_recvs,
+                  detector_ptr, balance, &steps_per_round,
+                  &allocations_per_round, world_rank, world_size);
+  }
+  MPI_Barrier(MPI_COMM_WORLD);
+  walk_time += MPI_Wtime();
+  cout << "Process " << world_rank << " done" << endl;
+
+  // Every round takes as long as its busiest process. Compare the steps of
+  // the busiest processes with the steps of perfectly balanced rounds.
+  int num_rounds = steps_per_round.size();
+  vector<long long> max_steps(num_rounds), total_steps(num_rounds);
+  MPI_Reduce(steps_per_round.data(), max_steps.data(), num_rounds,
+             MPI_LONG_LONG, MPI_MAX, 0, MPI_COMM_WORLD);
+  MPI_Reduce(steps_per_round.data(), total_steps.data(), num_rounds,
+             MPI_LONG_LONG, MPI_SUM, 0, MPI_COMM_WORLD);
+  // The walker buffers should stop growing after the first rounds
+  vector<long long> total_allocations(num_rounds);
+  MPI_Reduce(allocations_per_round.data(), total_allocations.data(),
+             num_rounds, MPI_LONG_LONG, MPI_SUM, 0, MPI_COMM_WORLD);
+  if (world_rank == 0) {
+    long long busiest_steps = 0, all_steps = 0;
+    for (int m = 0; m < num_rounds; m++) {
+      busiest_steps += max_steps[m];
+      all_steps += total_steps[m];
     }
-    cout << "Process " << world_rank << " sending " << outgoing_walkers.size()
-         << " outgoing walkers to process " << (world_rank + 1) % world_size
+    cout << "Walk time = " << walk_time << " in " << num_rounds << " rounds"
          << endl;
-    if (world_rank % 2 == 0) {
-      // Send all outgoing walkers to the next process.
-      send_outgoing_walkers(&outgoing_walkers, world_rank,
-                            world_size);
-      // Receive all the new incoming walkers
-      receive_incoming_walkers(&incoming_walkers, world_rank,
-                               world_size);
-    } else {
-      // Receive all the new incoming walkers
-      receive_incoming_walkers(&incoming_walkers, world_rank,
-                               world_size);
-      // Send all outgoing walkers to the next process.
-      send_outgoing_walkers(&outgoing_walkers, world_rank,
-                            world_size);
+    cout << "Load balance = "
+         << (busiest_steps > 0 ? all_steps / (double)busiest_steps / world_size
+                               : 1.0)
+         << " (" << all_steps << " steps, " << busiest_steps
+         << " steps on the busiest processes)" << endl;
+    long long all_allocations = 0;
+    int last_allocation_round = -1;
+    for (int m = 0; m < num_rounds; m++) {
+      all_allocations += total_allocations[m];
+      if (total_allocations[m] > 0) {
+        last_allocation_round = m;
+      }
     }
-    cout << "Process " << world_rank << " received " << incoming_walkers.size()
-         << " incoming walkers" << endl;
+    cout << "Walker buffer allocations = " << all_allocations;
+    if (last_allocation_round >= 0) {
+      cout << " (none after round " << last_allocation_round << ")";
+    }
+    cout << endl;
   }
-  cout << "Process " << world_rank << " done" << endl;
+  MPI_Type_free(&walker_datatype);
   MPI_Finalize();
   return 0;
 }
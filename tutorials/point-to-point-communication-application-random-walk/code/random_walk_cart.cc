@@ -0,0 +1,235 @@
+// Author: Wes Kendall
+// Copyright 2011 www.mpitutorial.com
+// This code is provided freely with the tutorials on mpitutorial.com. Feel
+// free to modify it for your own use. Any distribution of the code must
+// either provide a link to www.mpitutorial.com or keep this header intact.
+//
+// Random walking in one, two, or three dimensions. Walkers step in a random
+// direction along a random dimension, so they can leave a subdomain on any
+// side. The domain is decomposed with MPI_Cart_create, and walkers are only
+// exchanged with the neighboring processes with MPI_Neighbor_alltoallv.
+//
+#include <iostream>
+#include <vector>
+#include <cstdlib>
+#include <mpi.h>
+#include "tmpi_random.h"
+
+using namespace std;
+
+const int MAX_DIMS = 3;
+
+typedef struct {
+  int location[MAX_DIMS];
+  int num_steps_left_in_walk;
+} Walker;
+
+// The part of the domain owned by a process in every dimension
+typedef struct {
+  int num_dims;
+  int start[MAX_DIMS];
+  int size[MAX_DIMS];
+} Subdomain;
+
+// Creates a periodic Cartesian communicator with about the same amount of
+// processes in every dimension
+MPI_Comm create_cart_comm(int num_dims) {
+  int world_size;
+  MPI_Comm_size(MPI_COMM_WORLD, &world_size);
+  int dims[MAX_DIMS] = {0, 0, 0};
+  int periods[MAX_DIMS] = {1, 1, 1};
+  MPI_Dims_create(world_size, num_dims, dims);
+  MPI_Comm cart_comm;
+  MPI_Cart_create(MPI_COMM_WORLD, num_dims, dims, periods, 1, &cart_comm);
+  return cart_comm;
+}
+
+void decompose_domain(int domain_size, int num_dims, MPI_Comm cart_comm,
+                      Subdomain* subdomain) {
+  int dims[MAX_DIMS], periods[MAX_DIMS], coords[MAX_DIMS];
+  MPI_Cart_get(cart_comm, num_dims, dims, periods, coords);
+  subdomain->num_dims = num_dims;
+  for (int d = 0; d < num_dims; d++) {
+    if (dims[d] > domain_size) {
+      // Don't worry about this special case. Assume the domain size
+      // is greater than the amount of processes in every dimension.
+      MPI_Abort(MPI_COMM_WORLD, 1);
+    }
+    subdomain->start[d] = domain_size / dims[d] * coords[d];
+    subdomain->size[d] = domain_size / dims[d];
+    if (coords[d] == dims[d] - 1) {
+      // Give remainder to last process in the dimension
+      subdomain->size[d] += domain_size % dims[d];
+    }
+  }
+}
+
+void initialize_walkers(int num_walkers_per_proc, int max_walk_size,
+                        const Subdomain* subdomain, TMPI_Random* random,
+                        vector<Walker>* incoming_walkers) {
+  Walker walker;
+  for (int i = 0; i < num_walkers_per_proc; i++) {
+    // Initialize walkers at random locations of the subdomain
+    for (int d = 0; d < subdomain->num_dims; d++) {
+      walker.location[d] = subdomain->start[d] +
+        TMPI_Random_int(random, subdomain->size[d]);
+    }
+    walker.num_steps_left_in_walk = TMPI_Random_int(random, max_walk_size + 1);
+    incoming_walkers->push_back(walker);
+  }
+}
+
+// Walks the walker until it is finished or leaves the subdomain. Every step
+// goes one unit up or down along one of the dimensions. Returns -1 if the
+// walker finished. Otherwise returns the neighbor it leaves to, which is
+// 2 * d for the lower side and 2 * d + 1 for the upper side of dimension d.
+// This is the order of the neighbors of a Cartesian communicator.
+int walk(Walker* walker, const Subdomain* subdomain, int domain_size,
+         TMPI_Random* random) {
+  while (walker->num_steps_left_in_walk > 0) {
+    int direction = TMPI_Random_int(random, 2 * subdomain->num_dims);
+    int d = direction / 2;
+    walker->location[d] += (direction % 2 == 0) ? -1 : 1;
+    walker->num_steps_left_in_walk--;
+    if (subdomain->size[d] == domain_size) {
+      // The process owns the whole dimension, so the walker stays and only
+      // wraps around
+      walker->location[d] = (walker->location[d] + domain_size) % domain_size;
+      continue;
+    }
+    if (walker->location[d] < subdomain->start[d]) {
+      // Take care of the case when the walker leaves the beginning of the
+      // domain by wrapping it around to the end
+      if (walker->location[d] < 0) {
+        walker->location[d] = domain_size - 1;
+      }
+      return 2 * d;
+    }
+    if (walker->location[d] >= subdomain->start[d] + subdomain->size[d]) {
+      if (walker->location[d] == domain_size) {
+        walker->location[d] = 0;
+      }
+      return 2 * d + 1;
+    }
+  }
+  return -1;
+}
+
+// Sends the outgoing walkers of every neighbor to it and receives the walkers
+// of all neighbors. The walker counts are exchanged first so that every
+// process can size its receive buffer. Only neighbors communicate, so the
+// metadata does not grow with the amount of processes.
+void exchange_walkers(vector<vector<Walker> >* outgoing_walkers,
+                      vector<Walker>* incoming_walkers, MPI_Comm cart_comm) {
+  int num_neighbors = outgoing_walkers->size();
+  vector<int> send_counts(num_neighbors), recv_counts(num_neighbors);
+  for (int i = 0; i < num_neighbors; i++) {
+    send_counts[i] = (*outgoing_walkers)[i].size() * sizeof(Walker);
+  }
+  MPI_Neighbor_alltoall(send_counts.data(), 1, MPI_INT, recv_counts.data(), 1,
+                        MPI_INT, cart_comm);
+
+  // Pack the walkers of all neighbors in one buffer
+  vector<int> send_offsets(num_neighbors, 0), recv_offsets(num_neighbors, 0);
+  for (int i = 1; i < num_neighbors; i++) {
+    send_offsets[i] = send_offsets[i - 1] + send_counts[i - 1];
+    recv_offsets[i] = recv_offsets[i - 1] + recv_counts[i - 1];
+  }
+  vector<Walker> send_walkers;
+  for (int i = 0; i < num_neighbors; i++) {
+    send_walkers.insert(send_walkers.end(), (*outgoing_walkers)[i].begin(),
+                        (*outgoing_walkers)[i].end());
+    (*outgoing_walkers)[i].clear();
+  }
+  incoming_walkers->resize((recv_offsets[num_neighbors - 1] +
+                            recv_counts[num_neighbors - 1]) / sizeof(Walker));
+  MPI_Neighbor_alltoallv((void*)send_walkers.data(), send_counts.data(),
+                         send_offsets.data(), MPI_BYTE,
+                         (void*)incoming_walkers->data(), recv_counts.data(),
+                         recv_offsets.data(), MPI_BYTE, cart_comm);
+}
+
+int main(int argc, char** argv) {
+  if (argc != 5 && argc != 6) {
+    cerr << "Usage: random_walk_cart domain_size max_walk_size "
+         << "num_walkers_per_proc num_dims [seed]" << endl;
+    exit(1);
+  }
+  int domain_size = atoi(argv[1]);
+  int max_walk_size = atoi(argv[2]);
+  int num_walkers_per_proc = atoi(argv[3]);
+  int num_dims = atoi(argv[4]);
+  unsigned long long seed = argc == 6 ? strtoull(argv[5], NULL, 10) :
+    TMPI_RANDOM_DEFAULT_SEED;
+  if (num_dims < 1 || num_dims > MAX_DIMS) {
+    cerr << "num_dims must be between 1 and " << MAX_DIMS << endl;
+    exit(1);
+  }
+
+  MPI_Init(NULL, NULL);
+  int world_size;
+  MPI_Comm_size(MPI_COMM_WORLD, &world_size);
+
+  // Ranks of the Cartesian communicator can differ from the world ranks
+  MPI_Comm cart_comm = create_cart_comm(num_dims);
+  int cart_rank;
+  MPI_Comm_rank(cart_comm, &cart_rank);
+
+  TMPI_Random random;
+  TMPI_Random_init(&random, seed, cart_rank);
+  Subdomain subdomain;
+  vector<Walker> incoming_walkers;
+  // Every dimension has a lower and an upper neighbor
+  vector<vector<Walker> > outgoing_walkers(2 * num_dims);
+
+  // Find your part of the domain
+  decompose_domain(domain_size, num_dims, cart_comm, &subdomain);
+  // Initialize walkers in your subdomain
+  initialize_walkers(num_walkers_per_proc, max_walk_size, &subdomain, &random,
+                     &incoming_walkers);
+
+  cout << "Process " << cart_rank << " initiated " << num_walkers_per_proc
+       << " walkers in subdomain";
+  for (int d = 0; d < num_dims; d++) {
+    cout << (d == 0 ? " " : " x ") << subdomain.start[d] << " - "
+         << subdomain.start[d] + subdomain.size[d] - 1;
+  }
+  cout << endl;
+
+  // Walkers can walk back and forth between processes, so there is no bound
+  // on the amount of exchanges. Instead, count the finished walkers of all
+  // processes while the walkers are exchanged and stop when all are finished.
+  long long total_walkers = (long long)num_walkers_per_proc * world_size;
+  long long num_finished = 0, reduced_finished, global_finished;
+  int num_rounds = 0;
+  MPI_Barrier(cart_comm);
+  double walk_time = -MPI_Wtime();
+  do {
+    for (int i = 0; i < incoming_walkers.size(); i++) {
+      int neighbor = walk(&incoming_walkers[i], &subdomain, domain_size,
+                          &random);
+      if (neighbor < 0) {
+        num_finished++;
+      } else {
+        outgoing_walkers[neighbor].push_back(incoming_walkers[i]);
+      }
+    }
+    MPI_Request request;
+    reduced_finished = num_finished;
+    MPI_Iallreduce(&reduced_finished, &global_finished, 1, MPI_LONG_LONG,
+                   MPI_SUM, cart_comm, &request);
+    exchange_walkers(&outgoing_walkers, &incoming_walkers, cart_comm);
+    MPI_Wait(&request, MPI_STATUS_IGNORE);
+    num_rounds++;
+  } while (global_finished < total_walkers);
+  walk_time += MPI_Wtime();
+
+  cout << "Process " << cart_rank << " done" << endl;
+  if (cart_rank == 0) {
+    cout << "Walk time = " << walk_time << " in " << num_rounds << " rounds"
+         << endl;
+  }
+  MPI_Comm_free(&cart_comm);
+  MPI_Finalize();
+  return 0;
+}
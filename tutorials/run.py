@@ -4,7 +4,9 @@ import os
 import subprocess
 
 # Enter runnable programs here, keyed on the program executable name and followed
-# by a tuple of the tutorial name and the default number of nodes
+# by a tuple of the tutorial name and the default number of nodes. Optional
+# arguments come next, and then the executable name for runs of a program with
+# other arguments.
 programs = {
     # From the mpi-hello-world tutorial
     'mpi_hello_world': ('mpi-hello-world', 4),
@@ -12,29 +14,41 @@ programs = {
     # From mpi-send-and-receive tutorial
     'send_recv': ('mpi-send-and-receive', 2),
     'ping_pong': ('mpi-send-and-receive', 2),
+    'ping_pong_bench': ('mpi-send-and-receive', 2, ['4194304', '1000']),
     'ring': ('mpi-send-and-receive', 5),
 
     # From the dynamic-receiving-with-mpi-probe-and-mpi-status tutorial
     'check_status': ('dynamic-receiving-with-mpi-probe-and-mpi-status', 2),
     'probe': ('dynamic-receiving-with-mpi-probe-and-mpi-status', 2),
+    'bench_probe': ('dynamic-receiving-with-mpi-probe-and-mpi-status', 4, ['100000', '256']),
 
     # From the point-to-point-communication-application-random-walk tutorial
     'random_walk': ('point-to-point-communication-application-random-walk', 5, ['100', '500', '20']),
+    'random_walk_skewed': ('point-to-point-communication-application-random-walk', 4, ['400', '2000', '5000', '--skewed'], 'random_walk'),
+    'random_walk_balanced': ('point-to-point-communication-application-random-walk', 4, ['400', '2000', '5000', '--skewed', '--balance'], 'random_walk'),
+    'random_walk_cart': ('point-to-point-communication-application-random-walk', 4, ['100', '500', '20', '2']),
 
     # From the mpi-broadcast-and-collective-communication tutorial
     'my_bcast': ('mpi-broadcast-and-collective-communication', 4),
     'compare_bcast': ('mpi-broadcast-and-collective-communication', 16, ['100000', '10']),
+    'bench_collectives': ('mpi-broadcast-and-collective-communication', 16, ['1048576', '20', '5', 'csv']),
 
     # From the mpi-scatter-gather-and-allgather tutorial
     'avg': ('mpi-scatter-gather-and-allgather', 4, ['100']),
     'all_avg': ('mpi-scatter-gather-and-allgather', 4, ['100']),
+    'bench_avg': ('mpi-scatter-gather-and-allgather', 4, ['4000000', '10']),
 
     # From the performing-parallel-rank-with-mpi tutorial
     'random_rank': ('performing-parallel-rank-with-mpi', 4, ['100']),
+    'compare_sort': ('performing-parallel-rank-with-mpi', 1, ['10000000']),
 
     # From the mpi-reduce-and-allreduce tutorial
     'reduce_avg': ('mpi-reduce-and-allreduce', 4, ['100']),
     'reduce_stddev': ('mpi-reduce-and-allreduce', 4, ['100']),
+    'bench_allreduce': ('mpi-reduce-and-allreduce', 8, ['16777216', '10']),
+
+    # From the mpi-alltoall-and-v-routines tutorial
+    'bench_alltoall': ('mpi-alltoall-and-v-routines', 8, ['4096', '20']),
 
     # From the groups-and-communicators tutorial
     'comm_split': ('introduction-to-groups-and-communicators', 16),
@@ -54,8 +68,9 @@ else:
     mpirun = os.environ.get('MPIRUN', 'mpirun')
     hosts = '' if not os.environ.get('MPI_HOSTS') else '-f {0}'.format(os.environ.get('MPI_HOSTS'))
 
+    executable = programs[program_to_run][3] if len(programs[program_to_run]) > 3 else program_to_run
     sys_call = '{0} -n {1} {2} ./{3}/code/{4}'.format(
-        mpirun, programs[program_to_run][1], hosts, programs[program_to_run][0], program_to_run)
+        mpirun, programs[program_to_run][1], hosts, programs[program_to_run][0], executable)
 
     if len(programs[program_to_run]) > 2:
         sys_call = '{0} {1}'.format(sys_call, ' '.join(programs[program_to_run][2]))